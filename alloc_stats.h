@@ -0,0 +1,183 @@
+#pragma once
+
+#include <oak_util/types.h>
+
+namespace shrub {
+
+	using namespace oak;
+
+#ifdef SHRUB_ALLOC_STATS
+
+#ifndef SHRUB_ALLOC_SITE_CAPACITY
+#define SHRUB_ALLOC_SITE_CAPACITY 64
+#endif
+
+	struct AllocSite {
+		char const *file;
+		u32 line;
+		u32 count;
+		u32 bytes;
+		u32 lastCount;
+		u32 lastBytes;
+	};
+
+	// Every field is a u32 so the block maps onto a Uint32Array in JS
+	struct AllocStats {
+		char const *name;
+		u32 limit;
+		u32 used;
+		u32 frameCount;
+		u32 frameBytes;
+		u32 framePeak;
+		u32 lastCount;
+		u32 lastBytes;
+		u32 lastPeak;
+		u32 maxPeak;
+		u32 siteCount;
+		AllocSite sites[SHRUB_ALLOC_SITE_CAPACITY];
+	};
+
+	// Allocations are attributed to the innermost ALLOC_SITE scope, wasm has no usable return address
+	struct AllocSiteScope {
+		char const *prevFile;
+		u32 prevLine;
+
+		AllocSiteScope(char const *file, u32 line);
+		~AllocSiteScope();
+
+		AllocSiteScope(AllocSiteScope const&) = delete;
+		AllocSiteScope& operator=(AllocSiteScope const&) = delete;
+	};
+
+	inline char const *allocSiteFile = nullptr;
+	inline u32 allocSiteLine = 0;
+
+	inline AllocSiteScope::AllocSiteScope(char const *file, u32 line)
+		: prevFile{ allocSiteFile }, prevLine{ allocSiteLine } {
+		allocSiteFile = file;
+		allocSiteLine = line;
+	}
+
+	inline AllocSiteScope::~AllocSiteScope() {
+		allocSiteFile = prevFile;
+		allocSiteLine = prevLine;
+	}
+
+	struct TrackingAllocator {
+		Allocator allocator;
+		Allocator *parent = nullptr;
+		AllocStats stats{};
+
+		Allocator* init(char const *name, Allocator *parent_, u64 limit);
+
+		void record_alloc(u64 size);
+		void record_free(u64 size);
+
+		// Latches the frame counters, call before clearing a per-frame arena
+		void end_frame();
+	};
+
+	inline void* tracking_allocate(void *userData, u64 size, u64 alignment) {
+		auto tracker = static_cast<TrackingAllocator*>(userData);
+		tracker->record_alloc(size);
+		return tracker->parent->allocate(size, alignment);
+	}
+
+	inline void tracking_free(void *userData, void *ptr, u64 size) {
+		auto tracker = static_cast<TrackingAllocator*>(userData);
+		tracker->record_free(size);
+		tracker->parent->free(ptr, size);
+	}
+
+	inline void tracking_clear(void *userData) {
+		auto tracker = static_cast<TrackingAllocator*>(userData);
+		tracker->stats.used = 0;
+		// end_frame carried the usage being cleared into the new frame's peak, drop it unless this
+		// frame has allocated since
+		if (tracker->stats.frameCount == 0)
+			tracker->stats.framePeak = 0;
+		tracker->parent->clear();
+	}
+
+	inline Allocator* TrackingAllocator::init(char const *name, Allocator *parent_, u64 limit) {
+		parent = parent_;
+		stats.name = name;
+		stats.limit = static_cast<u32>(limit);
+
+		allocator = {};
+		allocator.userData = this;
+		allocator.allocFn = tracking_allocate;
+		allocator.freeFn = tracking_free;
+		allocator.clearFn = tracking_clear;
+
+		return &allocator;
+	}
+
+	inline void TrackingAllocator::record_alloc(u64 size) {
+		auto bytes = static_cast<u32>(size);
+		++stats.frameCount;
+		stats.frameBytes += bytes;
+		stats.used += bytes;
+		if (stats.used > stats.framePeak)
+			stats.framePeak = stats.used;
+
+#ifdef SHRUB_ALLOC_SITES
+		// Linear probe on the marker identity, overflowing sites are folded into the last slot
+		u32 i = 0;
+		for (; i < stats.siteCount; ++i) {
+			if (stats.sites[i].file == allocSiteFile && stats.sites[i].line == allocSiteLine)
+				break;
+		}
+		if (i == stats.siteCount) {
+			if (stats.siteCount < SHRUB_ALLOC_SITE_CAPACITY) {
+				++stats.siteCount;
+				stats.sites[i] = { allocSiteFile, allocSiteLine, 0, 0, 0, 0 };
+			} else {
+				i = SHRUB_ALLOC_SITE_CAPACITY - 1;
+			}
+		}
+		++stats.sites[i].count;
+		stats.sites[i].bytes += bytes;
+#endif
+	}
+
+	inline void TrackingAllocator::record_free(u64 size) {
+		auto bytes = static_cast<u32>(size);
+		stats.used = bytes > stats.used ? 0 : stats.used - bytes;
+	}
+
+	inline void TrackingAllocator::end_frame() {
+		stats.lastCount = stats.frameCount;
+		stats.lastBytes = stats.frameBytes;
+		stats.lastPeak = stats.framePeak;
+		if (stats.framePeak > stats.maxPeak)
+			stats.maxPeak = stats.framePeak;
+
+		stats.frameCount = 0;
+		stats.frameBytes = 0;
+		stats.framePeak = stats.used;
+
+		for (u32 i = 0; i < stats.siteCount; ++i) {
+			auto& site = stats.sites[i];
+			site.lastCount = site.count;
+			site.lastBytes = site.bytes;
+			site.count = 0;
+			site.bytes = 0;
+		}
+	}
+
+#endif
+
+#if defined(SHRUB_ALLOC_STATS) && defined(SHRUB_ALLOC_SITES)
+
+#define SHRUB_ALLOC_CONCAT_(a, b) a##b
+#define SHRUB_ALLOC_CONCAT(a, b) SHRUB_ALLOC_CONCAT_(a, b)
+#define ALLOC_SITE() ::shrub::AllocSiteScope SHRUB_ALLOC_CONCAT(allocSite_, __LINE__){ __FILE__, __LINE__ }
+
+#else
+
+#define ALLOC_SITE() do {} while (0)
+
+#endif
+
+}
@@ -0,0 +1,854 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <oak_util/types.h>
+#include <oak_math/math.h>
+
+#include "shrub.h"
+#include "geometry_cache.h"
+#include "msdf.h"
+#include "profile.h"
+
+using namespace oak;
+using namespace shrub;
+
+// oak_util is built freestanding, back it with the C runtime
+extern "C" usize get_page_size_freestanding() {
+	return 4096;
+}
+
+extern "C" void* virtual_alloc_freestanding(usize size) {
+	return malloc(size);
+}
+
+extern "C" bool virtual_try_grow_freestanding(void *addr, usize size, usize nSize) {
+	(void)addr;
+	(void)size;
+	(void)nSize;
+	return false;
+}
+
+extern "C" void virtual_free_freestanding(void *addr, usize size) {
+	(void)size;
+	free(addr);
+}
+
+extern "C" i32 commit_region_freestanding(void *addr, usize size) {
+	(void)addr;
+	(void)size;
+	return 0;
+}
+
+extern "C" i32 decommit_region_freestanding(void *addr, usize size) {
+	(void)addr;
+	(void)size;
+	return 0;
+}
+
+namespace {
+
+	// Stands in for the staging buffer, uploads are copied so the cost of moving vertices stays measured
+	constexpr usize stagingSinkSize = 16 << 20;
+	unsigned char stagingSink[stagingSinkSize + 4096];
+
+}
+
+extern "C" void webgl_buffer_sub_data(GLenum target, GLintptr offset, void const *data, GLsizeiptr size) {
+	(void)target;
+	auto dst = static_cast<usize>(offset) & (stagingSinkSize - 1);
+	memcpy(stagingSink + dst, data, static_cast<usize>(size) < 4096 ? static_cast<usize>(size) : 4096);
+}
+
+// The GPU side of GeometryCache, nothing to do without a context
+extern "C" int webgl_create_buffer() {
+	return 1;
+}
+
+extern "C" void webgl_bind_buffer(GLenum target, int buffer) {
+	(void)target;
+	(void)buffer;
+}
+
+extern "C" void webgl_buffer_data(GLenum target, GLsizeiptr size, GLenum usage) {
+	(void)target;
+	(void)size;
+	(void)usage;
+}
+
+extern "C" void webgl_copy_buffer_sub_data(
+		GLenum readTarget, GLenum writeTarget, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size) {
+	(void)readTarget;
+	(void)writeTarget;
+	(void)readOffset;
+	(void)writeOffset;
+	(void)size;
+}
+
+namespace {
+
+	enum class SceneShape {
+		// Every element is the only child of the previous one
+		CHAIN,
+		// Every element is a child of the root
+		FAN,
+		// Complete tree with a branching factor of 4
+		BALANCED,
+	};
+
+	char const *shapeNames[] = { "chain", "fan", "balanced" };
+
+	struct Rng {
+		u64 state;
+
+		u32 next() {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			return static_cast<u32>(state >> 32);
+		}
+
+		f32 range(f32 lo, f32 hi) {
+			return lo + (hi - lo) * static_cast<f32>(next() >> 8) * (1.f / 16777216.f);
+		}
+	};
+
+	struct Scene {
+		SceneShape shape;
+		i32 nodeCount;
+		ElementTree tree;
+		Vector<DrawCommand> drawCommands;
+		DrawCommand *unsortedCommands;
+		DrawCommand *sortedCommands;
+		DrawCommand *sortScratch;
+		DrawBatch *batches;
+		GeometryCache geometry;
+		ClipPlan clips;
+		Vec2 *queries;
+		i32 queryCount;
+	};
+
+	void build_scene(Scene *scene) {
+		auto& tree = scene->tree;
+		auto rng = Rng{ 0x9E3779B97F4A7C15ull ^ static_cast<u64>(scene->nodeCount) };
+
+		tree.begin_ui();
+		for (i32 i = 0; i < scene->nodeCount; ++i) {
+			auto parent = ElementIndex{ -1 };
+			if (i > 0) {
+				switch (scene->shape) {
+				case SceneShape::CHAIN: parent = { i - 1 }; break;
+				case SceneShape::FAN: parent = { 0 }; break;
+				case SceneShape::BALANCED: parent = { (i - 1) / 4 }; break;
+				}
+			}
+			auto elem = Element::from_id({ static_cast<u64>(i) + 1 });
+			// Keep deep chains inside a sane coordinate range
+			elem.pos = scene->shape == SceneShape::CHAIN
+				? Vec2{ rng.range(-1.f, 1.f), rng.range(-1.f, 1.f) }
+				: Vec2{ rng.range(0.f, 780.f), rng.range(0.f, 580.f) };
+			elem.extent = { rng.range(8.f, 64.f), rng.range(8.f, 64.f) };
+			tree.push_element(parent, elem);
+		}
+		tree.end_ui();
+	}
+
+	void prepare_scene(Scene *scene, Allocator *allocator) {
+		scene->tree.init(allocator, scene->nodeCount);
+		build_scene(scene);
+
+		scene->drawCommands.reserve(allocator, scene->nodeCount);
+		auto rng = Rng{ 0xD1B54A32D192ED03ull };
+		for (i32 i = 0; i < scene->nodeCount; ++i) {
+			auto key = make_sort_key(0, false, 0, 0, static_cast<u32>(i));
+			push(&scene->drawCommands, { { i }, { rng.range(0.f, 1.f), rng.range(0.f, 1.f), rng.range(0.f, 1.f), 1.f }, key });
+		}
+		scene->batches = allocate<DrawBatch>(allocator, scene->nodeCount);
+		scene->geometry.init(allocator, scene->nodeCount * 6, scene->nodeCount * 2);
+		scene->clips.plan(allocator, scene->tree, scene->drawCommands.data, scene->drawCommands.count);
+
+		// A handful of programs and textures with one in eight draws translucent, roughly what a styled UI submits
+		scene->unsortedCommands = allocate<DrawCommand>(allocator, scene->nodeCount);
+		scene->sortedCommands = allocate<DrawCommand>(allocator, scene->nodeCount);
+		scene->sortScratch = allocate<DrawCommand>(allocator, scene->nodeCount);
+		for (i32 i = 0; i < scene->nodeCount; ++i) {
+			auto bits = rng.next();
+			scene->unsortedCommands[i] = scene->drawCommands[i];
+			scene->unsortedCommands[i].sortKey =
+				make_sort_key(0, (bits & 7) == 0, (bits >> 3) & 7, (bits >> 6) & 15, static_cast<u32>(i));
+		}
+
+		scene->queryCount = 64;
+		scene->queries = allocate<Vec2>(allocator, scene->queryCount);
+		for (i32 i = 0; i < scene->queryCount; ++i)
+			scene->queries[i] = { rng.range(0.f, 800.f), rng.range(0.f, 600.f) };
+	}
+
+	// Returns the number of items processed, used for per-item timings
+	using BenchFn = i64 (*)(Scene *scene);
+
+	i64 bench_push_element(Scene *scene) {
+		build_scene(scene);
+		return scene->nodeCount;
+	}
+
+	i64 bench_layout(Scene *scene) {
+		scene->tree.layout();
+		return scene->nodeCount;
+	}
+
+	i64 bench_transform(Scene *scene) {
+		scene->tree.transform();
+		return scene->nodeCount;
+	}
+
+	i64 bench_hit_test(Scene *scene) {
+		i32 hits = 0;
+		for (i32 i = 0; i < scene->queryCount; ++i)
+			hits += scene->tree.hit_test(scene->queries[i]).index >= 0;
+		// Keep the loop observable
+		stagingSink[stagingSinkSize] = static_cast<unsigned char>(hits);
+		return scene->queryCount;
+	}
+
+	i64 bench_push_rectangle(Scene *scene) {
+		GLintptr offset = 0;
+		auto const& tree = scene->tree;
+		for (i32 i = 0; i < tree.elementCount; ++i)
+			push_rectangle(&offset, tree.positions[i], tree.elements[i].extent, element_depth({ i }), { 1.f, 1.f, 1.f, 1.f });
+		return tree.elementCount;
+	}
+
+	i64 bench_draw_commands(Scene *scene) {
+		GLintptr offset = 0;
+		push_draw_commands(&offset, scene->tree, scene->drawCommands.data, scene->drawCommands.count, scene->batches);
+		return scene->drawCommands.count;
+	}
+
+	// Steady state once warmed up, every range is already resident so this is the per-frame cost of an
+	// unchanged scene
+	i64 bench_retained_draw_commands(Scene *scene) {
+		auto& geometry = scene->geometry;
+		geometry.begin_frame();
+		retain_draw_commands(&geometry, scene->tree, scene->clips, {}, scene->drawCommands.data, scene->drawCommands.count);
+		geometry.end_frame(0);
+		geometry.upload(1 << 20);
+		batch_draw_commands(
+			geometry, scene->tree, scene->clips, scene->drawCommands.data, scene->drawCommands.count, scene->batches);
+		return scene->drawCommands.count;
+	}
+
+	// Roughly half of the fan and balanced scenes fall outside the viewport
+	i64 bench_cull(Scene *scene) {
+		scene->tree.cull({ { 0.f, 0.f }, { 800.f, 600.f } });
+		cull_hidden_commands(scene->tree, {}, scene->drawCommands.data, scene->drawCommands.count, scene->sortedCommands);
+		return scene->nodeCount;
+	}
+
+	// The sort is in place, copying the unsorted commands in is part of the timing
+	i64 bench_sort_draw_commands(Scene *scene) {
+		auto count = scene->drawCommands.count;
+		for (i64 i = 0; i < count; ++i)
+			scene->sortedCommands[i] = scene->unsortedCommands[i];
+		sort_draw_commands(scene->sortedCommands, scene->sortScratch, count);
+		return count;
+	}
+
+	struct Bench {
+		char const *name;
+		BenchFn fn;
+	};
+
+	Bench benches[] = {
+		{ "push_element", bench_push_element },
+		{ "layout", bench_layout },
+		{ "transform", bench_transform },
+		{ "hit_test", bench_hit_test },
+		{ "cull", bench_cull },
+		{ "push_rectangle", bench_push_rectangle },
+		{ "draw_commands", bench_draw_commands },
+		{ "sort_draw_commands", bench_sort_draw_commands },
+		{ "retained_draw_commands", bench_retained_draw_commands },
+	};
+
+	struct Options {
+		i32 repeat = 10;
+		i32 warmup = 2;
+		i32 maxNodes = 1000000;
+		char const *filter = nullptr;
+		char const *outPath = nullptr;
+		char const *baselinePath = nullptr;
+		// Relative slowdown of the median that counts as a regression
+		f64 threshold = 0.10;
+		// Benchmarks missing from the baseline are reported instead of failing
+		bool acceptNew = false;
+		// Runs a correctness check instead of the benchmarks
+		char const *check = nullptr;
+	};
+
+	struct Result {
+		char name[128];
+		f64 median;
+		f64 mad;
+		// Median of the calibration samples taken between this benchmark's samples, 0 when unknown
+		f64 calibration;
+	};
+
+	constexpr i32 maxResults = 256;
+
+	int compare_f64(void const *a, void const *b) {
+		auto x = *static_cast<f64 const*>(a);
+		auto y = *static_cast<f64 const*>(b);
+		return x < y ? -1 : x > y ? 1 : 0;
+	}
+
+	// values must be sorted
+	f64 median_of(f64 const *values, i32 count) {
+		return count % 2
+			? values[count / 2]
+			: (values[count / 2 - 1] + values[count / 2]) * 0.5;
+	}
+
+	int compare_u32(void const *a, void const *b) {
+		auto x = *static_cast<u32 const*>(a);
+		auto y = *static_cast<u32 const*>(b);
+		return x < y ? -1 : x > y ? 1 : 0;
+	}
+
+	// Fixed workload that runs none of shrub, timed after every benchmark sample. Medians are compared
+	// as multiples of it, which cancels out how fast the machine is and how loaded it was at the time.
+	f64 time_calibration() {
+		static u32 values[1 << 14];
+		u32 state = 0x9e3779b9u;
+		auto begin = profile_now();
+		for (auto& value : values) {
+			state = state * 1664525u + 1013904223u;
+			value = state;
+		}
+		qsort(values, sizeof(values) / sizeof(values[0]), sizeof(u32), compare_u32);
+		return (profile_now() - begin) * 1000000.0;
+	}
+
+	// CPU the benchmarks ran on, recorded in the output so a baseline says where it came from
+	void machine_name(char *out, usize size) {
+		snprintf(out, size, "unknown");
+		auto file = fopen("/proc/cpuinfo", "rb");
+		if (!file)
+			return;
+		char line[256];
+		while (fgets(line, sizeof(line), file)) {
+			auto colon = strchr(line, ':');
+			if (strncmp(line, "model name", 10) != 0 || !colon)
+				continue;
+			auto name = colon + 1;
+			while (*name == ' ')
+				++name;
+			auto length = strcspn(name, "\"\\\r\n");
+			snprintf(out, size, "%.*s", static_cast<int>(length), name);
+			break;
+		}
+		fclose(file);
+	}
+
+	// Median absolute deviation, scratch must hold count values
+	f64 mad_of(f64 const *sorted, f64 *scratch, i32 count) {
+		auto median = median_of(sorted, count);
+		for (i32 i = 0; i < count; ++i)
+			scratch[i] = sorted[i] > median ? sorted[i] - median : median - sorted[i];
+		qsort(scratch, static_cast<usize>(count), sizeof(f64), compare_f64);
+		return median_of(scratch, count);
+	}
+
+	// Value of a "key": number field of the entry running from entry to next, -1 when it has none
+	f64 read_field(char const *entry, char const *next, char const *key) {
+		auto field = strstr(entry, key);
+		if (!field || (next && field > next))
+			return -1.0;
+		return strtod(field + strlen(key), nullptr);
+	}
+
+	// Reads name, median_ns, mad_ns and calibration_ns back out of a file written by --out
+	i32 load_baseline(char const *path, Result *results, i32 capacity) {
+		auto file = fopen(path, "rb");
+		if (!file)
+			return -1;
+		fseek(file, 0, SEEK_END);
+		auto size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		auto text = static_cast<char*>(malloc(static_cast<usize>(size) + 1));
+		auto read = fread(text, 1, static_cast<usize>(size), file);
+		text[read] = '\0';
+		fclose(file);
+
+		i32 count = 0;
+		auto cursor = text;
+		while (count < capacity && (cursor = strstr(cursor, "\"name\": \""))) {
+			cursor += 9;
+			auto end = strchr(cursor, '"');
+			if (!end)
+				break;
+			auto& result = results[count];
+			auto length = end - cursor;
+			if (length >= static_cast<isize>(sizeof(result.name)))
+				length = sizeof(result.name) - 1;
+			memcpy(result.name, cursor, static_cast<usize>(length));
+			result.name[length] = '\0';
+			auto next = strstr(end, "\"name\": \"");
+			result.median = read_field(end, next, "\"median_ns\": ");
+			result.mad = read_field(end, next, "\"mad_ns\": ");
+			if (result.median < 0.0 || result.mad < 0.0)
+				break;
+			auto calibration = read_field(end, next, "\"calibration_ns\": ");
+			result.calibration = calibration > 0.0 ? calibration : 0.0;
+			cursor = end;
+			++count;
+		}
+
+		free(text);
+		return count;
+	}
+
+	// Medians and MADs are divided by the calibration time of their own run first, so a baseline recorded on
+	// another machine or under another load still compares. A benchmark regresses when its scaled median is
+	// slower by more than the threshold and the slowdown also clears three scaled MADs of either run, so
+	// noisy benchmarks need a bigger shift to fail. A benchmark missing from the baseline fails too unless
+	// acceptNew is set, so a new or changed benchmark can't pass unchecked until the baseline is re-recorded.
+	// A baseline entry without a calibration can't be scaled and always fails.
+	i32 compare_baseline(Result const *results, i32 count, Result const *baseline, i32 baselineCount, f64 threshold, bool acceptNew) {
+		i32 failures = 0;
+		fprintf(stderr, "%-40s %14s %14s %8s\n", "benchmark", "baseline x cal", "median x cal", "change");
+		for (i32 i = 0; i < count; ++i) {
+			auto const& result = results[i];
+			Result const *base = nullptr;
+			for (i32 j = 0; j < baselineCount; ++j) {
+				if (strcmp(baseline[j].name, result.name) == 0) {
+					base = &baseline[j];
+					break;
+				}
+			}
+			auto median = result.median / result.calibration;
+			if (!base) {
+				fprintf(stderr, "%-40s %14s %14.4f %8s  %s\n", result.name, "-", median, "-", acceptNew ? "new" : "NO BASELINE");
+				failures += !acceptNew;
+				continue;
+			}
+			if (base->calibration <= 0.0) {
+				fprintf(stderr, "%-40s %14s %14.4f %8s  NO CALIBRATION, re-record the baseline\n", result.name, "-", median, "-");
+				++failures;
+				continue;
+			}
+
+			auto baseMedian = base->median / base->calibration;
+			auto mad = result.mad / result.calibration;
+			auto baseMad = base->mad / base->calibration;
+			auto delta = median - baseMedian;
+			auto noise = 3.0 * 1.4826 * (mad > baseMad ? mad : baseMad);
+			auto change = baseMedian > 0.0 ? delta / baseMedian : 0.0;
+			bool regressed = change > threshold && delta > noise;
+			failures += regressed;
+
+			fprintf(stderr, "%-40s %14.4f %14.4f %+7.1f%%%s\n",
+				result.name, baseMedian, median, change * 100.0, regressed ? "  REGRESSED" : "");
+		}
+		return failures;
+	}
+
+	// Distance fields are checked against a brute force reference of the same outline, flattened finely
+	// and signed by winding number, in doubles
+	struct ReferenceOutline {
+		static constexpr i32 stepsPerEdge = 256;
+		static constexpr i32 maxPoints = 64 * stepsPerEdge;
+
+		f64 xs[maxPoints];
+		f64 ys[maxPoints];
+		// Each contour is a closed polyline from contourStarts[c] to contourStarts[c + 1]
+		i32 contourStarts[17];
+		i32 contourCount;
+
+		void flatten(Outline const& outline) {
+			i32 count = 0;
+			contourCount = outline.contourCount;
+			for (i32 c = 0; c < outline.contourCount; ++c) {
+				contourStarts[c] = count;
+				auto const& contour = outline.contours[c];
+				for (i32 e = 0; e < contour.edgeCount; ++e) {
+					auto const& edge = outline.edges[contour.firstEdge + e];
+					f64 px[3];
+					f64 py[3];
+					for (i32 p = 0; p < 3; ++p) {
+						px[p] = static_cast<f64>(edge.p[p].x);
+						py[p] = static_cast<f64>(edge.p[p].y);
+					}
+					for (i32 step = 0; step < stepsPerEdge; ++step) {
+						auto t = static_cast<f64>(step) / stepsPerEdge;
+						if (edge.quadratic) {
+							auto u = 1.0 - t;
+							xs[count] = u * u * px[0] + 2.0 * u * t * px[1] + t * t * px[2];
+							ys[count] = u * u * py[0] + 2.0 * u * t * py[1] + t * t * py[2];
+						} else {
+							xs[count] = px[0] + t * (px[1] - px[0]);
+							ys[count] = py[0] + t * (py[1] - py[0]);
+						}
+						++count;
+					}
+				}
+			}
+			contourStarts[contourCount] = count;
+		}
+
+		// Positive inside
+		f64 distance(f64 x, f64 y) const {
+			auto nearest = 1e30;
+			i32 winding = 0;
+			for (i32 c = 0; c < contourCount; ++c) {
+				auto first = contourStarts[c];
+				auto end = contourStarts[c + 1];
+				for (i32 i = first; i < end; ++i) {
+					auto j = i + 1 < end ? i + 1 : first;
+					auto dx = xs[j] - xs[i];
+					auto dy = ys[j] - ys[i];
+					auto lengthSq = dx * dx + dy * dy;
+					auto t = lengthSq > 0.0 ? ((x - xs[i]) * dx + (y - ys[i]) * dy) / lengthSq : 0.0;
+					t = t < 0.0 ? 0.0 : t > 1.0 ? 1.0 : t;
+					auto ex = xs[i] + t * dx - x;
+					auto ey = ys[i] + t * dy - y;
+					auto d = sqrt(ex * ex + ey * ey);
+					nearest = d < nearest ? d : nearest;
+
+					if ((ys[i] <= y) != (ys[j] <= y)) {
+						auto crossing = xs[i] + (y - ys[i]) / (ys[j] - ys[i]) * dx;
+						if (crossing > x)
+							winding += ys[j] > ys[i] ? 1 : -1;
+					}
+				}
+			}
+			return winding ? nearest : -nearest;
+		}
+	};
+
+	struct MsdfCase {
+		char const *name;
+		void (*build)(Outline *outline);
+	};
+
+	void build_square(Outline *outline) {
+		outline->move_to({ 0.1f, 0.1f });
+		outline->line_to({ 0.9f, 0.1f });
+		outline->line_to({ 0.9f, 0.9f });
+		outline->line_to({ 0.1f, 0.9f });
+		outline->close();
+	}
+
+	// Clockwise, as TrueType outlines are
+	void build_sliver(Outline *outline) {
+		outline->move_to({ 0.1f, 0.2f });
+		outline->line_to({ 0.5f, 0.95f });
+		outline->line_to({ 0.9f, 0.2f });
+		outline->line_to({ 0.5f, 0.35f });
+		outline->close();
+	}
+
+	// A ring of quadratics around a hole running the other way
+	void build_ring(Outline *outline) {
+		auto const step = 3.14159265358979 / 8.0;
+		for (i32 ring = 0; ring < 2; ++ring) {
+			auto r = ring ? 0.22 : 0.42;
+			auto direction = ring ? -1.0 : 1.0;
+			auto point = [&](i32 half, f64 radius) {
+				return Vec2{ static_cast<f32>(0.5 + radius * cos(half * step)),
+					static_cast<f32>(0.5 + direction * radius * sin(half * step)) };
+			};
+			// Controls sit where the tangents at the points 45 degrees apart meet
+			outline->move_to(point(0, r));
+			for (i32 i = 1; i <= 8; ++i)
+				outline->quad_to(point(2 * i - 1, r / cos(step)), point(2 * i, r));
+			outline->close();
+		}
+	}
+
+	// One corner and two curved edges, the edge coloring has to split them
+	void build_teardrop(Outline *outline) {
+		outline->move_to({ 0.5f, 0.95f });
+		outline->quad_to({ -0.1f, 0.05f }, { 0.5f, 0.05f });
+		outline->quad_to({ 1.1f, 0.05f }, { 0.5f, 0.95f });
+		outline->close();
+	}
+
+	MsdfCase msdfCases[] = {
+		{ "square", build_square },
+		{ "sliver", build_sliver },
+		{ "ring", build_ring },
+		{ "teardrop", build_teardrop },
+	};
+
+	// Two measures per outline and size: how far the true distance in alpha is from the reference within the
+	// range, and how many points between texels the bilinearly filtered median puts on the wrong side of the
+	// outline, which is what shows up as rounded corners or artifacts when the field is drawn magnified. A
+	// single channel field already gets the sliver's tip wrong.
+	i32 check_msdf(Allocator *allocator) {
+		auto outline = Outline{};
+		outline.init(allocator, 256, 16);
+		auto reference = static_cast<ReferenceOutline*>(malloc(sizeof(ReferenceOutline)));
+		auto capacity = 256 * 256 * 4;
+		auto pixels = static_cast<u8*>(malloc(static_cast<usize>(capacity)));
+
+		// Half a step of the 8 bit encoding, plus flattening and f32 slack
+		auto const range = static_cast<f64>(msdfRange);
+		auto const quantization = 2.0 * range / 255.0;
+		auto const distanceTolerance = quantization * 0.5 + 0.02;
+		i32 failures = 0;
+
+		f32 const scales[] = { 16.f, 32.f, 64.f };
+		for (auto const& test : msdfCases) {
+			for (auto scale : scales) {
+				outline.clear();
+				test.build(&outline);
+				auto metrics = GlyphMetrics{};
+				if (!generate_msdf_glyph(&outline, scale, &metrics, pixels, capacity)) {
+					fprintf(stderr, "msdf %s/%g: generation failed\n", test.name, static_cast<f64>(scale));
+					++failures;
+					continue;
+				}
+				reference->flatten(outline);
+
+				auto s = static_cast<f64>(scale);
+				auto width = metrics.width;
+				auto height = metrics.height;
+				auto originX = static_cast<f64>(metrics.bearingX) / s;
+				auto originY = (static_cast<f64>(metrics.bearingY) - height) / s;
+				auto decode = [&](i32 column, i32 row, i32 channel) {
+					auto value = pixels[4 * (row * width + column) + channel] / 255.0;
+					return (value - 0.5) * 2.0 * range;
+				};
+
+				auto maxDistanceError = 0.0;
+				for (i32 row = 0; row < height; ++row) {
+					for (i32 column = 0; column < width; ++column) {
+						auto x = originX + (column + 0.5) / s;
+						auto y = originY + (height - 1 - row + 0.5) / s;
+						auto expected = reference->distance(x, y) * s;
+						if (fabs(expected) > range - quantization)
+							continue;
+						auto error = fabs(decode(column, row, 3) - expected);
+						maxDistanceError = error > maxDistanceError ? error : maxDistanceError;
+					}
+				}
+
+				// Four points per texel, away from the outline by more than the encoding can resolve
+				i32 wrongSide = 0;
+				i32 samples = 0;
+				for (i32 sy = 0; sy < 4 * (height - 1); ++sy) {
+					for (i32 sx = 0; sx < 4 * (width - 1); ++sx) {
+						auto fx = (sx + 0.5) / 4.0;
+						auto fy = (sy + 0.5) / 4.0;
+						auto column = static_cast<i32>(fx);
+						auto row = static_cast<i32>(fy);
+						auto tx = fx - column;
+						auto ty = fy - row;
+						f64 channels[3];
+						for (i32 channel = 0; channel < 3; ++channel) {
+							auto top = decode(column, row, channel) * (1.0 - tx) + decode(column + 1, row, channel) * tx;
+							auto bottom = decode(column, row + 1, channel) * (1.0 - tx) + decode(column + 1, row + 1, channel) * tx;
+							channels[channel] = top * (1.0 - ty) + bottom * ty;
+						}
+						auto lo = channels[0] < channels[1] ? channels[0] : channels[1];
+						auto hi = channels[0] < channels[1] ? channels[1] : channels[0];
+						auto median = channels[2] < lo ? lo : channels[2] > hi ? hi : channels[2];
+
+						auto x = originX + (fx + 0.5) / s;
+						auto y = originY + (height - 1 - fy + 0.5) / s;
+						auto expected = reference->distance(x, y) * s;
+						if (fabs(expected) < 0.25)
+							continue;
+						++samples;
+						wrongSide += (median > 0.0) != (expected > 0.0);
+					}
+				}
+
+				bool failed = maxDistanceError > distanceTolerance || wrongSide > 0;
+				failures += failed;
+				fprintf(stderr, "msdf %-10s scale %3g  %3dx%-3d  max distance error %.3f px  wrong side %d/%d%s\n",
+					test.name, s, width, height, maxDistanceError, wrongSide, samples, failed ? "  FAILED" : "");
+			}
+		}
+
+		free(pixels);
+		free(reference);
+		return failures;
+	}
+
+	void usage(char const *argv0) {
+		fprintf(stderr,
+			"usage: %s [--repeat N] [--warmup N] [--max-nodes N] [--filter SUBSTR] [--out FILE]\n"
+			"       [--baseline FILE] [--threshold FRACTION] [--accept-new]\n"
+			"       %s --check msdf\n", argv0, argv0);
+	}
+
+}
+
+int main(int argc, char **argv) {
+	Options options;
+
+	for (int i = 1; i < argc; ++i) {
+		auto arg = argv[i];
+		if (strcmp(arg, "--accept-new") == 0) {
+			options.acceptNew = true;
+			continue;
+		}
+		auto value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (!value) {
+			usage(argv[0]);
+			return 1;
+		}
+		if (strcmp(arg, "--repeat") == 0) {
+			options.repeat = atoi(value);
+		} else if (strcmp(arg, "--warmup") == 0) {
+			options.warmup = atoi(value);
+		} else if (strcmp(arg, "--max-nodes") == 0) {
+			options.maxNodes = atoi(value);
+		} else if (strcmp(arg, "--filter") == 0) {
+			options.filter = value;
+		} else if (strcmp(arg, "--out") == 0) {
+			options.outPath = value;
+		} else if (strcmp(arg, "--baseline") == 0) {
+			options.baselinePath = value;
+		} else if (strcmp(arg, "--threshold") == 0) {
+			options.threshold = strtod(value, nullptr);
+		} else if (strcmp(arg, "--check") == 0) {
+			options.check = value;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+		++i;
+	}
+	if (options.repeat < 1)
+		options.repeat = 1;
+
+	if (options.check) {
+		if (strcmp(options.check, "msdf") != 0) {
+			usage(argv[0]);
+			return 1;
+		}
+		auto arena = make_arena_allocator(1 << 20);
+		return check_msdf(&arena) ? 1 : 0;
+	}
+
+	auto out = stdout;
+	if (options.outPath) {
+		out = fopen(options.outPath, "w");
+		if (!out) {
+			fprintf(stderr, "Failed to open %s\n", options.outPath);
+			return 1;
+		}
+	}
+
+	i32 const nodeCounts[] = { 1000, 10000, 100000, 1000000 };
+	auto samples = static_cast<f64*>(malloc(sizeof(f64) * static_cast<usize>(options.repeat)));
+	auto scratch = static_cast<f64*>(malloc(sizeof(f64) * static_cast<usize>(options.repeat)));
+	auto calibrationSamples = static_cast<f64*>(malloc(sizeof(f64) * static_cast<usize>(options.repeat)));
+	auto results = static_cast<Result*>(malloc(sizeof(Result) * maxResults));
+	i32 resultCount = 0;
+
+	char machine[128];
+	machine_name(machine, sizeof(machine));
+	fprintf(out, "{\n\"machine\": \"%s\",\n\"repeat\": %d,\n\"warmup\": %d,\n\"benchmarks\": [",
+		machine, options.repeat, options.warmup);
+	bool first = true;
+
+	auto arena = make_arena_allocator(1ll << 30);
+
+	for (auto nodeCount : nodeCounts) {
+		if (nodeCount > options.maxNodes)
+			continue;
+		for (i32 shape = 0; shape < 3; ++shape) {
+			Scene scene{};
+			scene.shape = static_cast<SceneShape>(shape);
+			scene.nodeCount = nodeCount;
+			bool prepared = false;
+
+			for (auto const& bench : benches) {
+				char name[128];
+				snprintf(name, sizeof(name), "%s/%s/%d", bench.name, shapeNames[shape], nodeCount);
+				if (options.filter && !strstr(name, options.filter))
+					continue;
+
+				if (!prepared) {
+					prepare_scene(&scene, &arena);
+					prepared = true;
+				}
+
+				for (i32 i = 0; i < options.warmup; ++i) {
+					bench.fn(&scene);
+					time_calibration();
+				}
+
+				i64 items = 0;
+				for (i32 i = 0; i < options.repeat; ++i) {
+					auto begin = profile_now();
+					items = bench.fn(&scene);
+					samples[i] = (profile_now() - begin) * 1000000.0;
+					calibrationSamples[i] = time_calibration();
+				}
+
+				qsort(samples, static_cast<usize>(options.repeat), sizeof(f64), compare_f64);
+				auto median = median_of(samples, options.repeat);
+				auto mad = mad_of(samples, scratch, options.repeat);
+				qsort(calibrationSamples, static_cast<usize>(options.repeat), sizeof(f64), compare_f64);
+				auto calibration = median_of(calibrationSamples, options.repeat);
+
+				if (resultCount < maxResults) {
+					auto& result = results[resultCount++];
+					snprintf(result.name, sizeof(result.name), "%s", name);
+					result.median = median;
+					result.mad = mad;
+					result.calibration = calibration;
+				}
+
+				fprintf(out, "%s\n{\"name\": \"%s\", \"op\": \"%s\", \"scene\": \"%s\", \"nodes\": %d, \"items\": %lld, "
+					"\"median_ns\": %.1f, \"mad_ns\": %.1f, \"calibration_ns\": %.1f, \"min_ns\": %.1f, \"max_ns\": %.1f, \"ns_per_item\": %.3f, "
+					"\"samples_ns\": [",
+					first ? "" : ",", name, bench.name, shapeNames[shape], nodeCount, static_cast<long long>(items),
+					median, mad, calibration, samples[0], samples[options.repeat - 1],
+					items ? median / static_cast<f64>(items) : 0.0);
+				for (i32 i = 0; i < options.repeat; ++i)
+					fprintf(out, "%s%.1f", i ? ", " : "", samples[i]);
+				fprintf(out, "]}");
+				fflush(out);
+				first = false;
+			}
+
+			arena.clear();
+		}
+	}
+
+	fprintf(out, "\n]\n}\n");
+
+	if (out != stdout)
+		fclose(out);
+
+	i32 exitCode = 0;
+	if (options.baselinePath) {
+		auto baseline = static_cast<Result*>(malloc(sizeof(Result) * maxResults));
+		auto baselineCount = load_baseline(options.baselinePath, baseline, maxResults);
+		if (baselineCount < 0) {
+			fprintf(stderr, "Failed to read baseline %s\n", options.baselinePath);
+			exitCode = 1;
+		} else {
+			auto failures = compare_baseline(results, resultCount, baseline, baselineCount, options.threshold, options.acceptNew);
+			if (failures) {
+				fprintf(stderr, "%d benchmark(s) regressed by more than %.0f%% or have no baseline\n", failures, options.threshold * 100.0);
+				exitCode = 1;
+			}
+		}
+		free(baseline);
+	}
+
+	free(results);
+	free(calibrationSamples);
+	free(scratch);
+	free(samples);
+
+	return exitCode;
+}
@@ -0,0 +1,164 @@
+import { WasmWrapper } from './wasm.js';
+
+// Payload sizes in bytes for the imports that read wasm memory
+const payloadSizes = [16, 256, 4096, 65536];
+
+class CallBench {
+
+  constructor() {
+    this.wasm = undefined;
+    // Accumulates results so the engine cannot drop the work
+    this.sink = 0;
+  }
+
+  init = async () => {
+    const gl = document.createElement('canvas').getContext('webgl2');
+
+    const importObject = {
+      bench: {
+        scalar: (a, b) => {
+          this.sink += a ^ b;
+        },
+        byteView: (ptr, length) => {
+          const array = this.wasm.memToByteArray(ptr, length);
+          this.sink += array[length - 1];
+        },
+        cachedView: (ptr, length) => {
+          this.sink += this.wasm.u8[ptr + length - 1];
+        },
+        string: (ptr, length) => {
+          const string = this.wasm.memToString(ptr, length);
+          this.sink += string.length;
+        },
+        // The two ways index.js forwards GL imports
+        glArrow: (red, green, blue, alpha) => {
+          gl.clearColor(red, green, blue, alpha);
+        },
+        glBound: gl.clearColor.bind(gl),
+      },
+    };
+
+    const wasm = await WebAssembly.instantiateStreaming(fetch("dist/bin/shrub_call_bench.wasm"), importObject);
+    this.wasm = new WasmWrapper(wasm);
+
+    this.wasm.fillPayload();
+  }
+
+  // Grows the iteration count until one run is well above timer resolution, then reports the median
+  // of several runs in nanoseconds per call
+  measure = (fn) => {
+    let iterations = 256;
+    for (;;) {
+      const begin = performance.now();
+      fn(iterations);
+      if (performance.now() - begin >= 20) {
+        break;
+      }
+      iterations *= 2;
+    }
+
+    const samples = [];
+    for (let i = 0; i < 7; ++i) {
+      const begin = performance.now();
+      fn(iterations);
+      samples.push((performance.now() - begin) * 1e6 / iterations);
+    }
+    samples.sort((a, b) => a - b);
+    return samples[samples.length >> 1];
+  }
+
+  run = () => {
+    const rows = [];
+
+    rows.push({
+      call: 'export (add)',
+      bytes: 0,
+      ns: this.measure((n) => {
+        let acc = 0;
+        for (let i = 0; i < n; ++i) {
+          acc = this.wasm.add(acc & 0xffff, i);
+        }
+        this.sink += acc;
+      }),
+    });
+
+    rows.push({
+      call: 'import, 2 scalars',
+      bytes: 0,
+      ns: this.measure((n) => this.wasm.callScalar(n)),
+    });
+
+    for (const size of payloadSizes) {
+      rows.push({
+        call: 'import, memToByteArray',
+        bytes: size,
+        ns: this.measure((n) => this.wasm.callByteView(n, size)),
+      });
+    }
+
+    for (const size of payloadSizes) {
+      rows.push({
+        call: 'import, cached u8 view',
+        bytes: size,
+        ns: this.measure((n) => this.wasm.callCachedView(n, size)),
+      });
+    }
+
+    for (const size of payloadSizes) {
+      rows.push({
+        call: 'import, memToString',
+        bytes: size,
+        ns: this.measure((n) => this.wasm.callString(n, size)),
+      });
+    }
+
+    rows.push({
+      call: 'import, gl.clearColor via arrow',
+      bytes: 0,
+      ns: this.measure((n) => this.wasm.callGlArrow(n)),
+    });
+
+    rows.push({
+      call: 'import, gl.clearColor bound',
+      bytes: 0,
+      ns: this.measure((n) => this.wasm.callGlBound(n)),
+    });
+
+    return rows;
+  }
+
+};
+
+const render = (rows) => {
+  const table = document.createElement('table');
+  const caption = table.createCaption();
+  caption.textContent = navigator.userAgent;
+
+  const header = table.insertRow();
+  for (const title of ['call', 'payload bytes', 'ns / call']) {
+    const cell = document.createElement('th');
+    cell.textContent = title;
+    header.appendChild(cell);
+  }
+
+  for (const row of rows) {
+    const tr = table.insertRow();
+    tr.insertCell().textContent = row.call;
+    tr.insertCell().textContent = row.bytes;
+    tr.insertCell().textContent = row.ns.toFixed(1);
+  }
+
+  document.body.appendChild(table);
+}
+
+const init = async () => {
+
+  const bench = new CallBench();
+  await bench.init();
+
+  const rows = bench.run();
+  console.table(rows);
+  render(rows);
+
+}
+init();
@@ -0,0 +1,202 @@
+#include "damage.h"
+
+#include "profile.h"
+
+namespace shrub {
+
+	namespace {
+
+		f32 min_f32(f32 a, f32 b) {
+			return a < b ? a : b;
+		}
+
+		f32 max_f32(f32 a, f32 b) {
+			return a > b ? a : b;
+		}
+
+		DamageRect merge(DamageRect a, DamageRect b) {
+			return {
+				{ min_f32(a.min.x, b.min.x), min_f32(a.min.y, b.min.y) },
+				{ max_f32(a.max.x, b.max.x), max_f32(a.max.y, b.max.y) },
+			};
+		}
+
+		f32 area(DamageRect r) {
+			return (r.max.x - r.min.x) * (r.max.y - r.min.y);
+		}
+
+		bool overlaps(DamageRect a, DamageRect b) {
+			return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y;
+		}
+
+		bool equal(Vec2 a, Vec2 b) {
+			return a.x == b.x && a.y == b.y;
+		}
+
+		bool equal(Vec4 a, Vec4 b) {
+			return a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w;
+		}
+
+	}
+
+	void DamageTracker::init(Allocator *allocator, i32 capacity_) {
+		capacity = 16;
+		while (capacity < capacity_)
+			capacity <<= 1;
+
+		tables[0] = allocate<DamageEntry>(allocator, capacity);
+		tables[1] = allocate<DamageEntry>(allocator, capacity);
+		for (i32 i = 0; i < capacity; ++i) {
+			tables[0][i] = {};
+			tables[1][i] = {};
+		}
+
+		current = 0;
+		count = 0;
+		rectCount = 0;
+		full = true;
+	}
+
+	void DamageTracker::begin_frame() {
+		auto table = tables[current];
+		for (i32 i = 0; i < capacity; ++i)
+			table[i].id = 0;
+		count = 0;
+	}
+
+	void DamageTracker::end_frame() {
+		PROFILE_ZONE("damage_end_frame");
+		// Whatever wasn't tracked again this frame has disappeared, its old area needs repainting
+		auto previous = tables[current ^ 1];
+		for (i32 i = 0; i < capacity; ++i) {
+			auto& entry = previous[i];
+			if (entry.id && !entry.seen)
+				add(entry.pos, entry.extent);
+			entry.id = 0;
+		}
+		current ^= 1;
+	}
+
+	void DamageTracker::track(ElementId id, Vec2 pos, Vec2 extent, Vec4 color, u64 content) {
+		assert(id.id != 0);
+		assert(count < capacity / 2);
+
+		auto mask = static_cast<u64>(capacity - 1);
+
+		auto table = tables[current];
+		auto slot = id.id & mask;
+		while (table[slot].id)
+			slot = (slot + 1) & mask;
+		table[slot] = { id.id, pos, extent, color, content, false };
+		++count;
+
+		auto previous = tables[current ^ 1];
+		slot = id.id & mask;
+		while (previous[slot].id && previous[slot].id != id.id)
+			slot = (slot + 1) & mask;
+
+		auto& old = previous[slot];
+		if (!old.id) {
+			add(pos, extent);
+			return;
+		}
+
+		old.seen = true;
+		if (!equal(old.pos, pos) || !equal(old.extent, extent)) {
+			add(old.pos, old.extent);
+			add(pos, extent);
+		} else if (!equal(old.color, color) || old.content != content) {
+			add(pos, extent);
+		}
+	}
+
+	void DamageTracker::add(Vec2 pos, Vec2 extent) {
+		add({ pos, pos + extent });
+	}
+
+	void DamageTracker::add(DamageRect rect) {
+		if (full)
+			return;
+
+		// Absorb every rect the new one touches, which may make it touch others
+		for (i32 i = 0; i < rectCount;) {
+			if (overlaps(rects[i], rect)) {
+				rect = merge(rect, rects[i]);
+				rects[i] = rects[--rectCount];
+				i = 0;
+			} else {
+				++i;
+			}
+		}
+
+		if (rectCount < maxRects) {
+			rects[rectCount++] = rect;
+			return;
+		}
+
+		// Out of rects, grow whichever one wastes the least area to cover this one
+		i32 best = 0;
+		f32 bestCost = 0.f;
+		for (i32 i = 0; i < rectCount; ++i) {
+			auto cost = area(merge(rects[i], rect)) - area(rects[i]);
+			if (i == 0 || cost < bestCost) {
+				best = i;
+				bestCost = cost;
+			}
+		}
+		rects[best] = merge(rects[best], rect);
+	}
+
+	void DamageTracker::presented() {
+		full = false;
+		rectCount = 0;
+	}
+
+	void DamageTracker::invalidate() {
+		full = true;
+		rectCount = 0;
+	}
+
+	bool DamageTracker::empty() const {
+		return !full && !rectCount;
+	}
+
+	bool DamageTracker::intersects(Vec2 pos, Vec2 extent) const {
+		if (full)
+			return true;
+		auto rect = DamageRect{ pos, pos + extent };
+		for (i32 i = 0; i < rectCount; ++i) {
+			if (overlaps(rects[i], rect))
+				return true;
+		}
+		return false;
+	}
+
+	void track_draw_commands(
+			DamageTracker *damage, ElementTree const& tree, DrawTables const& tables, DrawCommand const *commands, i64 count) {
+		PROFILE_ZONE("damage_track");
+		for (i64 i = 0; i < count; ++i) {
+			auto const& drawCmd = commands[i];
+			auto index = drawCmd.elementIndex.index;
+			auto bounds = command_bounds(tables, drawCmd, tree.positions[index], tree.elements[index].extent);
+			auto extent = Vec2{ bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y };
+			damage->track(command_id(tree, drawCmd), bounds.min, extent, drawCmd.color, hash_command_content(tables, drawCmd));
+		}
+	}
+
+	i64 cull_draw_commands(
+			DamageTracker const& damage, ElementTree const& tree, DrawTables const& tables,
+			DrawCommand const *commands, i64 count, DrawCommand *out) {
+		PROFILE_ZONE("damage_cull");
+		i64 kept = 0;
+		for (i64 i = 0; i < count; ++i) {
+			auto const& drawCmd = commands[i];
+			auto index = drawCmd.elementIndex.index;
+			auto bounds = command_bounds(tables, drawCmd, tree.positions[index], tree.elements[index].extent);
+			if (damage.intersects(bounds.min, { bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y }))
+				out[kept++] = drawCmd;
+		}
+		return kept;
+	}
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <oak_util/types.h>
+#include <oak_math/math.h>
+
+#include "shrub.h"
+
+namespace shrub {
+
+	using namespace oak;
+
+	// Canvas space, which the scene projection keeps equal to GL window space
+	struct DamageRect {
+		Vec2 min;
+		Vec2 max;
+	};
+
+	struct DamageEntry {
+		u64 id;
+		Vec2 pos;
+		Vec2 extent;
+		Vec4 color;
+		// hash_command_content of the command, 0 for a plain rectangle
+		u64 content;
+		bool seen;
+	};
+
+	// Compares what every element looked like last frame against this frame and collects the
+	// difference as a few merged rectangles. Entries are keyed by command_id in two open addressed
+	// tables, the previous frame's and the current one, swapped at end_frame so nothing is ever erased.
+	struct DamageTracker {
+		static constexpr i32 maxRects = 8;
+
+		DamageEntry *tables[2] = {};
+		i32 capacity = 0;
+		i32 current = 0;
+		i32 count = 0;
+
+		DamageRect rects[maxRects];
+		i32 rectCount = 0;
+		// Set when the previous contents of the canvas can't be trusted, e.g. the first frame
+		bool full = true;
+
+		// capacity is rounded up to a power of two and should be well above the element count
+		void init(Allocator *allocator, i32 capacity_);
+
+		// Damage accumulates across frames until presented, so a skipped frame loses nothing
+		void begin_frame();
+		void end_frame();
+		void presented();
+
+		void track(ElementId id, Vec2 pos, Vec2 extent, Vec4 color, u64 content);
+
+		// Damages a region regardless of what was tracked, for content that isn't an element
+		void add(Vec2 pos, Vec2 extent);
+		void add(DamageRect rect);
+
+		void invalidate();
+
+		bool empty() const;
+		bool intersects(Vec2 pos, Vec2 extent) const;
+	};
+
+	void track_draw_commands(
+			DamageTracker *damage, ElementTree const& tree, DrawTables const& tables, DrawCommand const *commands, i64 count);
+
+	// Keeps the commands that touch a damaged region, in order. out may alias commands.
+	// Returns the number of commands kept.
+	i64 cull_draw_commands(
+			DamageTracker const& damage, ElementTree const& tree, DrawTables const& tables,
+			DrawCommand const *commands, i64 count, DrawCommand *out);
+
+}
@@ -3,8 +3,21 @@
 #include <oak_math/math.h>
 
 #include "web_gl.h"
+#include "shrub.h"
+#include "program_cache.h"
+#include "uniform_ring.h"
+#include "damage.h"
+#include "geometry_cache.h"
+#include "layer_cache.h"
+#include "glyph_atlas.h"
+#include "msdf.h"
+#include "upload_queue.h"
+#include "profile.h"
+#include "alloc_stats.h"
+#include "frame_stats.h"
 
 using namespace oak;
+using namespace shrub;
 
 #define WASM_IMPORT(module, name) extern "C" __attribute__((import_module(#module), import_name(#name)))
 #define WASM_EXPORT(name) extern "C" __attribute__((export_name(#name)))
@@ -14,6 +27,10 @@ WASM_IMPORT(env, growMemory) void grow_memory(int pages);
 WASM_IMPORT(env, consoleLog) void console_log(char const *str, usize length);
 WASM_IMPORT(env, performanceNow) f64 performance_now();
 
+// Canvas 2D text, see GlyphRasterizer. Returns 0 when the glyph is missing.
+WASM_IMPORT(env, rasterizeGlyph) i32 rasterize_glyph(
+		u32 font, u32 size, u32 codepoint, GlyphMetrics *metrics, u8 *pixels, i32 capacity);
+
 WASM_IMPORT(env, sin) f64 wasm_sin(f64 a);
 WASM_IMPORT(env, cos) f64 wasm_cos(f64 a);
 
@@ -99,6 +116,10 @@ namespace {
 	Allocator globAlloc;
 	Allocator tempAlloc;
 
+#ifdef SHRUB_ALLOC_STATS
+	FixedArray<TrackingAllocator, 2> allocTrackers;
+#endif
+
 	struct VirtualFrame {
 		int stagingBuffer;
 		int fence;
@@ -115,263 +136,662 @@ namespace {
 		int x, y, button;
 	};
 
-	struct ElementIndex {
-		i32 index = 0;
-	};
+	bool rasterize_canvas_glyph(u32 font, u32 size, u32 codepoint, GlyphMetrics *metrics, u8 *pixels, i32 capacity) {
+		return rasterize_glyph(font, size, codepoint, metrics, pixels, capacity) != 0;
+	}
+
+	// Font ids 0 to 2 are the canvas fonts in index.js. The browser doesn't hand out outlines of its fonts, so
+	// the distance field font is a few icons drawn here in em units.
+	constexpr u32 iconFont = 3;
+	constexpr u32 iconGlyphSize = 32;
+	constexpr char const iconText[] = "\xe2\x9c\x93\xe2\x97\x8b+";
+
+	Outline iconOutline;
+
+	bool rasterize_icon_glyph(u32 font, u32 size, u32 codepoint, GlyphMetrics *metrics, u8 *pixels, i32 capacity) {
+		(void)font;
+		auto& outline = iconOutline;
+		outline.clear();
+		switch (codepoint) {
+		case 0x2713: // Check mark
+			outline.move_to({ 0.08f, 0.38f });
+			outline.line_to({ 0.36f, 0.06f });
+			outline.line_to({ 0.92f, 0.66f });
+			outline.line_to({ 0.8f, 0.76f });
+			outline.line_to({ 0.36f, 0.3f });
+			outline.line_to({ 0.2f, 0.48f });
+			outline.close();
+			break;
+		case 0x25cb: { // Ring, the hole runs the other way
+			// Quadratics every 45 degrees, the controls sit where the tangents meet
+			f32 const unit[16][2] = {
+				{ 1.f, 0.f }, { 1.f, 0.414f }, { 0.707f, 0.707f }, { 0.414f, 1.f },
+				{ 0.f, 1.f }, { -0.414f, 1.f }, { -0.707f, 0.707f }, { -1.f, 0.414f },
+				{ -1.f, 0.f }, { -1.f, -0.414f }, { -0.707f, -0.707f }, { -0.414f, -1.f },
+				{ 0.f, -1.f }, { 0.414f, -1.f }, { 0.707f, -0.707f }, { 1.f, -0.414f },
+			};
+			for (i32 ring = 0; ring < 2; ++ring) {
+				auto r = ring ? 0.24f : 0.38f;
+				auto flip = ring ? -1.f : 1.f;
+				outline.move_to({ 0.5f + r, 0.4f });
+				for (i32 i = 1; i <= 8; ++i) {
+					auto control = unit[2 * i - 1];
+					auto to = unit[(2 * i) % 16];
+					outline.quad_to(
+						{ 0.5f + r * control[0], 0.4f + flip * r * control[1] },
+						{ 0.5f + r * to[0], 0.4f + flip * r * to[1] });
+				}
+				outline.close();
+			}
+			break;
+		}
+		case '+':
+			outline.move_to({ 0.42f, 0.08f });
+			outline.line_to({ 0.58f, 0.08f });
+			outline.line_to({ 0.58f, 0.32f });
+			outline.line_to({ 0.82f, 0.32f });
+			outline.line_to({ 0.82f, 0.48f });
+			outline.line_to({ 0.58f, 0.48f });
+			outline.line_to({ 0.58f, 0.72f });
+			outline.line_to({ 0.42f, 0.72f });
+			outline.line_to({ 0.42f, 0.48f });
+			outline.line_to({ 0.18f, 0.48f });
+			outline.line_to({ 0.18f, 0.32f });
+			outline.line_to({ 0.42f, 0.32f });
+			outline.close();
+			break;
+		default:
+			return false;
+		}
+
+		auto em = static_cast<f32>(size);
+		metrics->advance = em;
+		metrics->ascent = 0.8f * em;
+		metrics->descent = 0.2f * em;
+		return generate_msdf_glyph(&outline, em, metrics, pixels, capacity);
+	}
+
+	// A chart series, one point per pixel of its element
+	constexpr i32 seriesPointCount = 512;
+
+	// Drawn with each join and cap
+	Vec2 const zigzagPoints[] = { { 10.f, 10.f }, { 35.f, 70.f }, { 60.f, 20.f }, { 90.f, 60.f } };
 
-	struct ElementId {
-		u64 id = 0;
+	// std140 layout of the Scene block in the vertex shader
+	struct SceneUniforms {
+		Mat4 projView;
 	};
 
-	struct ElementPadding {
-		f32 right = 0.f;
-		f32 top = 0.f;
-		f32 left = 0.f;
-		f32 bottom = 0.f;
+	struct Context {
+		Array<Event, 64> events;
+		FixedArray<VirtualFrame, 3> virtualFrames;
+		ElementTree elementTree;
+		Vector<DrawCommand> drawCommands;
+		Vector<DrawShape> drawShapes;
+		Vector<DrawPolyline> drawLines;
+		Vec2 *seriesPoints;
+		DrawPolyline series;
+		GlyphAtlas glyphs;
+		// Distance fields of iconFont, one entry draws at every size
+		GlyphAtlas iconGlyphs;
+		TextRunCache textRuns;
+		UploadQueue uploads;
+		FrameStats frameStats;
+
+		i64 virtualFrameIdx;
+		GeometryCache geometry;
+		UniformRing uniforms;
+		int vao;
+		// Instance attributes for shape, glyph and line batches, pointed at each batch as it's drawn
+		int shapeVao;
+		int glyphVao;
+		int lineVao;
+		ProgramCache programs;
+		ProgramId prog;
+		ProgramId shapeProg;
+		ProgramId glyphProg;
+		ProgramId msdfProg;
+		ProgramId lineProg;
+		DamageTracker damage;
+		LayerCache layers;
+		ProgramId compositeProg;
+
+		void init(Allocator *allocator);
+
+		// False when a batch was skipped because its program isn't ready. Everything is scissored to bounds,
+		// which are in canvas coordinates and shifted by -origin for the render target.
+		bool draw_batches(DrawBatch const *batches, i64 count, ClipRect const& bounds, Vec2 origin);
+
+		// GL texture for the texture index of a sort key
+		int texture_handle(u32 textureKey) const;
+
+		bool begin_frame();
+		void end_frame();
 	};
 
-	struct Element {
-
-		enum FlagBits : u32 {
-			LAYOUT_AXIS_MAJOR_MASK = 0x3,
-			LAYOUT_AXIS_MINOR_MASK = 0xC,
-			USE_AUTO_LAYOUT_BIT = 0x10,
-		};
-
-		ElementId id;
-		Vec2 pos;
-		Vec2 alignment;
-		Vec2 extent;
-		ElementPadding padding;
-		u32 flags = 0;
-
-		static constexpr Element from_id(ElementId id) {
-			auto result = Element{};
-			result.id = id;
-			return result;
+	void Context::init(Allocator *allocator) {
+		for (i64 i = 0; i < virtualFrames.capacity; ++i) {
+			auto& frame = virtualFrames[i];
+			// Geometry uploads are staged here, GeometryCache::upload is passed the same size
+			frame.stagingBuffer = gl_create_buffer();
+			gl_bind_buffer(GL_COPY_READ_BUFFER, frame.stagingBuffer);
+			gl_buffer_data(GL_COPY_READ_BUFFER, 1<<20, GL_STREAM_DRAW);
+			frame.fence = 0;
 		}
+		// Depths are spaced 2^-22 apart, mediump would merge thousands of elements into one
+		char const vertexShader[] = R"(#version 300 es
+	precision highp float;
 
-		constexpr i32 major_axis() const {
-			return (flags & LAYOUT_AXIS_MAJOR_MASK);
-		}
+	layout (location = 0) in vec3 vPos;
+	layout (location = 1) in vec4 vColor;
 
-		constexpr i32 minor_axis() const {
-			return (flags & LAYOUT_AXIS_MINOR_MASK) >> 2;
-		}
+	layout(std140) uniform Scene {
+		mat4 projView;
 	};
 
-	struct ElementConstraints {
-		ElementIndex index;
-		Vec2 minExtent;
-		Vec2 maxExtent;
-	};
+	out vec4 sColor;
 
-	struct ElementTree {
+	void main() {
+		gl_Position = projView * vec4(vPos, 1.0);
 
-		Element *elements = nullptr;
-		ElementIndex *parents = nullptr;
-		ElementIndex *firstChildren = nullptr;
-		ElementIndex *lastChildren = nullptr;
-		ElementIndex *siblings = nullptr;
-		Vec2 *positions = nullptr;
-		i32 elementCount = 0;
-		i32 elementCapacity = 0;
+		sColor = vColor;
+	}
+		)";
 
-		ElementConstraints *constraints = nullptr;
-		i32 constraintCount = 0;
-		i32 constraintCapacity = 0;
+		char const fragmentShader[] = R"(#version 300 es
+	precision mediump float;
 
-		void init(Allocator *allocator, i32 capacity);
+	in vec4 sColor;
 
-		void begin_ui();
-		void end_ui();
+	layout (location = 0) out vec4 oColor;
 
-		ElementIndex push_element(ElementIndex parent, Element const& widget);
+	void main() {
+		// Blending is premultiplied
+		oColor = vec4(sColor.rgb * sColor.a, sColor.a);
+	}
+		)";
+		// Cached layers are sampled with their uv rect in the color attribute. highp for the depth, as above.
+		char const compositeVertexShader[] = R"(#version 300 es
+	precision highp float;
 
-		void layout();
-		void transform();
+	layout (location = 0) in vec3 vPos;
+	layout (location = 1) in vec4 vUv;
 
-		Element* operator[](ElementIndex index);
+	layout(std140) uniform Scene {
+		mat4 projView;
 	};
 
-	void ElementTree::init(Allocator *allocator, i32 capacity) {
-		elements = allocate<Element>(allocator, capacity);
-		parents = allocate<ElementIndex>(allocator, capacity);
-		firstChildren = allocate<ElementIndex>(allocator, capacity);
-		lastChildren = allocate<ElementIndex>(allocator, capacity);
-		siblings = allocate<ElementIndex>(allocator, capacity);
-		positions = allocate<Vec2>(allocator, capacity);
+	out vec2 sUv;
 
-		elementCapacity = capacity;
-	}
+	void main() {
+		gl_Position = projView * vec4(vPos, 1.0);
 
-	void ElementTree::begin_ui() {
-		elementCount = 0;
+		sUv = vUv.xy;
 	}
+		)";
+
+		char const compositeFragmentShader[] = R"(#version 300 es
+	precision mediump float;
+
+	uniform sampler2D uLayer;
 
-	void ElementTree::end_ui() {
-		layout();
-		transform();
+	in vec2 sUv;
+
+	layout (location = 0) out vec4 oColor;
+
+	void main() {
+		oColor = texture(uLayer, sUv);
 	}
+		)";
+		// Rounded rectangles from one instanced quad each. Distances need more than mediump's 11 bits once
+		// positions reach the hundreds.
+		char const shapeVertexShader[] = R"(#version 300 es
+	precision highp float;
+
+	layout (location = 0) in vec4 iRect;
+	layout (location = 1) in vec4 iColor;
+	layout (location = 2) in vec4 iRadii;
+	layout (location = 3) in vec4 iBorderColor;
+	layout (location = 4) in vec4 iClip;
+	layout (location = 5) in vec3 iParams;
 
-	ElementIndex ElementTree::push_element(ElementIndex parent, Element const& elem) {
+	layout(std140) uniform Scene {
+		mat4 projView;
+	};
 
-		auto result = ElementIndex{ elementCount };
-		elements[result.index] = elem;
-		parents[result.index] = parent;
-		firstChildren[result.index] = {};
-		lastChildren[result.index] = {};
-		siblings[result.index] = {};
+	out vec2 sPos;
+	out vec2 sLocal;
+	flat out vec2 sHalfExtent;
+	flat out vec4 sColor;
+	flat out vec4 sRadii;
+	flat out vec4 sBorderColor;
+	flat out vec4 sClip;
+	flat out float sBorderWidth;
+	flat out float sBlur;
 
-		if (parent.index != -1) {
-			if (lastChildren[parent.index].index != -1)
-				siblings[lastChildren[parent.index].index] = result;
-			lastChildren[parent.index] = result;
-			if (firstChildren[parent.index].index == -1)
-				firstChildren[parent.index] = result;
-		}
+	const vec2 corners[6] = vec2[6](
+		vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0),
+		vec2(1.0, 1.0), vec2(0.0, 1.0), vec2(0.0, 0.0));
 
-		return result;
+	void main() {
+		// Margin so the antialiased edge, or three deviations of a shadow, isn't cut off by the quad
+		float margin = 0.5 + 3.0 * iParams.z;
+		vec2 pos = iRect.xy - margin + corners[gl_VertexID] * (iRect.zw + 2.0 * margin);
+		gl_Position = projView * vec4(pos, iParams.x, 1.0);
+
+		sPos = pos;
+		sHalfExtent = iRect.zw * 0.5;
+		sLocal = pos - iRect.xy - sHalfExtent;
+		sColor = iColor;
+		sRadii = iRadii;
+		sBorderColor = iBorderColor;
+		sClip = iClip;
+		sBorderWidth = iParams.y;
+		sBlur = iParams.z;
 	}
+		)";
 
-	void ElementTree::layout() {
+		char const shapeFragmentShader[] = R"(#version 300 es
+	precision highp float;
 
-		for (i32 i = 0; i < elementCount; ++i) {
-		}
+	in vec2 sPos;
+	in vec2 sLocal;
+	flat in vec2 sHalfExtent;
+	flat in vec4 sColor;
+	flat in vec4 sRadii;
+	flat in vec4 sBorderColor;
+	flat in vec4 sClip;
+	flat in float sBorderWidth;
+	flat in float sBlur;
+
+	layout (location = 0) out vec4 oColor;
 
+	float rounded_box(vec2 p, vec2 halfExtent, float r) {
+		vec2 q = abs(p) - halfExtent + r;
+		return min(max(q.x, q.y), 0.0) + length(max(q, 0.0)) - r;
 	}
 
-	void ElementTree::transform() {
-		for (i32 i = 0; i < elementCount; ++i) {
-			auto parentOrigin = Vec2{};
-			auto parentExtent = Vec2{};
-			if (parents[i].index != -1) {
-				parentOrigin = positions[parents[i].index];
-				parentExtent = elements[parents[i].index].extent;
-			}
+	vec2 erf(vec2 x) {
+		vec2 s = sign(x);
+		vec2 a = abs(x);
+		x = 1.0 + (0.278393 + (0.230389 + 0.078108 * (a * a)) * a) * a;
+		x *= x;
+		return s - s / (x * x);
+	}
 
-			positions[i] = parentOrigin + elements[i].pos;
-		}
+	float gaussian(float x, float sigma) {
+		return exp(-(x * x) / (2.0 * sigma * sigma)) / (2.50662827 * sigma);
 	}
 
-	Element* ElementTree::operator[](ElementIndex index) {
-		return elements + index.index;
+	// Coverage of the blurred box along x at height y, closed form since the row is a segment
+	float shadow_row(float x, float y, float sigma, float r, vec2 halfExtent) {
+		float delta = min(halfExtent.y - r - abs(y), 0.0);
+		float curved = halfExtent.x - r + sqrt(max(0.0, r * r - delta * delta));
+		vec2 integral = 0.5 + 0.5 * erf((x + vec2(-curved, curved)) * (0.70710678 / sigma));
+		return integral.y - integral.x;
 	}
 
-	struct DrawCommand {
-		ElementIndex elementIndex;
-		Vec4 color;
-	};
+	// The gaussian is separable for a plain box, the rounded corners only need a few samples along y
+	float rounded_box_shadow(vec2 p, vec2 halfExtent, float r, float sigma) {
+		float low = p.y - halfExtent.y;
+		float high = p.y + halfExtent.y;
+		float start = clamp(-3.0 * sigma, low, high);
+		float end = clamp(3.0 * sigma, low, high);
+		float step = (end - start) / 4.0;
+		float y = start + step * 0.5;
+		float value = 0.0;
+		for (int i = 0; i < 4; ++i) {
+			value += shadow_row(p.x, p.y - y, sigma, r, halfExtent) * gaussian(y, sigma) * step;
+			y += step;
+		}
+		return value;
+	}
 
-	struct Context {
-		Array<Event, 64> events;
-		FixedArray<VirtualFrame, 3> virtualFrames;
-		ElementTree elementTree;
-		Vector<DrawCommand> drawCommands;
+	void main() {
+		if (any(lessThan(sPos, sClip.xy)) || any(greaterThan(sPos, sClip.zw)))
+			discard;
 
-		i64 virtualFrameIdx;
-		int geomBuf;
-		int sceneBuf;
-		int vao;
-		int prog;
+		// x and w are the corners on the min x side
+		vec2 side = sLocal.x < 0.0 ? sRadii.xw : sRadii.yz;
+		float r = min(sLocal.y < 0.0 ? side.x : side.y, min(sHalfExtent.x, sHalfExtent.y));
 
-		void init(Allocator *allocator);
+		if (sBlur > 0.0) {
+			float shadow = rounded_box_shadow(sLocal, sHalfExtent, r, sBlur);
+			oColor = vec4(sColor.rgb * sColor.a, sColor.a) * shadow;
+			return;
+		}
 
-		int make_shader(String vertSource, String fragSource);
+		float d = rounded_box(sLocal, sHalfExtent, r);
 
-		bool begin_frame();
-		void end_frame();
-	};
+		// A one pixel ramp across the edge, fwidth keeps it a pixel wide under any projection scale
+		float aa = max(fwidth(d), 1e-4);
+		float coverage = clamp(0.5 - d / aa, 0.0, 1.0);
+		float fill = clamp(0.5 - (d + sBorderWidth) / aa, 0.0, 1.0);
+		vec4 color = sBorderWidth > 0.0 ? mix(sBorderColor, sColor, fill) : sColor;
 
-	void Context::init(Allocator *allocator) {
-		for (i64 i = 0; i < virtualFrames.capacity; ++i) {
-			auto& frame = virtualFrames[i];
-			frame.stagingBuffer = gl_create_buffer();
-			gl_bind_buffer(GL_COPY_READ_BUFFER, frame.stagingBuffer);
-			gl_buffer_data(GL_COPY_READ_BUFFER, 1<<20, GL_STREAM_DRAW);
-			frame.fence = 0;
-		}
-		char const vertexShader[] = R"(#version 300 es
-	precision mediump float;
+		oColor = vec4(color.rgb * color.a, color.a) * coverage;
+	}
+		)";
+		char const glyphVertexShader[] = R"(#version 300 es
+	precision highp float;
 
-	layout (location = 0) in vec2 vPos;
-	layout (location = 1) in vec4 vColor;
+	layout (location = 0) in vec4 iRect;
+	layout (location = 1) in vec4 iUv;
+	layout (location = 2) in vec4 iColor;
+	layout (location = 3) in float iDepth;
 
 	layout(std140) uniform Scene {
 		mat4 projView;
 	};
 
-	out vec4 sColor;
+	out vec2 sUv;
+	flat out vec4 sColor;
+
+	const vec2 corners[6] = vec2[6](
+		vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0),
+		vec2(1.0, 1.0), vec2(0.0, 1.0), vec2(0.0, 0.0));
 
 	void main() {
-		gl_Position = projView * vec4(vPos, 0.0, 1.0);
+		vec2 corner = corners[gl_VertexID];
+		gl_Position = projView * vec4(iRect.xy + corner * iRect.zw, iDepth, 1.0);
 
-		sColor = vColor;
+		sUv = mix(iUv.xy, iUv.zw, corner);
+		sColor = iColor;
 	}
 		)";
 
-		char const fragmentShader[] = R"(#version 300 es
+		char const glyphFragmentShader[] = R"(#version 300 es
 	precision mediump float;
 
-	in vec4 sColor;
+	uniform sampler2D uAtlas;
+
+	in vec2 sUv;
+	flat in vec4 sColor;
 
 	layout (location = 0) out vec4 oColor;
 
 	void main() {
-		oColor = sColor;
+		float coverage = texture(uAtlas, sUv).r;
+		oColor = vec4(sColor.rgb * sColor.a, sColor.a) * coverage;
 	}
 		)";
-		prog = make_shader(vertexShader, fragmentShader);
+		char const msdfFragmentShader[] = R"(#version 300 es
+	precision highp float;
 
-		Mat4 proj = ortho(0, 800, 0, 600, 1, -1);
+	uniform sampler2D uAtlas;
 
-		sceneBuf = gl_create_buffer();
-		gl_bind_buffer_range(GL_UNIFORM_BUFFER, 0, sceneBuf, 0, sizeof(Mat4));
-		gl_buffer_data(GL_UNIFORM_BUFFER, sizeof(Mat4), GL_STATIC_DRAW);
-		gl_buffer_sub_data(GL_UNIFORM_BUFFER, 0, &proj, sizeof(Mat4));
+	in vec2 sUv;
+	flat in vec4 sColor;
 
-		vao = gl_create_vertex_array();
-		gl_bind_vertex_array(vao);
+	layout (location = 0) out vec4 oColor;
 
-		geomBuf = gl_create_buffer();
-		gl_bind_buffer(GL_ARRAY_BUFFER, geomBuf);
-		gl_buffer_data(GL_ARRAY_BUFFER, 20<<20, GL_STATIC_DRAW);
+	// Twice msdfRange, the field spans that many texels across the outline
+	const float pxRange = 8.0;
 
-		gl_enable_vertex_attrib_array(0);
-		gl_enable_vertex_attrib_array(1);
-		gl_vertex_attrib_pointer(0, 2, GL_FLOAT, 0, 24, 0);
-		gl_vertex_attrib_pointer(1, 4, GL_FLOAT, 0, 24, 8);
+	float median(float r, float g, float b) {
+		return max(min(r, g), min(max(r, g), b));
+	}
 
-		drawCommands.reserve(allocator, 512);
+	void main() {
+		vec3 field = texture(uAtlas, sUv).rgb;
+		// Screen pixels the range covers at this magnification, so edges stay a pixel wide at any size
+		vec2 unitRange = vec2(pxRange) / vec2(textureSize(uAtlas, 0));
+		float screenRange = max(0.5 * dot(unitRange, 1.0 / fwidth(sUv)), 1.0);
+		float distance = median(field.r, field.g, field.b) - 0.5;
+		float coverage = clamp(distance * screenRange + 0.5, 0.0, 1.0);
+		oColor = vec4(sColor.rgb * sColor.a, sColor.a) * coverage;
 	}
+		)";
+		// Each instance is a segment that reads the points on either side of it too, a zero slot ends the line.
+		// The quad covers the segment and reaches past its ends far enough for the cap or its half of the join.
+		char const lineVertexShader[] = R"(#version 300 es
+	precision highp float;
+
+	layout (location = 0) in vec2 iPrev;
+	layout (location = 1) in float iPrevWidth;
+	layout (location = 2) in vec3 iStart;
+	layout (location = 3) in vec4 iColor;
+	layout (location = 4) in vec3 iParams;
+	layout (location = 5) in vec2 iEnd;
+	layout (location = 6) in float iEndWidth;
+	layout (location = 7) in vec2 iNext;
+	layout (location = 8) in float iNextWidth;
 
-	int Context::make_shader(String vertSource, String fragSource) {
-		int programId = gl_create_program();
+	layout(std140) uniform Scene {
+		mat4 projView;
+	};
 
-		auto vs = gl_create_shader(GL_VERTEX_SHADER);
-		auto fs = gl_create_shader(GL_FRAGMENT_SHADER);
+	out vec2 sPos;
+	// Endpoint and the direction out of the segment there
+	flat out vec4 sStart;
+	flat out vec4 sEnd;
+	// Cut between the segment and its neighbour, what the end is, and how far the bevel is from the endpoint
+	flat out vec4 sStartCut;
+	flat out vec4 sEndCut;
+	// Per end, 1 when the cut runs the whole width of the segment, 0 when it only applies past the endpoint
+	flat out vec2 sSplit;
+	flat out vec4 sColor;
+	flat out float sHalfWidth;
+
+	// Caps then joins, matching LineCap and LineJoin
+	const float BUTT_CAP = 0.0;
+	const float SQUARE_CAP = 1.0;
+	const float ROUND_CAP = 2.0;
+	const float MITER_JOIN = 3.0;
+	const float ROUND_JOIN = 4.0;
+	const float BEVEL_JOIN = 5.0;
+
+	const vec2 corners[6] = vec2[6](
+		vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0),
+		vec2(1.0, 1.0), vec2(0.0, 1.0), vec2(0.0, 0.0));
+
+	// Returns how far past p the end reaches
+	float line_end(
+			vec2 p, vec2 u, float len, vec2 neighbour, float neighbourWidth, float halfWidth, out vec4 cut,
+			out float split) {
+		int style = int(iParams.y);
+		vec2 v = neighbour - p;
+		float neighbourLen = length(v);
+		split = 0.0;
+		if (neighbourWidth == 0.0 || neighbourLen < 1e-6) {
+			float cap = float(style >> 2);
+			cut = vec4(0.0, 0.0, cap, 0.0);
+			return cap == BUTT_CAP ? 0.0 : halfWidth;
+		}
 
-		gl_shader_source(vs, vertSource.data, vertSource.count);
-		gl_shader_source(fs, fragSource.data, fragSource.count);
+		// The two segments meet on the bisector, a line doubling back is cut square
+		vec2 k = u + v / neighbourLen;
+		k = dot(k, k) < 1e-8 ? u : normalize(k);
+		float cosHalf = dot(u, k);
+		// Where the inner edges cross lies past the end of a short segment at a sharp join, the cut would leave
+		// a gap there, so the segments overlap on the inside instead
+		split = halfWidth * sqrt(max(1.0 - cosHalf * cosHalf, 0.0)) <= cosHalf * min(len, neighbourLen) ? 1.0 : 0.0;
+		int join = style & 3;
+		if (join == 1) {
+			cut = vec4(k, ROUND_JOIN, 0.0);
+			return halfWidth;
+		}
+		if (join == 0 && cosHalf * iParams.z >= 1.0) {
+			cut = vec4(k, MITER_JOIN, 0.0);
+			return halfWidth / cosHalf;
+		}
+		cut = vec4(k, BEVEL_JOIN, halfWidth * cosHalf);
+		return halfWidth;
+	}
+
+	void main() {
+		float halfWidth = 0.5 * iParams.x;
+		vec2 d = iEnd - iStart.xy;
+		float len = length(d);
+		// Segments touching a zero slot join two lines, or a line and the padding after it
+		if (halfWidth == 0.0 || iEndWidth == 0.0 || len < 1e-6) {
+			gl_Position = vec4(0.0);
+			return;
+		}
+		d /= len;
+
+		vec4 startCut;
+		vec4 endCut;
+		float before = line_end(iStart.xy, -d, len, iPrev, iPrevWidth, halfWidth, startCut, sSplit.x);
+		float after = line_end(iEnd, d, len, iNext, iNextWidth, halfWidth, endCut, sSplit.y);
+
+		// A pixel of margin all round for the antialiased edge
+		vec2 corner = corners[gl_VertexID];
+		float along = mix(-before - 1.0, len + after + 1.0, corner.x);
+		float across = (2.0 * corner.y - 1.0) * (halfWidth + 1.0);
+		vec2 pos = iStart.xy + d * along + vec2(-d.y, d.x) * across;
+		gl_Position = projView * vec4(pos, iStart.z, 1.0);
+
+		sPos = pos;
+		sStart = vec4(iStart.xy, -d);
+		sEnd = vec4(iEnd, d);
+		sStartCut = startCut;
+		sEndCut = endCut;
+		sColor = iColor;
+		sHalfWidth = halfWidth;
+	}
+		)";
 
-		gl_compile_shader(vs);
-		gl_compile_shader(fs);
+		char const lineFragmentShader[] = R"(#version 300 es
+	precision highp float;
 
-		gl_attach_shader(programId, vs);
-		gl_attach_shader(programId, fs);
+	in vec2 sPos;
+	flat in vec4 sStart;
+	flat in vec4 sEnd;
+	flat in vec4 sStartCut;
+	flat in vec4 sEndCut;
+	flat in vec2 sSplit;
+	flat in vec4 sColor;
+	flat in float sHalfWidth;
 
-		gl_link_program(programId);
+	layout (location = 0) out vec4 oColor;
 
-		gl_detach_shader(programId, vs);
-		gl_detach_shader(programId, fs);
+	const float BUTT_CAP = 0.0;
+	const float SQUARE_CAP = 1.0;
+	const float MITER_JOIN = 3.0;
+	const float BEVEL_JOIN = 5.0;
+
+	// q is relative to the endpoint and u points out of the segment. Inside the sides there's only something
+	// to cut past the endpoint, elsewhere this is far below the side distance.
+	float end_distance(vec2 q, vec2 u, vec4 cut) {
+		float along = dot(q, u);
+		if (cut.z == BUTT_CAP)
+			return along;
+		if (cut.z == SQUARE_CAP)
+			return along - sHalfWidth;
+		if (along <= 0.0 || cut.z == MITER_JOIN)
+			return -1e9;
+		if (cut.z == BEVEL_JOIN)
+			return abs(dot(q, vec2(-cut.y, cut.x))) - cut.w;
+		// Round caps and joins
+		return length(q) - sHalfWidth;
+	}
 
-		gl_delete_shader(vs);
-		gl_delete_shader(fs);
+	// The neighbour draws the other side of the bisector
+	bool past_join(vec2 q, vec2 u, vec4 cut, float split) {
+		return cut.z >= MITER_JOIN && dot(q, cut.xy) > 0.0 && (split > 0.0 || dot(q, u) > 0.0);
+	}
 
-		return programId;
+	void main() {
+		vec2 d = sEnd.zw;
+		vec2 fromStart = sPos - sStart.xy;
+		vec2 fromEnd = sPos - sEnd.xy;
+		float d0 = abs(dot(fromStart, vec2(-d.y, d.x))) - sHalfWidth;
+		float d1 = max(end_distance(fromStart, sStart.zw, sStartCut), end_distance(fromEnd, sEnd.zw, sEndCut));
+		float dist = max(d0, d1);
+
+		// Taken before the discard so the derivative sees every pixel of the quad
+		float aa = max(fwidth(dist), 1e-4);
+		if (past_join(fromStart, sStart.zw, sStartCut, sSplit.x) || past_join(fromEnd, sEnd.zw, sEndCut, sSplit.y))
+			discard;
+
+		float coverage = clamp(0.5 - dist / aa, 0.0, 1.0);
+		oColor = vec4(sColor.rgb * sColor.a, sColor.a) * coverage;
+	}
+		)";
+		programs.init(allocator, 64);
+		prog = programs.request(vertexShader, fragmentShader);
+		compositeProg = programs.request(compositeVertexShader, compositeFragmentShader);
+		shapeProg = programs.request(shapeVertexShader, shapeFragmentShader);
+		glyphProg = programs.request(glyphVertexShader, glyphFragmentShader);
+		msdfProg = programs.request(glyphVertexShader, msdfFragmentShader);
+		lineProg = programs.request(lineVertexShader, lineFragmentShader);
+
+		layers.init();
+		// Layer textures hold premultiplied colors
+		gl_enable(GL_BLEND);
+		gl_blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+		// Opaque draws go front to back, see element_depth
+		gl_enable(GL_DEPTH_TEST);
+		gl_depth_func(GL_LESS);
+		gl_clear_depth(1.f);
+
+		uniforms.init(allocator, 64<<10, static_cast<i32>(virtualFrames.capacity));
+
+		vao = gl_create_vertex_array();
+		gl_bind_vertex_array(vao);
+
+		// Leaves GL_ARRAY_BUFFER bound for the attribute pointers below
+		geometry.init(allocator, 1<<17, 8192);
+
+		gl_enable_vertex_attrib_array(0);
+		gl_enable_vertex_attrib_array(1);
+		gl_vertex_attrib_pointer(0, 3, GL_FLOAT, 0, GeometryCache::vertexSize, 0);
+		gl_vertex_attrib_pointer(1, 4, GL_FLOAT, 0, GeometryCache::vertexSize, 12);
+
+		shapeVao = gl_create_vertex_array();
+		gl_bind_vertex_array(shapeVao);
+		for (GLuint i = 0; i < 6; ++i) {
+			gl_enable_vertex_attrib_array(i);
+			gl_vertex_attrib_divisor(i, 1);
+		}
+		glyphVao = gl_create_vertex_array();
+		gl_bind_vertex_array(glyphVao);
+		for (GLuint i = 0; i < 4; ++i) {
+			gl_enable_vertex_attrib_array(i);
+			gl_vertex_attrib_divisor(i, 1);
+		}
+		lineVao = gl_create_vertex_array();
+		gl_bind_vertex_array(lineVao);
+		for (GLuint i = 0; i < 9; ++i) {
+			gl_enable_vertex_attrib_array(i);
+			gl_vertex_attrib_divisor(i, 1);
+		}
+		gl_bind_vertex_array(vao);
+		drawShapes.reserve(allocator, 64);
+		drawLines.reserve(allocator, 16);
+
+		// A random walk
+		seriesPoints = allocate<Vec2>(allocator, seriesPointCount);
+		auto value = 70.f;
+		for (i32 i = 0; i < seriesPointCount; ++i) {
+			auto step = static_cast<f32>(hash_int(static_cast<u64>(i)) & 0xff) * (8.f / 255.f) - 4.f;
+			value = value + step < 10.f ? 10.f : value + step > 130.f ? 130.f : value + step;
+			seriesPoints[i] = { static_cast<f32>(i), value };
+		}
+		series = make_polyline(seriesPoints, seriesPointCount, 2.f, LineJoin::ROUND, LineCap::ROUND);
+
+		glyphs.init(allocator, 1u << 15, 512, 512, 1, 2048, rasterize_canvas_glyph);
+		iconOutline.init(allocator, 64, 4);
+		iconGlyphs.init(allocator, (1u << 15) + 1, 256, 256, 4, 256, rasterize_icon_glyph);
+		textRuns.init(allocator, 512, 8192);
+		for (u32 font = 0; font < iconFont; ++font)
+			textRuns.set_font(font, &glyphs, 0);
+		textRuns.set_font(iconFont, &iconGlyphs, iconGlyphSize);
+
+		elementTree.init(allocator, 4096);
+		damage.init(allocator, 8192);
+		drawCommands.reserve(allocator, 512);
+
+		// A 512x512 R8 atlas repack fits in one frame, a burst of new images wouldn't
+		uploads.init(allocator, 64, 256 << 10, 2.0);
+
+		frameStats.init();
 	}
 
 	bool Context::begin_frame() {
+		PROFILE_ZONE("begin_frame");
 		auto& frame = virtualFrames[virtualFrameIdx];
 		if (frame.fence != 0) {
 			GLenum result = gl_client_wait_sync(frame.fence, 0, 0);
@@ -390,9 +810,122 @@ namespace {
 		return true;
 	}
 
+	void scissor_rect(ClipRect const& rect, Vec2 origin) {
+		auto x0 = static_cast<GLint>(rect.min.x - origin.x);
+		auto y0 = static_cast<GLint>(rect.min.y - origin.y);
+		auto x1 = static_cast<GLint>(rect.max.x - origin.x);
+		auto y1 = static_cast<GLint>(rect.max.y - origin.y);
+		// Round outwards so antialiased edges on fractional coordinates are covered
+		if (static_cast<f32>(x0) > rect.min.x - origin.x) --x0;
+		if (static_cast<f32>(y0) > rect.min.y - origin.y) --y0;
+		if (static_cast<f32>(x1) < rect.max.x - origin.x) ++x1;
+		if (static_cast<f32>(y1) < rect.max.y - origin.y) ++y1;
+		gl_scissor(x0, y0, x1 > x0 ? x1 - x0 : 0, y1 > y0 ? y1 - y0 : 0);
+	}
+
+	bool Context::draw_batches(DrawBatch const *batches, i64 count, ClipRect const& bounds, Vec2 origin) {
+		bool complete = true;
+		int boundProgram = 0;
+		int boundTexture = 0;
+		int boundVao = vao;
+		bool depthWrites = true;
+		// Nothing is scissored to element -2, so the first batch always sets it
+		auto scissorClip = ElementIndex{ -2 };
+		for (i64 i = 0; i < count; ++i) {
+			auto const& batch = batches[i];
+			// Nothing is drawn until the program has finished linking
+			auto program = programs.program({ static_cast<i32>(batch.program) });
+			if (!program) {
+				complete = false;
+				continue;
+			}
+			if (program != boundProgram) {
+				gl_use_program(program);
+				boundProgram = program;
+			}
+			// Translucent draws are still tested against the opaque ones in front of them
+			if (batch.translucent == depthWrites) {
+				depthWrites = !batch.translucent;
+				gl_depth_mask(depthWrites);
+			}
+			if (batch.clip.index != scissorClip.index) {
+				auto rect = batch.clip.index != -1 ? intersect(bounds, elementTree.child_clip_rect(batch.clip)) : bounds;
+				scissor_rect(rect, origin);
+				scissorClip = batch.clip;
+			}
+			if (batch.texture) {
+				auto texture = texture_handle(batch.texture);
+				if (texture != boundTexture) {
+					gl_bind_texture(GL_TEXTURE_2D, texture);
+					boundTexture = texture;
+				}
+			}
+
+			auto batchVao = batch.primitive == BatchPrimitive::SHAPES ? shapeVao
+				: batch.primitive == BatchPrimitive::GLYPHS ? glyphVao
+				: batch.primitive == BatchPrimitive::LINES ? lineVao
+				: vao;
+			if (batchVao != boundVao) {
+				gl_bind_vertex_array(batchVao);
+				boundVao = batchVao;
+			}
+			// WebGL has no base instance, so the instance attributes are pointed at the batch instead.
+			// GL_ARRAY_BUFFER is still the geometry buffer from init.
+			auto base = static_cast<GLintptr>(batch.first) * GeometryCache::vertexSize;
+			if (batch.primitive == BatchPrimitive::SHAPES) {
+				auto stride = shapeVertices * GeometryCache::vertexSize;
+				gl_vertex_attrib_pointer(0, 4, GL_FLOAT, 0, stride, base);
+				gl_vertex_attrib_pointer(1, 4, GL_FLOAT, 0, stride, base + 16);
+				gl_vertex_attrib_pointer(2, 4, GL_FLOAT, 0, stride, base + 32);
+				gl_vertex_attrib_pointer(3, 4, GL_FLOAT, 0, stride, base + 48);
+				gl_vertex_attrib_pointer(4, 4, GL_FLOAT, 0, stride, base + 64);
+				gl_vertex_attrib_pointer(5, 3, GL_FLOAT, 0, stride, base + 80);
+				gl_draw_arrays_instanced(GL_TRIANGLES, 0, 6, batch.count / shapeVertices);
+			} else if (batch.primitive == BatchPrimitive::GLYPHS) {
+				auto stride = glyphVertices * GeometryCache::vertexSize;
+				gl_vertex_attrib_pointer(0, 4, GL_FLOAT, 0, stride, base);
+				gl_vertex_attrib_pointer(1, 4, GL_FLOAT, 0, stride, base + 16);
+				gl_vertex_attrib_pointer(2, 4, GL_FLOAT, 0, stride, base + 32);
+				gl_vertex_attrib_pointer(3, 1, GL_FLOAT, 0, stride, base + 48);
+				gl_draw_arrays_instanced(GL_TRIANGLES, 0, 6, batch.count / glyphVertices);
+			} else if (batch.primitive == BatchPrimitive::LINES) {
+				// Instance i reads four slots from first + i: the point before, both ends and the point after
+				auto stride = GeometryCache::vertexSize;
+				gl_vertex_attrib_pointer(0, 2, GL_FLOAT, 0, stride, base);
+				gl_vertex_attrib_pointer(1, 1, GL_FLOAT, 0, stride, base + 16);
+				gl_vertex_attrib_pointer(2, 3, GL_FLOAT, 0, stride, base + stride);
+				gl_vertex_attrib_pointer(3, 4, GL_UNSIGNED_BYTE, 1, stride, base + stride + 12);
+				gl_vertex_attrib_pointer(4, 3, GL_FLOAT, 0, stride, base + stride + 16);
+				gl_vertex_attrib_pointer(5, 2, GL_FLOAT, 0, stride, base + 2 * stride);
+				gl_vertex_attrib_pointer(6, 1, GL_FLOAT, 0, stride, base + 2 * stride + 16);
+				gl_vertex_attrib_pointer(7, 2, GL_FLOAT, 0, stride, base + 3 * stride);
+				gl_vertex_attrib_pointer(8, 1, GL_FLOAT, 0, stride, base + 3 * stride + 16);
+				gl_draw_arrays_instanced(GL_TRIANGLES, 0, 6, batch.count - 3);
+			} else {
+				gl_draw_arrays(GL_TRIANGLES, batch.first, batch.count);
+			}
+		}
+		if (boundVao != vao)
+			gl_bind_vertex_array(vao);
+		// Clears only reach the depth buffer while writes are on
+		if (!depthWrites)
+			gl_depth_mask(true);
+		return complete;
+	}
+
+	int Context::texture_handle(u32 textureKey) const {
+		if (textureKey == glyphs.textureKey)
+			return glyphs.texture;
+		if (textureKey == iconGlyphs.textureKey)
+			return iconGlyphs.texture;
+		return layers.texture_handle(textureKey);
+	}
+
 	void Context::end_frame() {
+		PROFILE_ZONE("end_frame");
 		auto& frame = virtualFrames[virtualFrameIdx];
 		frame.fence = gl_fence_sync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		gl_stats_end_frame();
 		++virtualFrameIdx;
 		if (virtualFrameIdx >= virtualFrames.capacity)
 			virtualFrameIdx = 0;
@@ -402,21 +935,6 @@ namespace {
 
 }
 
-void push_rectangle(GLintptr *offset, Vec2 pos, Vec2 extent, Vec4 color) {
-
-	const f32 rectangle[] = {
-		pos.x           , pos.y           , color.x, color.y, color.z, color.w,
-		pos.x + extent.x, pos.y           , color.x, color.y, color.z, color.w,
-		pos.x + extent.x, pos.y + extent.y, color.x, color.y, color.z, color.w,
-		pos.x + extent.x, pos.y + extent.y, color.x, color.y, color.z, color.w,
-		pos.x           , pos.y + extent.y, color.x, color.y, color.z, color.w,
-		pos.x           , pos.y           , color.x, color.y, color.z, color.w,
-	};
-
-	gl_buffer_sub_data(GL_COPY_READ_BUFFER, *offset, rectangle, sizeof(rectangle));
-	*offset += sizeof(rectangle);
-}
-
 #define new_id() ElementId{ hash_combine(hash_int(__LINE__), hash_string(__FILE__)) }
 
 WASM_EXPORT(handleMousemove) void handle_mousemove(int x, int y) {
@@ -433,25 +951,101 @@ WASM_EXPORT(handleMouseup) void handle_mouseup(int button) {
 
 WASM_EXPORT(c_render) void c_render(f64 timestamp) {
 
+	PROFILE_FRAME_MARK();
+	PROFILE_ZONE("c_render");
+	ALLOC_SITE();
+
 	static f64 lastTimestamp = 0;
 
+	auto cpuBegin = profile_now();
+
 	auto dt = timestamp - lastTimestamp;
+	if (lastTimestamp != 0)
+		context->frameStats.record(FrameMetric::FRAME, dt * 1000.0);
 	lastTimestamp = timestamp;
 
-	if (!context->events.count)
+	// Nothing to draw, but the frame time still goes into the published percentiles
+	if (!context->events.count) {
+		context->frameStats.publish();
 		return;
+	}
 
-	(void)dt;
+	int mouseX = -1, mouseY = -1;
 
-	int mouseX, mouseY;
+	auto uiBegin = profile_now();
 
 	context->elementTree.begin_ui();
+	context->uploads.begin_frame();
+	context->glyphs.begin_frame();
+	context->iconGlyphs.begin_frame();
+	context->textRuns.begin_frame();
 
 	auto windowElem = context->elementTree.push_element({ -1 }, Element::from_id(new_id()));
 	auto otherElem = context->elementTree.push_element(windowElem, Element::from_id(new_id()));
 	context->elementTree[otherElem]->extent = { 32.f, 128.f };
 
+	// Static panel, drawn from its layer texture until one of its rows changes. The rows past its bottom
+	// edge are culled.
+	auto panelId = new_id();
+	auto panelElem = context->elementTree.push_element(windowElem, Element::from_id(panelId));
+	context->elementTree[panelElem]->pos = { 600.f, 40.f };
+	context->elementTree[panelElem]->extent = { 180.f, 520.f };
+	context->elementTree[panelElem]->flags |= Element::CACHE_LAYER_BIT | Element::CLIP_CHILDREN_BIT;
+	ElementIndex panelRows[24];
+	ElementIndex rowLabels[24];
+	for (i32 i = 0; i < 24; ++i) {
+		auto rowId = ElementId{ hash_combine(panelId.id, hash_int(static_cast<u64>(i))) };
+		panelRows[i] = context->elementTree.push_element(panelElem, Element::from_id(rowId));
+		context->elementTree[panelRows[i]]->pos = { 10.f, 10.f + static_cast<f32>(i) * 42.f };
+		context->elementTree[panelRows[i]]->extent = { 160.f, 34.f };
+		// Text is translucent, it has to be nearer than the opaque row to pass the depth test
+		rowLabels[i] = context->elementTree.push_element(panelRows[i], Element::from_id(ElementId{ hash_combine(rowId.id, 1) }));
+		context->elementTree[rowLabels[i]]->pos = { 10.f, 0.f };
+		context->elementTree[rowLabels[i]]->extent = { 140.f, 34.f };
+	}
+
+	// Pushed first so the button draws over it
+	auto buttonShadowElem = context->elementTree.push_element(windowElem, Element::from_id(new_id()));
+	context->elementTree[buttonShadowElem]->pos = { 200.f, 260.f };
+	context->elementTree[buttonShadowElem]->extent = { 160.f, 48.f };
+	auto buttonElem = context->elementTree.push_element(windowElem, Element::from_id(new_id()));
+	context->elementTree[buttonElem]->pos = { 200.f, 260.f };
+	context->elementTree[buttonElem]->extent = { 160.f, 48.f };
+	auto buttonLabelElem = context->elementTree.push_element(buttonElem, Element::from_id(new_id()));
+	context->elementTree[buttonLabelElem]->pos = { 20.f, 0.f };
+	context->elementTree[buttonLabelElem]->extent = { 120.f, 48.f };
+	auto dotElem = context->elementTree.push_element(windowElem, Element::from_id(new_id()));
+	context->elementTree[dotElem]->pos = { 400.f, 260.f };
+	context->elementTree[dotElem]->extent = { 48.f, 48.f };
+	u32 const iconSizes[3] = { 16, 32, 64 };
+	ElementIndex iconElems[3];
+	auto iconsId = new_id();
+	auto iconX = 200.f;
+	for (i32 i = 0; i < 3; ++i) {
+		auto size = static_cast<f32>(iconSizes[i]);
+		auto iconId = ElementId{ hash_combine(iconsId.id, hash_int(static_cast<u64>(i))) };
+		iconElems[i] = context->elementTree.push_element(windowElem, Element::from_id(iconId));
+		context->elementTree[iconElems[i]]->pos = { iconX, 340.f };
+		context->elementTree[iconElems[i]]->extent = { 3.f * size, 1.25f * size };
+		iconX += 3.f * size + 12.f;
+	}
+
+	auto seriesElem = context->elementTree.push_element(windowElem, Element::from_id(new_id()));
+	context->elementTree[seriesElem]->pos = { 40.f, 440.f };
+	context->elementTree[seriesElem]->extent = { static_cast<f32>(seriesPointCount), 140.f };
+	ElementIndex zigzagElems[3];
+	auto zigzagsId = new_id();
+	for (i32 i = 0; i < 3; ++i) {
+		auto zigzagId = ElementId{ hash_combine(zigzagsId.id, hash_int(static_cast<u64>(i))) };
+		zigzagElems[i] = context->elementTree.push_element(windowElem, Element::from_id(zigzagId));
+		context->elementTree[zigzagElems[i]]->pos = { 200.f + static_cast<f32>(i) * 120.f, 150.f };
+		context->elementTree[zigzagElems[i]]->extent = { 100.f, 80.f };
+	}
+
 	context->elementTree.end_ui();
+	context->elementTree.cull({ { 0.f, 0.f }, { 800.f, 600.f } });
+
+	context->frameStats.record(FrameMetric::UI, profile_now() - uiBegin);
 
 	for (auto evt : context->events) {
 		switch (evt.type) {
@@ -467,19 +1061,99 @@ WASM_EXPORT(c_render) void c_render(f64 timestamp) {
 	}
 	context->events.clear();
 
-	if (1
-			&& mouseX >= context->elementTree.elements[otherElem.index].pos.x
-			&& mouseX <= context->elementTree.elements[otherElem.index].pos.x
-				+ context->elementTree.elements[otherElem.index].extent.x
-			&& mouseY >= context->elementTree.elements[otherElem.index].pos.y
-			&& mouseY <= context->elementTree.elements[otherElem.index].pos.y
-				+ context->elementTree.elements[otherElem.index].extent.y
-				) {
-		push(&context->drawCommands, { otherElem, { 0.1f, 0.2f, 0.9f, 1.f }});
+	auto hovered = context->elementTree.hit_test({ static_cast<f32>(mouseX), static_cast<f32>(mouseY) });
+	auto otherKey = make_sort_key(0, false, static_cast<u32>(context->prog.index), 0, static_cast<u32>(otherElem.index));
+	if (hovered.index == otherElem.index) {
+		push(&context->drawCommands, { otherElem, { 0.1f, 0.2f, 0.9f, 1.f }, otherKey });
 	} else {
-		push(&context->drawCommands, { otherElem, { 1.f }});
+		push(&context->drawCommands, { otherElem, { 1.f }, otherKey });
+	}
+
+	push(&context->drawCommands, { panelElem, { 0.15f, 0.15f, 0.15f, 1.f },
+		make_sort_key(0, false, static_cast<u32>(context->prog.index), 0, static_cast<u32>(panelElem.index)) });
+	for (i32 i = 0; i < 24; ++i) {
+		auto row = panelRows[i];
+		auto rowHovered = hovered.index == row.index || hovered.index == rowLabels[i].index;
+		auto rowColor = rowHovered ? Vec4{ 0.3f, 0.3f, 0.5f, 1.f } : Vec4{ 0.25f, 0.25f, 0.25f, 1.f };
+		push(&context->drawCommands, { row, rowColor,
+			make_sort_key(0, false, static_cast<u32>(context->prog.index), 0, static_cast<u32>(row.index)) });
+	}
+
+	auto shapeProgram = static_cast<u32>(context->shapeProg.index);
+	auto buttonShadow = static_cast<i32>(context->drawShapes.count);
+	push(&context->drawShapes, DrawShape{ { 12.f, 12.f, 12.f, 12.f }, {}, 0.f, 6.f, { 0.f, -4.f } });
+	push(&context->drawCommands, { buttonShadowElem, { 0.f, 0.f, 0.f, 0.4f },
+		make_sort_key(0, true, shapeProgram, 0, static_cast<u32>(buttonShadowElem.index)), buttonShadow });
+
+	auto buttonShape = static_cast<i32>(context->drawShapes.count);
+	push(&context->drawShapes, DrawShape{ { 12.f, 12.f, 12.f, 12.f }, { 0.9f, 0.9f, 0.9f, 1.f }, 2.f, 0.f, {} });
+	auto buttonHovered = hovered.index == buttonElem.index || hovered.index == buttonLabelElem.index;
+	auto buttonColor = buttonHovered ? Vec4{ 0.2f, 0.4f, 0.9f, 1.f } : Vec4{ 0.15f, 0.3f, 0.7f, 1.f };
+	push(&context->drawCommands, { buttonElem, buttonColor,
+		make_sort_key(0, true, shapeProgram, 0, static_cast<u32>(buttonElem.index)), buttonShape });
+
+	// Labels stay laid out in the run cache, an unchanged one is a hash lookup
+	auto glyphProgram = static_cast<u32>(context->glyphProg.index);
+	auto buttonLabel = context->textRuns.prepare(0, 18, "Button");
+	if (buttonLabel != -1) {
+		push(&context->drawCommands, { buttonLabelElem, { 1.f, 1.f, 1.f, 1.f },
+			make_sort_key(0, true, glyphProgram, context->glyphs.textureKey, static_cast<u32>(buttonLabelElem.index)), -1, buttonLabel });
+	}
+	for (i32 i = 0; i < 24; ++i) {
+		char label[] = "Row 00";
+		label[4] = static_cast<char>('0' + i / 10);
+		label[5] = static_cast<char>('0' + i % 10);
+		auto run = context->textRuns.prepare(0, 14, String{ label, 6 });
+		if (run == -1)
+			continue;
+		push(&context->drawCommands, { rowLabels[i], { 0.9f, 0.9f, 0.9f, 1.f },
+			make_sort_key(0, true, glyphProgram, context->glyphs.textureKey, static_cast<u32>(rowLabels[i].index)), -1, run });
+	}
+
+	auto dotShape = static_cast<i32>(context->drawShapes.count);
+	push(&context->drawShapes, DrawShape{ { 24.f, 24.f, 24.f, 24.f }, {}, 0.f, 0.f, {} });
+	push(&context->drawCommands, { dotElem, { 0.9f, 0.5f, 0.1f, 1.f },
+		make_sort_key(0, true, shapeProgram, 0, static_cast<u32>(dotElem.index)), dotShape });
+
+	// The same distance fields at three sizes
+	auto msdfProgram = static_cast<u32>(context->msdfProg.index);
+	for (i32 i = 0; i < 3; ++i) {
+		auto run = context->textRuns.prepare(iconFont, iconSizes[i], iconText);
+		if (run == -1)
+			continue;
+		push(&context->drawCommands, { iconElems[i], { 0.95f, 0.95f, 0.6f, 1.f },
+			make_sort_key(0, true, msdfProgram, context->iconGlyphs.textureKey, static_cast<u32>(iconElems[i].index)), -1, run });
 	}
 
+	// One instance per segment, the joins and caps are worked out in the vertex shader
+	auto lineProgram = static_cast<u32>(context->lineProg.index);
+	auto seriesLine = static_cast<i32>(context->drawLines.count);
+	push(&context->drawLines, context->series);
+	push(&context->drawCommands, { seriesElem, { 0.3f, 0.8f, 0.5f, 1.f },
+		make_sort_key(0, true, lineProgram, 0, static_cast<u32>(seriesElem.index)), -1, -1, seriesLine });
+	LineJoin const zigzagJoins[3] = { LineJoin::MITER, LineJoin::ROUND, LineJoin::BEVEL };
+	LineCap const zigzagCaps[3] = { LineCap::BUTT, LineCap::ROUND, LineCap::SQUARE };
+	for (i32 i = 0; i < 3; ++i) {
+		auto line = static_cast<i32>(context->drawLines.count);
+		push(&context->drawLines, make_polyline(zigzagPoints, 4, 12.f, zigzagJoins[i], zigzagCaps[i]));
+		push(&context->drawCommands, { zigzagElems[i], { 0.9f, 0.8f, 0.3f, 0.8f },
+			make_sort_key(0, true, lineProgram, 0, static_cast<u32>(zigzagElems[i].index)), -1, -1, line });
+	}
+
+	// Uploaded before the runs resolve, so glyphs rasterized this frame are drawn if they fit the budget
+	context->glyphs.queue_upload(&context->uploads);
+	context->iconGlyphs.queue_upload(&context->uploads);
+	context->uploads.flush();
+	context->glyphs.sync(context->uploads);
+	context->iconGlyphs.sync(context->uploads);
+	// Glyphs rasterized for later labels may have moved the earlier ones in the atlas
+	context->textRuns.resolve();
+	auto tables = DrawTables{ context->drawShapes.data, context->textRuns.runs, context->drawLines.data };
+
+	auto renderBegin = profile_now();
+
+	context->programs.poll();
+
 	if (!context->begin_frame()) {
 		// We may not begin this frame
 		return;
@@ -487,21 +1161,67 @@ WASM_EXPORT(c_render) void c_render(f64 timestamp) {
 
 	auto const& frame = context->virtualFrames[context->virtualFrameIdx];
 
-	gl_clear_color(0.2f, 0.2f, 0.2f, 1.f);
-	gl_clear(GL_COLOR_BUFFER_BIT);
+	context->uniforms.begin_frame(static_cast<i32>(context->virtualFrameIdx));
+	auto sceneOffset = context->uniforms.push(SceneUniforms{ ortho(0, 800, 0, 600, 1, -1) });
 
 	gl_bind_buffer(GL_COPY_READ_BUFFER, frame.stagingBuffer);
-	gl_bind_buffer(GL_COPY_WRITE_BUFFER, context->geomBuf);
-
-	GLintptr offset = 0;
+	gl_bind_buffer(GL_COPY_WRITE_BUFFER, context->geometry.buffer);
+
+	// Numbered before culling, so a command keeps its ordinal when one before it goes offscreen
+	number_draw_commands(
+		temporaryAllocator, context->elementTree, context->drawCommands.data, context->drawCommands.count);
+	// Offscreen and clipped commands never reach the sort or vertex generation
+	auto commandCount = cull_hidden_commands(
+		context->elementTree, tables, context->drawCommands.data, context->drawCommands.count, context->drawCommands.data);
+	auto sortScratch = allocate<DrawCommand>(temporaryAllocator, commandCount);
+	sort_draw_commands(context->drawCommands.data, sortScratch, commandCount);
+
+	auto& damage = context->damage;
+	damage.begin_frame();
+	track_draw_commands(&damage, context->elementTree, tables, context->drawCommands.data, commandCount);
+	// The triangle below spins every frame
+	damage.add(Vec2{ 100.f - 15.f, 100.f - 15.f }, Vec2{ 30.f, 30.f });
+
+	auto& layers = context->layers;
+	layers.begin_frame();
+	auto layerRoots = allocate<ElementIndex>(temporaryAllocator, context->elementTree.elementCount);
+	auto layerCommands = allocate<DrawCommand>(temporaryAllocator, commandCount);
+	auto mainCommands = allocate<DrawCommand>(temporaryAllocator, commandCount + LayerCache::maxLayers);
+	commandCount = layers.extract(
+		context->elementTree, tables, context->drawCommands.data, commandCount, static_cast<u32>(context->compositeProg.index),
+		layerRoots, layerCommands, mainCommands);
+	context->drawCommands.clear();
 
-	for (i64 i = 0; i < context->drawCommands.count; ++i) {
-		auto drawCmd = &context->drawCommands[i];
-		auto const& pos = context->elementTree.positions[drawCmd->elementIndex.index];
-		auto const& elem = context->elementTree.elements[drawCmd->elementIndex.index];
-		push_rectangle(&offset, pos, elem.extent, drawCmd->color);
+	auto& geometry = context->geometry;
+	geometry.begin_frame();
+	// Decided on the main list, layer lists just scissor
+	ClipPlan clips;
+	clips.plan(temporaryAllocator, context->elementTree, mainCommands, commandCount);
+	retain_draw_commands(&geometry, context->elementTree, clips, tables, mainCommands, commandCount);
+
+	// Projections for the layers re-rendered this frame, each maps the root's corner to the texture origin
+	GLintptr layerScenes[LayerCache::maxLayers];
+	for (i32 l = 0; l < layers.layerCount; ++l) {
+		auto const& layer = layers.layers[l];
+		if (layer.frame != layers.frame)
+			continue;
+		retain_draw_commands(
+			&geometry, context->elementTree, clips, tables, layerCommands + layer.firstCommand, layer.commandCount);
+		if (!layers.needs_render(layer))
+			continue;
+
+		auto const& texture = layers.textures[layer.texture];
+		auto rootPos = context->elementTree.positions[layer.root.index];
+		layerScenes[l] = context->uniforms.push(SceneUniforms{ ortho(
+			rootPos.x, rootPos.x + static_cast<f32>(texture.width),
+			rootPos.y, rootPos.y + static_cast<f32>(texture.height), 1, -1) });
+		// A fresh texture isn't covered by the damage of its children
+		damage.add(rootPos, context->elementTree.elements[layer.root.index].extent);
 	}
-	context->drawCommands.clear();
+	damage.end_frame();
+
+	// Anything outside the damaged regions is already on the canvas from a previous frame
+	commandCount = cull_draw_commands(damage, context->elementTree, tables, mainCommands, commandCount, mainCommands);
 
 	Vec2 v0 = { -10.f, -10.f };
 	Vec2 v1 = { 10.f, -10.f };
@@ -511,33 +1231,173 @@ WASM_EXPORT(c_render) void c_render(f64 timestamp) {
 	v1 = rotate(v1, timestamp);
 	v2 = rotate(v2, timestamp);
 
+	// In front of every element
+	auto triangleDepth = element_depth({ context->elementTree.elementCount });
 	const f32 triangle[] = {
-		100.f + v0.x, 100.f + v0.y, 1.f, 0.f, 1.f, 1.f,
-		100.f + v1.x, 100.f + v1.y, 0.f, 1.f, 1.f, 1.f,
-		100.f + v2.x, 100.f + v2.y, 0.f, 0.f, 1.f, 1.f,
+		100.f + v0.x, 100.f + v0.y, triangleDepth, 1.f, 0.f, 1.f, 1.f,
+		100.f + v1.x, 100.f + v1.y, triangleDepth, 0.f, 1.f, 1.f, 1.f,
+		100.f + v2.x, 100.f + v2.y, triangleDepth, 0.f, 0.f, 1.f, 1.f,
 	};
 
-	gl_buffer_sub_data(GL_COPY_READ_BUFFER, offset, triangle, sizeof(triangle));
-	offset += sizeof(triangle);
+	f32 *triangleOut;
+	auto triangleId = new_id();
+	geometry.retain(triangleId, hash_int(static_cast<u64>(timestamp * 1000.0)), 3, &triangleOut);
+	if (triangleOut) {
+		for (i32 i = 0; i < 3 * vertexFloats; ++i)
+			triangleOut[i] = triangle[i];
+	}
+
+	// Compaction moves at most 64 rectangles a frame. Ranges move, so every retain comes before it and
+	// every batch after it.
+	geometry.end_frame(64 * 6);
+
+	// One extra for the triangle
+	auto batches = allocate<DrawBatch>(temporaryAllocator, commandCount + 1);
+	auto batchCount = batch_draw_commands(geometry, context->elementTree, clips, mainCommands, commandCount, batches);
+	auto triangleRange = geometry.range(triangleId);
+	if (triangleRange.count)
+		batches[batchCount++] = { static_cast<u32>(context->prog.index), 0, false, { -1 }, BatchPrimitive::TRIANGLES, triangleRange.first, triangleRange.count };
+
+	{
+		PROFILE_ZONE("gl_submit");
+		// Geometry is drawn the frame it's retained and has no placeholder, so it isn't deferred
+		context->uploads.record_direct(geometry.upload(1<<20));
+		context->uniforms.upload();
+
+		// Vertices that didn't fit in the staging buffer are drawn stale, so the frame and its layers are
+		// painted again once they land
+		bool uploaded = !geometry.pending();
+		bool complete = uploaded;
+
+		// Clears are scissored too, every pass sets its bounds before clearing
+		gl_enable(GL_SCISSOR_TEST);
+
+		bool layerPasses = false;
+		for (i32 l = 0; l < layers.layerCount; ++l) {
+			auto& layer = layers.layers[l];
+			if (!layers.needs_render(layer))
+				continue;
+
+			auto const& texture = layers.textures[layer.texture];
+			auto rootPos = context->elementTree.positions[layer.root.index];
+			auto bounds = ClipRect{ rootPos, rootPos + Vec2{ static_cast<f32>(texture.width), static_cast<f32>(texture.height) } };
+			gl_bind_framebuffer(GL_FRAMEBUFFER, texture.framebuffer);
+			gl_viewport(0, 0, texture.width, texture.height);
+			context->uniforms.bind(0, layerScenes[l], sizeof(SceneUniforms));
+			scissor_rect(bounds, rootPos);
+			gl_clear_color(0.f, 0.f, 0.f, 0.f);
+			gl_clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+			auto layerBatches = allocate<DrawBatch>(temporaryAllocator, layer.commandCount);
+			auto layerBatchCount = batch_draw_commands(
+				geometry, context->elementTree, clips, layerCommands + layer.firstCommand, layer.commandCount, layerBatches);
+			// Incomplete layers are rendered again next frame
+			if (context->draw_batches(layerBatches, layerBatchCount, bounds, rootPos) && uploaded)
+				layers.mark_rendered(&layer);
+			else
+				complete = false;
+			layerPasses = true;
+		}
+		if (layerPasses) {
+			gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+			gl_viewport(0, 0, 800, 600);
+		}
 
-	gl_copy_buffer_sub_data(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, offset);
+		context->uniforms.bind(0, sceneOffset, sizeof(SceneUniforms));
+		gl_clear_color(0.2f, 0.2f, 0.2f, 1.f);
+
+		if (damage.full) {
+			auto bounds = ClipRect{ { 0.f, 0.f }, { 800.f, 600.f } };
+			scissor_rect(bounds, {});
+			gl_clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			complete &= context->draw_batches(batches, batchCount, bounds, {});
+		} else {
+			for (i32 i = 0; i < damage.rectCount; ++i) {
+				auto bounds = ClipRect{ damage.rects[i].min, damage.rects[i].max };
+				scissor_rect(bounds, {});
+				gl_clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				complete &= context->draw_batches(batches, batchCount, bounds, {});
+			}
+		}
+		gl_disable(GL_SCISSOR_TEST);
+
+		// Repaint everything once the missing programs are ready and the geometry is uploaded
+		if (complete)
+			damage.presented();
+		else
+			damage.invalidate();
+	}
 
-	gl_use_program(context->prog);
-	gl_draw_arrays(GL_TRIANGLES, 0, offset / 24);
+	layers.end_frame();
+	context->drawShapes.clear();
+	context->drawLines.clear();
 
 	context->end_frame();
 
+	auto cpuEnd = profile_now();
+	context->frameStats.record(FrameMetric::RENDER, cpuEnd - renderBegin);
+	context->frameStats.record(FrameMetric::CPU, cpuEnd - cpuBegin);
+	context->frameStats.publish();
+
+#ifdef SHRUB_ALLOC_STATS
+	for (i64 i = 0; i < allocTrackers.capacity; ++i)
+		allocTrackers[i].end_frame();
+#endif
+
 	temporaryAllocator->clear();
 }
 
+WASM_EXPORT(frameStats) FrameStatsBlock const* frame_stats() {
+	return &context->frameStats.block;
+}
+
+WASM_EXPORT(uploadStats) UploadStatsBlock const* upload_stats() {
+	return &context->uploads.stats;
+}
+
+WASM_EXPORT(setUploadBudget) void set_upload_budget(u32 bytes, f64 ms) {
+	context->uploads.set_budget(static_cast<GLsizeiptr>(bytes), ms);
+}
+
+#ifdef SHRUB_GL_STATS
+WASM_EXPORT(glStats) GLStats const* gl_stats() {
+	return &glStats;
+}
+#endif
+
+#ifdef SHRUB_ALLOC_STATS
+WASM_EXPORT(allocStats) AllocStats const* alloc_stats(i32 index) {
+	if (index < 0 || index >= allocTrackers.capacity)
+		return nullptr;
+	return &allocTrackers[index].stats;
+}
+#endif
+
+#ifdef SHRUB_PROFILE
+WASM_EXPORT(profileTrace) char const* profile_trace() {
+	auto size = profiler.write_trace(nullptr, 0);
+	auto buffer = allocate<char>(temporaryAllocator, size + 1);
+	profiler.write_trace(buffer, size);
+	buffer[size] = '\0';
+	return buffer;
+}
+#endif
+
 WASM_EXPORT(c_init) void c_init() {
 	heapPtr = &__heap_base;
 
-	globAlloc = make_arena_allocator(1<<20);
+	ALLOC_SITE();
+
+	globAlloc = make_arena_allocator(16<<20);
 	tempAlloc = make_arena_allocator(1<<29);
 
+#ifdef SHRUB_ALLOC_STATS
+	globalAllocator = allocTrackers[0].init("global", &globAlloc, 16<<20);
+	temporaryAllocator = allocTrackers[1].init("temporary", &tempAlloc, 1<<29);
+#else
 	globalAllocator = &globAlloc;
 	temporaryAllocator = &tempAlloc;
+#endif
 
 	console_fmt("Hello JS %g\n", 5);
 
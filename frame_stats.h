@@ -0,0 +1,190 @@
+#pragma once
+
+#include <oak_util/types.h>
+
+namespace shrub {
+
+	using namespace oak;
+
+	enum class FrameMetric : i32 {
+		// Time between c_render calls
+		FRAME,
+		// CPU time spent inside c_render
+		CPU,
+		// begin_ui through end_ui
+		UI,
+		// begin_frame through end_frame
+		RENDER,
+		COUNT,
+	};
+
+	// Log-linear buckets over microseconds: exact below 2^subBucketBits, then 2^subBucketBits
+	// buckets per power of two, so every bucket is within ~6% of the values it holds.
+	struct FrameHistogram {
+		static constexpr u32 subBucketBits = 4;
+		static constexpr u32 subBucketCount = 1 << subBucketBits;
+		static constexpr u32 maxValueBits = 24;
+		static constexpr u32 maxValue = (1u << maxValueBits) - 1;
+		static constexpr i32 bucketCount = (maxValueBits - subBucketBits + 1) * subBucketCount;
+
+		u32 counts[bucketCount];
+		u32 total;
+
+		static i32 bucket_index(u32 us);
+		// Highest value that maps to index
+		static u32 bucket_value(i32 index);
+
+		void add(i32 index) {
+			++counts[index];
+			++total;
+		}
+
+		void remove(i32 index) {
+			--counts[index];
+			--total;
+		}
+
+		u32 percentile(u32 perMille) const;
+	};
+
+	inline i32 FrameHistogram::bucket_index(u32 us) {
+		if (us > maxValue)
+			us = maxValue;
+		if (us < subBucketCount)
+			return static_cast<i32>(us);
+		auto msb = 31 - static_cast<u32>(__builtin_clz(us));
+		auto sub = (us >> (msb - subBucketBits)) - subBucketCount;
+		return static_cast<i32>((msb - subBucketBits + 1) * subBucketCount + sub);
+	}
+
+	inline u32 FrameHistogram::bucket_value(i32 index) {
+		auto group = static_cast<u32>(index) >> subBucketBits;
+		auto sub = static_cast<u32>(index) & (subBucketCount - 1);
+		if (group == 0)
+			return sub;
+		auto shift = group - 1;
+		return ((subBucketCount + sub) << shift) + (1u << shift) - 1;
+	}
+
+	inline u32 FrameHistogram::percentile(u32 perMille) const {
+		if (!total)
+			return 0;
+		// Rank of the sample at or above perMille, rounded up so p100 is the last sample
+		auto rank = (static_cast<u64>(total) * perMille + 999) / 1000;
+		if (rank == 0)
+			rank = 1;
+		u64 seen = 0;
+		for (i32 i = 0; i < bucketCount; ++i) {
+			seen += counts[i];
+			if (seen >= rank)
+				return bucket_value(i);
+		}
+		return maxValue;
+	}
+
+	// Times in microseconds, every field is a u32 so the block maps onto a Uint32Array in JS
+	struct FrameWindowStats {
+		u32 count;
+		u32 p50;
+		u32 p95;
+		u32 p99;
+		u32 max;
+	};
+
+	struct FrameMetricStats {
+		FrameWindowStats shortWindow;
+		FrameWindowStats longWindow;
+	};
+
+	struct FrameStatsBlock {
+		u32 frame;
+		u32 shortWindowSize;
+		u32 longWindowSize;
+		FrameMetricStats metrics[static_cast<i32>(FrameMetric::COUNT)];
+	};
+
+	struct FrameStats {
+		static constexpr u32 shortWindow = 64;
+		static constexpr u32 longWindow = 1024;
+
+		static_assert((longWindow & (longWindow - 1)) == 0, "Sample ring size must be a power of two");
+
+		struct Series {
+			u32 samples[longWindow];
+			u64 head;
+			FrameHistogram shortHistogram;
+			FrameHistogram longHistogram;
+		};
+
+		Series series[static_cast<i32>(FrameMetric::COUNT)];
+		FrameStatsBlock block;
+
+		void init();
+
+		void record(FrameMetric metric, f64 ms);
+
+		// Recomputes the percentiles in block from the current windows
+		void publish();
+	};
+
+	inline void FrameStats::init() {
+		for (auto& s : series) {
+			s.head = 0;
+			s.shortHistogram = {};
+			s.longHistogram = {};
+		}
+		block = {};
+		block.shortWindowSize = shortWindow;
+		block.longWindowSize = longWindow;
+	}
+
+	inline void FrameStats::record(FrameMetric metric, f64 ms) {
+		auto& s = series[static_cast<i32>(metric)];
+
+		auto us = ms <= 0.0 ? 0u : ms * 1000.0 >= FrameHistogram::maxValue
+			? FrameHistogram::maxValue
+			: static_cast<u32>(ms * 1000.0);
+
+		if (s.head >= shortWindow)
+			s.shortHistogram.remove(FrameHistogram::bucket_index(s.samples[(s.head - shortWindow) & (longWindow - 1)]));
+		if (s.head >= longWindow)
+			s.longHistogram.remove(FrameHistogram::bucket_index(s.samples[s.head & (longWindow - 1)]));
+
+		s.samples[s.head & (longWindow - 1)] = us;
+		++s.head;
+
+		auto index = FrameHistogram::bucket_index(us);
+		s.shortHistogram.add(index);
+		s.longHistogram.add(index);
+	}
+
+	inline void FrameStats::publish() {
+		++block.frame;
+		for (i32 m = 0; m < static_cast<i32>(FrameMetric::COUNT); ++m) {
+			auto const& s = series[m];
+			auto& out = block.metrics[m];
+
+			out.shortWindow.count = s.shortHistogram.total;
+			out.shortWindow.p50 = s.shortHistogram.percentile(500);
+			out.shortWindow.p95 = s.shortHistogram.percentile(950);
+			out.shortWindow.p99 = s.shortHistogram.percentile(990);
+			out.longWindow.count = s.longHistogram.total;
+			out.longWindow.p50 = s.longHistogram.percentile(500);
+			out.longWindow.p95 = s.longHistogram.percentile(950);
+			out.longWindow.p99 = s.longHistogram.percentile(990);
+
+			// Exact maxima, the histogram only bounds them to a bucket
+			out.shortWindow.max = 0;
+			out.longWindow.max = 0;
+			auto n = s.head < longWindow ? s.head : longWindow;
+			for (u64 i = 0; i < n; ++i) {
+				auto v = s.samples[(s.head - 1 - i) & (longWindow - 1)];
+				if (i < shortWindow && v > out.shortWindow.max)
+					out.shortWindow.max = v;
+				if (v > out.longWindow.max)
+					out.longWindow.max = v;
+			}
+		}
+	}
+
+}
@@ -0,0 +1,485 @@
+#include "geometry_cache.h"
+
+#include "profile.h"
+
+namespace shrub {
+
+	namespace {
+
+		u64 hash_f32(u64 hash, f32 value) {
+			u32 bits;
+			__builtin_memcpy(&bits, &value, sizeof(bits));
+			return hash_combine(hash, hash_int(bits));
+		}
+
+		u64 hash_rectangle(Vec2 pos, Vec2 extent, f32 depth, Vec4 color) {
+			u64 hash = 0;
+			hash = hash_f32(hash, pos.x);
+			hash = hash_f32(hash, pos.y);
+			hash = hash_f32(hash, depth);
+			hash = hash_f32(hash, extent.x);
+			hash = hash_f32(hash, extent.y);
+			hash = hash_f32(hash, color.x);
+			hash = hash_f32(hash, color.y);
+			hash = hash_f32(hash, color.z);
+			hash = hash_f32(hash, color.w);
+			return hash;
+		}
+
+		// Moves the edges inside clip, the uv rect follows so the texture isn't squashed
+		void clip_rectangle(Vec2 *pos, Vec2 *extent, Vec4 *uvRect, ClipRect const& clip) {
+			auto min = *pos;
+			auto max = *pos + *extent;
+			auto clipped = intersect(clip, { min, max });
+			auto clippedMin = clipped.min;
+			auto clippedMax = clipped.max;
+
+			auto du = (uvRect->z - uvRect->x) / extent->x;
+			auto dv = (uvRect->w - uvRect->y) / extent->y;
+			*uvRect = {
+				uvRect->x + (clippedMin.x - min.x) * du,
+				uvRect->y + (clippedMin.y - min.y) * dv,
+				uvRect->z - (max.x - clippedMax.x) * du,
+				uvRect->w - (max.y - clippedMax.y) * dv,
+			};
+			*pos = clippedMin;
+			*extent = { clippedMax.x - clippedMin.x, clippedMax.y - clippedMin.y };
+		}
+
+		// An element can be drawn by several programs, e.g. a cached layer's root and its composite
+		ElementId geometry_id(ElementTree const& tree, DrawCommand const& drawCmd) {
+			auto id = command_id(tree, drawCmd);
+			auto state = sort_key_program(drawCmd.sortKey) << SORT_KEY_TEXTURE_BITS | sort_key_texture(drawCmd.sortKey);
+			return state ? ElementId{ hash_combine(id.id, hash_int(state)) } : id;
+		}
+
+	}
+
+	void GeometryCache::init(Allocator *allocator, GLint vertexCapacity_, i32 slotCapacity_) {
+		vertexCapacity = vertexCapacity_;
+		vertexTop = 0;
+		vertices = allocate<f32>(allocator, static_cast<i64>(vertexCapacity) * vertexFloats);
+
+		slotCapacity = 16;
+		while (slotCapacity < slotCapacity_)
+			slotCapacity <<= 1;
+		slotCount = 0;
+		slots = allocate<GeometrySlot>(allocator, slotCapacity);
+		for (i32 i = 0; i < slotCapacity; ++i)
+			slots[i] = {};
+
+		// Holes are always separated by a live range, so there can't be more of them than slots
+		freeCapacity = slotCapacity;
+		freeCount = 0;
+		freeRanges = allocate<GeometryRange>(allocator, freeCapacity);
+
+		dirtyCapacity = slotCapacity;
+		dirtyCount = 0;
+		dirtyRanges = allocate<GeometryRange>(allocator, dirtyCapacity);
+		allDirty = false;
+
+		frame = 0;
+
+		buffer = gl_create_buffer();
+		gl_bind_buffer(GL_ARRAY_BUFFER, buffer);
+		gl_buffer_data(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(vertexCapacity) * vertexSize, GL_DYNAMIC_DRAW);
+	}
+
+	void GeometryCache::begin_frame() {
+		++frame;
+	}
+
+	GeometryRange GeometryCache::retain(ElementId id, u64 inputHash, GLint count, f32 **out) {
+		assert(id.id != 0);
+		*out = nullptr;
+
+		auto index = find_slot(id.id);
+		auto& slot = slots[index];
+
+		if (slot.id && slot.range.count != count) {
+			free_range(slot.range);
+			slot.range = {};
+		}
+
+		if (!slot.id) {
+			if (slotCount >= slotCapacity / 2)
+				return {};
+			slot = { id.id, inputHash, {}, frame };
+			++slotCount;
+		} else {
+			slot.frame = frame;
+			if (slot.range.count && slot.inputHash == inputHash)
+				return slot.range;
+			slot.inputHash = inputHash;
+		}
+
+		if (!slot.range.count) {
+			slot.range = allocate_range(count, vertexCapacity);
+			if (!slot.range.count) {
+				erase_slot(index);
+				return {};
+			}
+		}
+
+		mark_dirty(slot.range);
+		*out = vertices + static_cast<i64>(slot.range.first) * vertexFloats;
+		return slot.range;
+	}
+
+	GeometryRange GeometryCache::range(ElementId id) const {
+		auto const& slot = slots[find_slot(id.id)];
+		return slot.id ? slot.range : GeometryRange{};
+	}
+
+	void GeometryCache::end_frame(GLint compactBudget) {
+		PROFILE_ZONE("geometry_end_frame");
+
+		for (i32 i = 0; i < slotCapacity;) {
+			auto& slot = slots[i];
+			if (!slot.id) {
+				++i;
+				continue;
+			}
+
+			if (slot.frame != frame) {
+				free_range(slot.range);
+				// Erasing may shift a later slot into i, so look at it again
+				erase_slot(i);
+				continue;
+			}
+
+			// Slide live ranges down into the lowest hole that fits them, the holes then bubble up to
+			// vertexTop where free_range drops them
+			if (compactBudget >= slot.range.count && freeCount && freeRanges[0].first < slot.range.first) {
+				auto moved = allocate_range(slot.range.count, slot.range.first);
+				if (moved.count) {
+					__builtin_memcpy(
+						vertices + static_cast<i64>(moved.first) * vertexFloats,
+						vertices + static_cast<i64>(slot.range.first) * vertexFloats,
+						static_cast<usize>(moved.count) * vertexSize);
+					free_range(slot.range);
+					slot.range = moved;
+					mark_dirty(moved);
+					compactBudget -= moved.count;
+				}
+			}
+			++i;
+		}
+	}
+
+	GLsizeiptr GeometryCache::upload(GLsizeiptr stagingCapacity) {
+		if (allDirty) {
+			allDirty = false;
+			dirtyCount = 0;
+			if (vertexTop)
+				dirtyRanges[dirtyCount++] = { 0, vertexTop };
+		}
+
+		if (!dirtyCount)
+			return 0;
+
+		PROFILE_ZONE("geometry_upload");
+
+		// Ranges are mostly appended in order, insertion sort is close to linear here
+		for (i32 i = 1; i < dirtyCount; ++i) {
+			auto range = dirtyRanges[i];
+			auto j = i;
+			for (; j > 0 && dirtyRanges[j - 1].first > range.first; --j)
+				dirtyRanges[j] = dirtyRanges[j - 1];
+			dirtyRanges[j] = range;
+		}
+
+		i32 merged = 0;
+		for (i32 i = 1; i < dirtyCount; ++i) {
+			auto& last = dirtyRanges[merged];
+			auto range = dirtyRanges[i];
+			if (range.first <= last.first + last.count + coalesceGap) {
+				auto end = range.first + range.count;
+				if (end > last.first + last.count)
+					last.count = end - last.first;
+			} else {
+				dirtyRanges[++merged] = range;
+			}
+		}
+		dirtyCount = merged + 1;
+
+		GLsizeiptr staged = 0;
+		i32 uploaded = 0;
+		for (; uploaded < dirtyCount; ++uploaded) {
+			auto& range = dirtyRanges[uploaded];
+			auto fit = static_cast<GLint>((stagingCapacity - staged) / vertexSize);
+			if (!fit)
+				break;
+
+			auto count = range.count < fit ? range.count : fit;
+			auto size = static_cast<GLsizeiptr>(count) * vertexSize;
+			gl_buffer_sub_data(GL_COPY_READ_BUFFER, staged,
+				vertices + static_cast<i64>(range.first) * vertexFloats, size);
+			gl_copy_buffer_sub_data(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+				staged, static_cast<GLintptr>(range.first) * vertexSize, size);
+			staged += size;
+
+			if (count < range.count) {
+				// Out of staging space, the rest goes next frame
+				range.first += count;
+				range.count -= count;
+				break;
+			}
+		}
+
+		for (i32 i = uploaded; i < dirtyCount; ++i)
+			dirtyRanges[i - uploaded] = dirtyRanges[i];
+		dirtyCount -= uploaded;
+
+		return staged;
+	}
+
+	bool GeometryCache::pending() const {
+		return allDirty || dirtyCount;
+	}
+
+	i32 GeometryCache::find_slot(u64 id) const {
+		auto mask = static_cast<u64>(slotCapacity - 1);
+		auto index = id & mask;
+		while (slots[index].id && slots[index].id != id)
+			index = (index + 1) & mask;
+		return static_cast<i32>(index);
+	}
+
+	void GeometryCache::erase_slot(i32 index) {
+		// Backward shift deletion, pulls later entries of the probe run into the hole so lookups never
+		// need tombstones
+		auto mask = slotCapacity - 1;
+		auto hole = index;
+		auto next = index;
+		for (;;) {
+			next = (next + 1) & mask;
+			if (!slots[next].id)
+				break;
+			auto home = static_cast<i32>(slots[next].id & static_cast<u64>(mask));
+			auto distanceToHole = (next - hole) & mask;
+			auto distanceToHome = (next - home) & mask;
+			if (distanceToHome >= distanceToHole) {
+				slots[hole] = slots[next];
+				hole = next;
+			}
+		}
+		slots[hole] = {};
+		--slotCount;
+	}
+
+	GeometryRange GeometryCache::allocate_range(GLint count, GLint below) {
+		// First fit keeps allocations packed towards the start of the buffer
+		for (i32 i = 0; i < freeCount; ++i) {
+			auto& hole = freeRanges[i];
+			if (hole.first >= below)
+				break;
+			if (hole.count < count)
+				continue;
+
+			auto result = GeometryRange{ hole.first, count };
+			hole.first += count;
+			hole.count -= count;
+			if (!hole.count) {
+				for (i32 j = i + 1; j < freeCount; ++j)
+					freeRanges[j - 1] = freeRanges[j];
+				--freeCount;
+			}
+			return result;
+		}
+
+		if (vertexTop >= below || vertexTop + count > vertexCapacity)
+			return {};
+
+		auto result = GeometryRange{ vertexTop, count };
+		vertexTop += count;
+		return result;
+	}
+
+	void GeometryCache::free_range(GeometryRange range) {
+		if (!range.count)
+			return;
+
+		i32 i = 0;
+		while (i < freeCount && freeRanges[i].first < range.first)
+			++i;
+
+		bool joinsPrev = i > 0 && freeRanges[i - 1].first + freeRanges[i - 1].count == range.first;
+		bool joinsNext = i < freeCount && range.first + range.count == freeRanges[i].first;
+
+		if (joinsPrev && joinsNext) {
+			freeRanges[i - 1].count += range.count + freeRanges[i].count;
+			for (i32 j = i + 1; j < freeCount; ++j)
+				freeRanges[j - 1] = freeRanges[j];
+			--freeCount;
+			i -= 1;
+		} else if (joinsPrev) {
+			freeRanges[i - 1].count += range.count;
+			i -= 1;
+		} else if (joinsNext) {
+			freeRanges[i].first = range.first;
+			freeRanges[i].count += range.count;
+		} else {
+			assert(freeCount < freeCapacity);
+			for (i32 j = freeCount; j > i; --j)
+				freeRanges[j] = freeRanges[j - 1];
+			freeRanges[i] = range;
+			++freeCount;
+		}
+
+		// A hole touching the top just lowers it
+		auto& last = freeRanges[freeCount - 1];
+		if (last.first + last.count == vertexTop) {
+			vertexTop = last.first;
+			--freeCount;
+		}
+	}
+
+	void GeometryCache::mark_dirty(GeometryRange range) {
+		if (allDirty)
+			return;
+
+		if (dirtyCount) {
+			auto& last = dirtyRanges[dirtyCount - 1];
+			if (last.first + last.count == range.first) {
+				last.count += range.count;
+				return;
+			}
+		}
+
+		if (dirtyCount == dirtyCapacity) {
+			allDirty = true;
+			return;
+		}
+		dirtyRanges[dirtyCount++] = range;
+	}
+
+	void retain_draw_commands(
+			GeometryCache *cache, ElementTree const& tree, ClipPlan const& clips, DrawTables const& tables,
+			DrawCommand const *commands, i64 count) {
+		PROFILE_ZONE("vertex_gen");
+		for (i64 i = 0; i < count; ++i) {
+			auto const& drawCmd = commands[i];
+			auto pos = tree.positions[drawCmd.elementIndex.index];
+			auto extent = tree.extents[drawCmd.elementIndex.index];
+			auto color = drawCmd.color;
+			auto depth = element_depth(drawCmd.elementIndex);
+			auto textured = sort_key_texture(drawCmd.sortKey) != 0;
+
+			auto clip = clips.geometry_clip(tree, drawCmd.elementIndex);
+
+			// Cutting the quad would cut the rounded corners off, shapes discard outside the clip rect instead.
+			// Shadows reach past the element, so clip_source can't tell whether they need clipping.
+			if (drawCmd.shape != -1) {
+				auto const& shape = tables.shapes[drawCmd.shape];
+				auto const& clipRect = clip.index != -1 || shape.shadowBlur > 0.f
+					? tree.clipRects[drawCmd.elementIndex.index]
+					: unboundedClip;
+				auto hash = hash_rectangle(pos, extent, depth, color);
+				hash = hash_combine(hash, hash_shape(shape));
+				hash = hash_combine(hash, hash_rectangle(clipRect.min, clipRect.max, 0.f, {}));
+
+				f32 *out;
+				cache->retain(geometry_id(tree, drawCmd), hash, shapeVertices, &out);
+				if (out)
+					write_shape(out, pos, extent, depth, color, shape, clipRect);
+				continue;
+			}
+
+			// Glyphs move in the atlas when it's repacked, which changes their uvs but not the run's hash
+			if (drawCmd.text != -1) {
+				auto const& run = tables.texts[drawCmd.text];
+				if (!run.glyphCount)
+					continue;
+				auto origin = text_origin(run, pos, extent);
+				auto const& clipRect = clip.index != -1 ? tree.clipRects[drawCmd.elementIndex.index] : unboundedClip;
+				auto hash = hash_rectangle(origin, {}, depth, color);
+				hash = hash_combine(hash, run.hash);
+				hash = hash_combine(hash, hash_int(run.generation));
+				hash = hash_combine(hash, hash_rectangle(clipRect.min, clipRect.max, 0.f, {}));
+
+				f32 *out;
+				cache->retain(geometry_id(tree, drawCmd), hash, run.glyphCount * glyphVertices, &out);
+				if (!out)
+					continue;
+				for (i32 g = 0; g < run.glyphCount; ++g) {
+					auto const& glyph = run.glyphs[g];
+					auto glyphPos = origin + glyph.pos;
+					auto glyphExtent = glyph.extent;
+					auto uvRect = glyph.uvRect;
+					if (clip.index != -1) {
+						clip_rectangle(&glyphPos, &glyphExtent, &uvRect, clipRect);
+						// Entirely outside, an empty instance keeps the run's count fixed
+						if (glyphExtent.x <= 0.f || glyphExtent.y <= 0.f)
+							glyphExtent = {};
+					}
+					write_glyph(out + g * glyphVertices * vertexFloats, glyphPos, glyphExtent, depth, color, uvRect);
+				}
+				continue;
+			}
+
+			// Joins can't be cut to a rect on the CPU, lines are always scissored instead
+			if (drawCmd.line != -1) {
+				auto const& line = tables.lines[drawCmd.line];
+				if (line.pointCount < 2 || line.width <= 0.f)
+					continue;
+				auto hash = hash_combine(hash_rectangle(pos, {}, depth, color), line.hash);
+
+				f32 *out;
+				cache->retain(geometry_id(tree, drawCmd), hash, polyline_vertices(line), &out);
+				if (out)
+					write_polyline(out, pos, depth, color, line);
+				continue;
+			}
+
+			if (clip.index != -1) {
+				auto uvRect = textured ? color : Vec4{ 0.f, 0.f, 1.f, 1.f };
+				clip_rectangle(&pos, &extent, &uvRect, tree.clipRects[drawCmd.elementIndex.index]);
+				if (textured)
+					color = uvRect;
+			}
+
+			f32 *out;
+			cache->retain(geometry_id(tree, drawCmd), hash_rectangle(pos, extent, depth, color), 6, &out);
+			if (!out)
+				continue;
+			if (textured)
+				write_textured_rectangle(out, pos, extent, depth, color);
+			else
+				write_rectangle(out, pos, extent, depth, color);
+		}
+	}
+
+	i64 batch_draw_commands(
+			GeometryCache const& cache, ElementTree const& tree, ClipPlan const& clips,
+			DrawCommand const *commands, i64 count, DrawBatch *batches) {
+		PROFILE_ZONE("draw_batch");
+		i64 batchCount = 0;
+		for (i64 i = 0; i < count; ++i) {
+			auto const& drawCmd = commands[i];
+			auto range = cache.range(geometry_id(tree, drawCmd));
+			if (!range.count)
+				continue;
+
+			auto program = sort_key_program(drawCmd.sortKey);
+			auto texture = sort_key_texture(drawCmd.sortKey);
+			auto translucent = sort_key_translucent(drawCmd.sortKey);
+			auto primitive = command_primitive(drawCmd);
+			auto clip = primitive == BatchPrimitive::LINES
+				? tree.clipParents[drawCmd.elementIndex.index]
+				: clips.scissor_clip(tree, drawCmd.elementIndex);
+			if (batchCount) {
+				auto& last = batches[batchCount - 1];
+				if (last.program == program && last.texture == texture && last.translucent == translucent
+						&& last.clip.index == clip.index && last.primitive == primitive
+						&& last.first + last.count == range.first) {
+					last.count += range.count;
+					continue;
+				}
+			}
+			batches[batchCount++] = { program, texture, translucent, clip, primitive, range.first, range.count };
+		}
+		return batchCount;
+	}
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <oak_util/types.h>
+
+#include "shrub.h"
+
+namespace shrub {
+
+	using namespace oak;
+
+	// In vertices of GeometryCache::vertexSize bytes
+	struct GeometryRange {
+		GLint first;
+		GLint count;
+	};
+
+	struct GeometrySlot {
+		u64 id;
+		u64 inputHash;
+		GeometryRange range;
+		u32 frame;
+	};
+
+	// Retained vertex storage. Every element owns a stable range of one GL buffer and a CPU copy of it;
+	// the vertices are only regenerated and re-uploaded when the hash of their inputs changes. Dirty
+	// ranges are coalesced and staged through the virtual frame's staging buffer, so upload bandwidth
+	// follows the change rate instead of the scene size. Ranges of elements that stop being drawn are
+	// freed at end_frame, which also slides a bounded number of live ranges down into the holes.
+	struct GeometryCache {
+		static constexpr GLint vertexSize = static_cast<GLint>(shrub::vertexFloats * sizeof(f32));
+		// Dirty ranges closer than this are uploaded as one, the gap is cheaper than another call
+		static constexpr GLint coalesceGap = 64;
+
+		int buffer = 0;
+		f32 *vertices = nullptr;
+		GLint vertexCapacity = 0;
+		GLint vertexTop = 0;
+
+		// Open addressed on ElementId with linear probing
+		GeometrySlot *slots = nullptr;
+		i32 slotCapacity = 0;
+		i32 slotCount = 0;
+
+		// Sorted by first and never adjacent to each other or to vertexTop
+		GeometryRange *freeRanges = nullptr;
+		i32 freeCount = 0;
+		i32 freeCapacity = 0;
+
+		GeometryRange *dirtyRanges = nullptr;
+		i32 dirtyCount = 0;
+		i32 dirtyCapacity = 0;
+		// Set when dirtyRanges overflowed, everything below vertexTop is uploaded instead
+		bool allDirty = false;
+
+		u32 frame = 0;
+
+		// slotCapacity is rounded up to a power of two and should be well above the element count
+		void init(Allocator *allocator, GLint vertexCapacity_, i32 slotCapacity_);
+
+		void begin_frame();
+
+		// Keeps the range of id alive for this frame, allocating it on first use. *out points at the
+		// vertices to write when they are new or inputHash changed, otherwise it is null. Returns an
+		// empty range when the buffer is full.
+		GeometryRange retain(ElementId id, u64 inputHash, GLint count, f32 **out);
+
+		// Range retained for id, empty if there is none
+		GeometryRange range(ElementId id) const;
+
+		// Frees the ranges that weren't retained this frame and moves up to compactBudget vertices. Ranges read
+		// before this call may be stale, batch after it.
+		void end_frame(GLint compactBudget);
+
+		// Copies dirty ranges into buffer, staging them in the buffer bound to GL_COPY_READ_BUFFER.
+		// buffer must be bound to GL_COPY_WRITE_BUFFER. Whatever doesn't fit in stagingCapacity bytes
+		// stays dirty for the next frame, see pending. Returns the number of bytes uploaded.
+		GLsizeiptr upload(GLsizeiptr stagingCapacity);
+
+		// True while some dirty vertices haven't been uploaded, ranges batched now may draw stale ones
+		bool pending() const;
+
+		i32 find_slot(u64 id) const;
+		void erase_slot(i32 index);
+		GeometryRange allocate_range(GLint count, GLint below);
+		void free_range(GeometryRange range);
+		void mark_dirty(GeometryRange range);
+	};
+
+	// Commands the clip plan clips in their geometry have their rectangle, and uv rect, cut to the clip rect.
+	// Shape commands are retained as one instance, text commands as one instance per glyph, line commands as one
+	// vertex slot per point.
+	void retain_draw_commands(
+			GeometryCache *cache, ElementTree const& tree, ClipPlan const& clips, DrawTables const& tables,
+			DrawCommand const *commands, i64 count);
+
+	// Like push_draw_commands but over the retained ranges, commands whose ranges are adjacent and share
+	// a program, texture and scissor clip are merged. Lines are scissored to their nearest clipping ancestor
+	// whether or not they cross it, their stroke isn't held to the element's bounds. batches must hold count
+	// entries, returns the number written.
+	i64 batch_draw_commands(
+			GeometryCache const& cache, ElementTree const& tree, ClipPlan const& clips,
+			DrawCommand const *commands, i64 count, DrawBatch *batches);
+
+}
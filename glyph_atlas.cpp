@@ -0,0 +1,609 @@
+#include "glyph_atlas.h"
+
+#include "profile.h"
+
+namespace shrub {
+
+	namespace {
+
+		f32 min_f32(f32 a, f32 b) {
+			return a < b ? a : b;
+		}
+
+		f32 max_f32(f32 a, f32 b) {
+			return a > b ? a : b;
+		}
+
+		// Malformed sequences decode to U+FFFD one byte at a time
+		u32 decode_utf8(String text, i64 *at) {
+			auto byte = static_cast<u8>(text.data[(*at)++]);
+			if (byte < 0x80)
+				return byte;
+
+			i32 continuation = byte >= 0xf0 ? 3 : byte >= 0xe0 ? 2 : byte >= 0xc0 ? 1 : 0;
+			if (!continuation || byte >= 0xf8 || *at + continuation > text.count)
+				return 0xfffd;
+
+			u32 codepoint = byte & (0x3fu >> continuation);
+			for (i32 i = 0; i < continuation; ++i) {
+				auto next = static_cast<u8>(text.data[*at + i]);
+				if ((next & 0xc0) != 0x80)
+					return 0xfffd;
+				codepoint = codepoint << 6 | (next & 0x3f);
+			}
+			*at += continuation;
+			return codepoint;
+		}
+
+		i32 count_codepoints(String text) {
+			i32 count = 0;
+			for (i64 at = 0; at < text.count; ++count)
+				decode_utf8(text, &at);
+			return count;
+		}
+
+		u32 age(u32 frame, u32 lastUsed) {
+			auto elapsed = frame - lastUsed;
+			return elapsed < GlyphAtlas::maxAge ? elapsed : GlyphAtlas::maxAge;
+		}
+
+	}
+
+	void GlyphAtlas::init(
+			Allocator *allocator, u32 textureKey_, i32 width_, i32 height_, i32 texelSize_, i32 capacity_,
+			GlyphRasterizer rasterize_) {
+		assert(texelSize_ == 1 || texelSize_ == 4);
+		assert(width_ * texelSize_ % 4 == 0);
+		textureKey = textureKey_;
+		width = width_;
+		height = height_;
+		texelSize = texelSize_;
+		rasterize = rasterize_;
+
+		for (auto& copy : pixels) {
+			copy = allocate<u8>(allocator, width * height * texelSize);
+			__builtin_memset(copy, 0, static_cast<usize>(width * height * texelSize));
+		}
+		current = 0;
+
+		// A node per column at most, plus the one pack inserts before merging
+		skyline = allocate<SkylineNode>(allocator, width + 1);
+		previousSkyline = allocate<SkylineNode>(allocator, width + 1);
+		reset_skyline();
+
+		capacity = 16;
+		while (capacity < capacity_)
+			capacity <<= 1;
+		tables[0] = allocate<GlyphEntry>(allocator, capacity);
+		tables[1] = allocate<GlyphEntry>(allocator, capacity);
+		for (i32 i = 0; i < capacity; ++i) {
+			tables[0][i] = {};
+			tables[1][i] = {};
+		}
+		count = 0;
+		repackOrder = allocate<i32>(allocator, capacity);
+
+		scratchCapacity = maxGlyphSize * maxGlyphSize * texelSize;
+		scratch = allocate<u8>(allocator, scratchCapacity);
+
+		// WebGL zero fills storage allocated without pixels, which matches the CPU copy
+		texture = gl_create_texture();
+		gl_bind_texture(GL_TEXTURE_2D, texture);
+		gl_tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		gl_tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		gl_tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		gl_tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		if (texelSize == 4)
+			gl_tex_image_2d(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr, 0);
+		else
+			gl_tex_image_2d(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr, 0);
+
+		generation = 0;
+		frame = 0;
+		dirtyMin = 0;
+		dirtyMax = 0;
+		pendingMin = 0;
+		pendingMax = 0;
+		waiting = false;
+		queuedSinceSync = false;
+	}
+
+	void GlyphAtlas::begin_frame() {
+		++frame;
+	}
+
+	GlyphEntry* GlyphAtlas::request(u64 key) {
+		assert(key != 0);
+		auto slot = find_slot(key);
+		if (tables[current][slot].key) {
+			tables[current][slot].lastUsed = frame;
+			return &tables[current][slot];
+		}
+
+		// Missing glyphs are kept without ink so they aren't asked for again every frame
+		auto metrics = GlyphMetrics{};
+		auto font = static_cast<u32>(key >> 48);
+		auto size = static_cast<u32>(key >> 32) & 0xffff;
+		auto codepoint = static_cast<u32>(key);
+		if (!rasterize(font, size, codepoint, &metrics, scratch, scratchCapacity) || metrics.width <= 0 || metrics.height <= 0)
+			metrics.width = metrics.height = 0;
+
+		i32 x = 0;
+		i32 y = 0;
+		auto inked = metrics.width > 0;
+		auto packWidth = metrics.width + 2 * padding;
+		auto packHeight = metrics.height + 2 * padding;
+		if (count >= capacity / 2 || (inked && !pack(packWidth, packHeight, &x, &y))) {
+			if (!repack() || count >= capacity / 2 || (inked && !pack(packWidth, packHeight, &x, &y)))
+				return nullptr;
+			slot = find_slot(key);
+		}
+
+		if (inked) {
+			x += padding;
+			y += padding;
+			auto target = pixels[current];
+			auto rowSize = metrics.width * texelSize;
+			for (i32 row = 0; row < metrics.height; ++row) {
+				__builtin_memcpy(
+					target + ((y + row) * width + x) * texelSize, scratch + row * rowSize, static_cast<usize>(rowSize));
+			}
+			mark_dirty(y, y + metrics.height);
+		}
+
+		auto& entry = tables[current][slot];
+		entry = { key, metrics, x, y, frame };
+		++count;
+		return &entry;
+	}
+
+	GlyphEntry* GlyphAtlas::find(u64 key) {
+		auto slot = find_slot(key);
+		return tables[current][slot].key ? &tables[current][slot] : nullptr;
+	}
+
+	void GlyphAtlas::touch(GlyphEntry *entry) {
+		entry->lastUsed = frame;
+	}
+
+	void GlyphAtlas::queue_upload(UploadQueue *queue) {
+		if (dirtyMax <= dirtyMin)
+			return;
+		// Whole rows keep the source contiguous, so no unpack row length is needed
+		if (!queue->queue_texture_rows(
+				upload_key(), texture, width, width * texelSize, texelSize == 4 ? GL_RGBA : GL_RED,
+				pixels[current], dirtyMin, dirtyMax))
+			return;
+		dirtyMin = 0;
+		dirtyMax = 0;
+		queuedSinceSync = true;
+	}
+
+	void GlyphAtlas::sync(UploadQueue const& queue) {
+		i64 begin = 0;
+		i64 end = 0;
+		queue.pending(upload_key(), &begin, &end);
+		auto changed = queuedSinceSync || static_cast<i32>(begin) != pendingMin || static_cast<i32>(end) != pendingMax;
+		pendingMin = static_cast<i32>(begin);
+		pendingMax = static_cast<i32>(end);
+		queuedSinceSync = false;
+		if (waiting && changed) {
+			waiting = false;
+			++generation;
+		}
+	}
+
+	bool GlyphAtlas::ready(GlyphEntry const& entry) {
+		auto top = entry.y;
+		auto bottom = entry.y + entry.metrics.height;
+		auto overlaps = [&](i32 min, i32 max) {
+			return max > min && top < max && bottom > min;
+		};
+		if (overlaps(dirtyMin, dirtyMax) || overlaps(pendingMin, pendingMax)) {
+			waiting = true;
+			return false;
+		}
+		return true;
+	}
+
+	Vec4 GlyphAtlas::uv_rect(GlyphEntry const& entry) const {
+		auto w = static_cast<f32>(width);
+		auto h = static_cast<f32>(height);
+		return {
+			static_cast<f32>(entry.x) / w,
+			static_cast<f32>(entry.y) / h,
+			static_cast<f32>(entry.x + entry.metrics.width) / w,
+			static_cast<f32>(entry.y + entry.metrics.height) / h,
+		};
+	}
+
+	u64 GlyphAtlas::upload_key() const {
+		return hash_combine(hash_int(textureKey), hash_int(static_cast<u64>(texture)));
+	}
+
+	i32 GlyphAtlas::find_slot(u64 key) const {
+		auto mask = static_cast<u64>(capacity - 1);
+		auto slot = hash_int(key) & mask;
+		auto table = tables[current];
+		while (table[slot].key && table[slot].key != key)
+			slot = (slot + 1) & mask;
+		return static_cast<i32>(slot);
+	}
+
+	bool GlyphAtlas::pack(i32 packWidth, i32 packHeight, i32 *x, i32 *y) {
+		// Bottom left: the lowest place the rect fits, ties go to the narrowest node so wide gaps stay open
+		i32 best = -1;
+		i32 bestY = 0;
+		i32 bestWidth = 0;
+		for (i32 i = 0; i < skylineCount; ++i) {
+			if (skyline[i].x + packWidth > width)
+				break;
+
+			i32 top = 0;
+			for (i32 j = i, remaining = packWidth; remaining > 0; ++j) {
+				top = skyline[j].y > top ? skyline[j].y : top;
+				remaining -= skyline[j].width;
+			}
+			if (top + packHeight > height)
+				continue;
+			if (best == -1 || top < bestY || (top == bestY && skyline[i].width < bestWidth)) {
+				best = i;
+				bestY = top;
+				bestWidth = skyline[i].width;
+			}
+		}
+		if (best == -1)
+			return false;
+
+		*x = skyline[best].x;
+		*y = bestY;
+
+		for (i32 i = skylineCount; i > best; --i)
+			skyline[i] = skyline[i - 1];
+		skyline[best] = { *x, bestY + packHeight, packWidth };
+		++skylineCount;
+
+		// Trim the nodes the new one covers
+		for (i32 i = best + 1; i < skylineCount;) {
+			auto end = skyline[i - 1].x + skyline[i - 1].width;
+			if (skyline[i].x >= end)
+				break;
+			auto overlap = end - skyline[i].x;
+			if (overlap < skyline[i].width) {
+				skyline[i].x += overlap;
+				skyline[i].width -= overlap;
+				break;
+			}
+			for (i32 j = i; j + 1 < skylineCount; ++j)
+				skyline[j] = skyline[j + 1];
+			--skylineCount;
+		}
+
+		for (i32 i = 0; i + 1 < skylineCount;) {
+			if (skyline[i].y == skyline[i + 1].y) {
+				skyline[i].width += skyline[i + 1].width;
+				for (i32 j = i + 1; j + 1 < skylineCount; ++j)
+					skyline[j] = skyline[j + 1];
+				--skylineCount;
+			} else {
+				++i;
+			}
+		}
+
+		packedArea += static_cast<i64>(packWidth) * packHeight;
+		return true;
+	}
+
+	void GlyphAtlas::reset_skyline() {
+		skyline[0] = { 0, 0, width };
+		skylineCount = 1;
+		packedArea = 0;
+	}
+
+	bool GlyphAtlas::repack() {
+		PROFILE_ZONE("glyph_repack");
+
+		auto source = tables[current];
+		auto sourcePixels = pixels[current];
+		auto previousCount = count;
+		auto previousSkylineCount = skylineCount;
+		auto previousArea = packedArea;
+		for (i32 i = 0; i < skylineCount; ++i)
+			previousSkyline[i] = skyline[i];
+
+		current ^= 1;
+		auto target = tables[current];
+		auto targetPixels = pixels[current];
+		for (i32 i = 0; i < capacity; ++i)
+			target[i] = {};
+		__builtin_memset(targetPixels, 0, static_cast<usize>(width * height * texelSize));
+		count = 0;
+		reset_skyline();
+
+		auto move = [&](GlyphEntry const& entry) {
+			auto moved = entry;
+			auto const& metrics = entry.metrics;
+			if (metrics.width > 0) {
+				if (!pack(metrics.width + 2 * padding, metrics.height + 2 * padding, &moved.x, &moved.y))
+					return false;
+				moved.x += padding;
+				moved.y += padding;
+				for (i32 row = 0; row < metrics.height; ++row) {
+					__builtin_memcpy(
+						targetPixels + ((moved.y + row) * width + moved.x) * texelSize,
+						sourcePixels + ((entry.y + row) * width + entry.x) * texelSize,
+						static_cast<usize>(metrics.width * texelSize));
+				}
+			}
+			target[find_slot(entry.key)] = moved;
+			++count;
+			return true;
+		};
+
+		// Glyphs used this frame go first and tallest first, which is where the skyline wastes the least.
+		// Insertion sort, repacks are rare.
+		i32 recentCount = 0;
+		for (i32 i = 0; i < capacity; ++i) {
+			if (!source[i].key || age(frame, source[i].lastUsed) != 0)
+				continue;
+			auto j = recentCount++;
+			for (; j > 0 && source[repackOrder[j - 1]].metrics.height < source[i].metrics.height; --j)
+				repackOrder[j] = repackOrder[j - 1];
+			repackOrder[j] = i;
+		}
+		for (i32 i = 0; i < recentCount; ++i) {
+			if (move(source[repackOrder[i]]))
+				continue;
+			// The source table and pixels are untouched, switch back to them
+			current ^= 1;
+			count = previousCount;
+			skylineCount = previousSkylineCount;
+			packedArea = previousArea;
+			for (i32 n = 0; n < skylineCount; ++n)
+				skyline[n] = previousSkyline[n];
+			return false;
+		}
+
+		// Then most recently used first, so whatever doesn't make it into half the atlas is the least recently
+		// used. Ages are small, a pass per age is cheaper than sorting.
+		auto areaBudget = static_cast<i64>(width) * height / 2;
+		for (u32 pass = 1; pass <= maxAge; ++pass) {
+			for (i32 i = 0; i < capacity; ++i) {
+				auto const& entry = source[i];
+				if (!entry.key || age(frame, entry.lastUsed) != pass)
+					continue;
+				if (packedArea >= areaBudget || count >= capacity / 4)
+					continue;
+				move(entry);
+			}
+		}
+
+		++generation;
+		mark_dirty(0, height);
+		return true;
+	}
+
+	void GlyphAtlas::mark_dirty(i32 minRow, i32 maxRow) {
+		if (dirtyMax <= dirtyMin) {
+			dirtyMin = minRow;
+			dirtyMax = maxRow;
+			return;
+		}
+		dirtyMin = minRow < dirtyMin ? minRow : dirtyMin;
+		dirtyMax = maxRow > dirtyMax ? maxRow : dirtyMax;
+	}
+
+	void TextRunCache::init(Allocator *allocator, i32 runCapacity_, i32 glyphCapacity_) {
+		for (auto& source : fonts)
+			source = {};
+
+		runCapacity = runCapacity_;
+		runs = allocate<TextRun>(allocator, runCapacity);
+		keys = allocate<TextRunKey>(allocator, runCapacity);
+		lastUsed = allocate<u32>(allocator, runCapacity);
+		firstGlyphs = allocate<i32>(allocator, runCapacity);
+		codepointCounts = allocate<i32>(allocator, runCapacity);
+		freeRuns = allocate<i32>(allocator, runCapacity);
+		runCount = 0;
+		freeRunCount = 0;
+
+		tableCapacity = 16;
+		while (tableCapacity < 2 * runCapacity)
+			tableCapacity <<= 1;
+		table = allocate<i32>(allocator, tableCapacity);
+		for (i32 i = 0; i < tableCapacity; ++i)
+			table[i] = -1;
+
+		glyphCapacity = glyphCapacity_;
+		for (i32 i = 0; i < 2; ++i) {
+			glyphKeys[i] = allocate<u64>(allocator, glyphCapacity);
+			glyphEntries[i] = allocate<GlyphEntry*>(allocator, glyphCapacity);
+			quads[i] = allocate<GlyphQuad>(allocator, glyphCapacity);
+		}
+		current = 0;
+		glyphTop = 0;
+		frame = 0;
+	}
+
+	void TextRunCache::set_font(u32 font, GlyphAtlas *atlas, u32 glyphSize) {
+		assert(font < maxFonts);
+		fonts[font] = { atlas, glyphSize };
+	}
+
+	void TextRunCache::begin_frame() {
+		++frame;
+	}
+
+	i32 TextRunCache::prepare(u32 font, u32 size, String text) {
+		assert(size > 0);
+		assert(font < maxFonts && fonts[font].atlas);
+		auto atlas = fonts[font].atlas;
+		auto hash = hash_combine(hash_string(text), hash_int(glyph_key(font, size, 0)));
+
+		auto index = find_run(hash, font, size);
+		if (index != -1) {
+			lastUsed[index] = frame;
+			if (runs[index].generation != atlas->generation) {
+				resolve_run(index, true);
+				return index;
+			}
+			// Still where they were, only the LRU stamps need moving
+			auto entries = glyphEntries[current] + firstGlyphs[index];
+			for (i32 i = 0; i < codepointCounts[index]; ++i) {
+				if (entries[i])
+					atlas->touch(entries[i]);
+			}
+			return index;
+		}
+
+		auto codepointCount = count_codepoints(text);
+		if (codepointCount > glyphCapacity)
+			return -1;
+		if ((runCount == runCapacity && !freeRunCount) || glyphTop + codepointCount > glyphCapacity) {
+			compact();
+			if ((runCount == runCapacity && !freeRunCount) || glyphTop + codepointCount > glyphCapacity)
+				return -1;
+		}
+
+		index = freeRunCount ? freeRuns[--freeRunCount] : runCount++;
+		keys[index] = { hash, font, size };
+		lastUsed[index] = frame;
+		firstGlyphs[index] = glyphTop;
+		codepointCounts[index] = codepointCount;
+
+		auto runKeys = glyphKeys[current] + glyphTop;
+		auto glyphSize = fonts[font].glyphSize ? fonts[font].glyphSize : size;
+		i64 at = 0;
+		for (i32 i = 0; i < codepointCount; ++i)
+			runKeys[i] = glyph_key(font, glyphSize, decode_utf8(text, &at));
+		glyphTop += codepointCount;
+
+		insert_run(index);
+		resolve_run(index, true);
+		return index;
+	}
+
+	void TextRunCache::resolve() {
+		PROFILE_ZONE("text_resolve");
+		for (i32 i = 0; i < runCount; ++i) {
+			if (keys[i].size && lastUsed[i] == frame && runs[i].generation != fonts[keys[i].font].atlas->generation)
+				resolve_run(i, false);
+		}
+	}
+
+	i32 TextRunCache::find_run(u64 hash, u32 font, u32 size) const {
+		auto mask = static_cast<u64>(tableCapacity - 1);
+		for (auto slot = hash & mask; table[slot] != -1; slot = (slot + 1) & mask) {
+			auto const& key = keys[table[slot]];
+			if (key.hash == hash && key.font == font && key.size == size)
+				return table[slot];
+		}
+		return -1;
+	}
+
+	void TextRunCache::insert_run(i32 index) {
+		auto mask = static_cast<u64>(tableCapacity - 1);
+		auto slot = keys[index].hash & mask;
+		while (table[slot] != -1)
+			slot = (slot + 1) & mask;
+		table[slot] = index;
+	}
+
+	void TextRunCache::resolve_run(i32 index, bool rasterize) {
+		auto first = firstGlyphs[index];
+		auto codepointCount = codepointCounts[index];
+		auto runKeys = glyphKeys[current] + first;
+		auto entries = glyphEntries[current] + first;
+		auto runQuads = quads[current] + first;
+		auto const& source = fonts[keys[index].font];
+		auto atlas = source.atlas;
+		// Metrics are in pixels of the size the glyphs were rasterized at
+		auto scale = source.glyphSize
+			? static_cast<f32>(keys[index].size) / static_cast<f32>(source.glyphSize)
+			: 1.f;
+
+		// Rasterizing a glyph can repack the atlas and move the ones looked up before it. They were used this
+		// frame so they survive, a second pass finds them where they went.
+		auto& run = runs[index];
+		for (i32 attempt = 0; attempt < 2; ++attempt) {
+			auto generation = atlas->generation;
+
+			f32 pen = 0.f;
+			run = { keys[index].hash, runQuads, 0, generation, {}, 0.f, 0.f };
+			for (i32 i = 0; i < codepointCount; ++i) {
+				auto entry = rasterize ? atlas->request(runKeys[i]) : atlas->find(runKeys[i]);
+				entries[i] = entry;
+				if (!entry)
+					continue;
+
+				auto const& metrics = entry->metrics;
+				run.ascent = max_f32(run.ascent, metrics.ascent * scale);
+				run.descent = max_f32(run.descent, metrics.descent * scale);
+				// Glyphs still on their way to the texture leave a gap until they arrive
+				if (metrics.width > 0 && atlas->ready(*entry)) {
+					auto extent = Vec2{ static_cast<f32>(metrics.width) * scale, static_cast<f32>(metrics.height) * scale };
+					auto pos = Vec2{ pen + metrics.bearingX * scale, metrics.bearingY * scale - extent.y };
+					// The quad's min corner is the bitmap's bottom row
+					auto uv = atlas->uv_rect(*entry);
+					runQuads[run.glyphCount++] = { pos, extent, { uv.x, uv.w, uv.z, uv.y } };
+					run.bounds.min.x = min_f32(run.bounds.min.x, pos.x);
+					run.bounds.min.y = min_f32(run.bounds.min.y, pos.y);
+					run.bounds.max.x = max_f32(run.bounds.max.x, pos.x + extent.x);
+					run.bounds.max.y = max_f32(run.bounds.max.y, pos.y + extent.y);
+				}
+				pen += metrics.advance * scale;
+			}
+
+			run.bounds.min.y = min_f32(run.bounds.min.y, -run.descent);
+			run.bounds.max.x = max_f32(run.bounds.max.x, pen);
+			run.bounds.max.y = max_f32(run.bounds.max.y, run.ascent);
+			if (atlas->generation == generation)
+				break;
+		}
+	}
+
+	void TextRunCache::compact() {
+		PROFILE_ZONE("text_compact");
+		auto source = current;
+		current ^= 1;
+		glyphTop = 0;
+
+		// Runs used this frame stay where draw commands can find them, older ones are kept most recently used
+		// first while they fit in half the storage
+		i32 kept = 0;
+		for (u32 pass = 0; pass <= GlyphAtlas::maxAge; ++pass) {
+			for (i32 i = 0; i < runCount; ++i) {
+				if (!keys[i].size || age(frame, lastUsed[i]) != pass)
+					continue;
+
+				auto codepointCount = codepointCounts[i];
+				if (pass > 0 && (glyphTop + codepointCount > glyphCapacity / 2 || kept >= runCapacity / 2)) {
+					keys[i] = {};
+					continue;
+				}
+
+				auto first = firstGlyphs[i];
+				for (i32 g = 0; g < codepointCount; ++g) {
+					glyphKeys[current][glyphTop + g] = glyphKeys[source][first + g];
+					glyphEntries[current][glyphTop + g] = glyphEntries[source][first + g];
+					quads[current][glyphTop + g] = quads[source][first + g];
+				}
+				firstGlyphs[i] = glyphTop;
+				runs[i].glyphs = quads[current] + glyphTop;
+				glyphTop += codepointCount;
+				++kept;
+			}
+		}
+
+		for (i32 i = 0; i < tableCapacity; ++i)
+			table[i] = -1;
+		freeRunCount = 0;
+		for (i32 i = 0; i < runCount; ++i) {
+			if (keys[i].size)
+				insert_run(i);
+			else
+				freeRuns[freeRunCount++] = i;
+		}
+	}
+
+}
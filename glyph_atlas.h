@@ -0,0 +1,219 @@
+#pragma once
+
+#include <oak_util/types.h>
+
+#include "shrub.h"
+#include "upload_queue.h"
+
+namespace shrub {
+
+	using namespace oak;
+
+	// Filled in by the rasterizer, in pixels with y up
+	struct GlyphMetrics {
+		// Bitmap size, 0 for glyphs without ink such as spaces
+		i32 width;
+		i32 height;
+		// From the pen position on the baseline to the bitmap's top left corner
+		f32 bearingX;
+		f32 bearingY;
+		f32 advance;
+		// Of the font rather than the glyph, the same for every glyph of a font and size
+		f32 ascent;
+		f32 descent;
+	};
+
+	// Writes width * height coverage bytes, top row first, to pixels and fills in metrics. Returns false when
+	// the font has no such glyph or it doesn't fit in capacity bytes.
+	using GlyphRasterizer = bool (*)(u32 font, u32 size, u32 codepoint, GlyphMetrics *metrics, u8 *pixels, i32 capacity);
+
+	struct GlyphEntry {
+		// 0 for an empty slot, see glyph_key
+		u64 key;
+		GlyphMetrics metrics;
+		// Top left of the bitmap in the atlas
+		i32 x;
+		i32 y;
+		u32 lastUsed;
+	};
+
+	struct SkylineNode {
+		i32 x;
+		i32 y;
+		i32 width;
+	};
+
+	constexpr u64 glyph_key(u32 font, u32 size, u32 codepoint) {
+		return static_cast<u64>(font & 0xffff) << 48 | static_cast<u64>(size & 0xffff) << 32 | codepoint;
+	}
+
+	// Every glyph in use, skyline packed into one texture: R8 coverage, or RGBA8 distance fields that serve
+	// every size from one entry, see msdf.h. The atlas keeps a CPU copy of the texture and queues the rows
+	// that changed once a frame; glyphs are left out of their runs until their rows have arrived. When a
+	// glyph doesn't fit, the atlas is repacked from its most recently used glyphs until half of it is taken
+	// and the rest are evicted.
+	// Glyphs used this frame always survive, but they move, so generation changes. When they don't all fit,
+	// the atlas is left as it was and the request that needed the room fails instead.
+	struct GlyphAtlas {
+		// Empty texels around every glyph so linear filtering doesn't pull in its neighbours
+		static constexpr i32 padding = 1;
+		// Bitmaps up to this many pixels square can be rasterized
+		static constexpr i32 maxGlyphSize = 128;
+		// Glyphs unused for longer are evicted together at the end of the LRU order
+		static constexpr u32 maxAge = 15;
+
+		// Sort key texture index of the atlas, well above the layer textures
+		u32 textureKey = 0;
+		int texture = 0;
+		i32 width = 0;
+		i32 height = 0;
+		// Bytes per texel, 1 for coverage or 4 for distance fields
+		i32 texelSize = 1;
+
+		// CPU copies of the texture, repacking copies glyphs from one to the other
+		u8 *pixels[2] = {};
+		i32 current = 0;
+
+		// Left to right, each node is the height taken below the span starting at x
+		SkylineNode *skyline = nullptr;
+		i32 skylineCount = 0;
+		i64 packedArea = 0;
+		// Skyline before a repack, restored when it fails
+		SkylineNode *previousSkyline = nullptr;
+		// Slots of the glyphs used this frame, in the order repack packs them
+		i32 *repackOrder = nullptr;
+
+		// Open addressed on key with linear probing, repacking moves the survivors to the other table
+		GlyphEntry *tables[2] = {};
+		i32 capacity = 0;
+		i32 count = 0;
+
+		u8 *scratch = nullptr;
+		i32 scratchCapacity = 0;
+		GlyphRasterizer rasterize = nullptr;
+
+		u32 generation = 0;
+		u32 frame = 0;
+
+		// Rows not queued yet, empty when dirtyMax <= dirtyMin
+		i32 dirtyMin = 0;
+		i32 dirtyMax = 0;
+		// Rows queued but not uploaded as of the last sync, empty the same way
+		i32 pendingMin = 0;
+		i32 pendingMax = 0;
+		// A glyph was held back, runs need resolving again once its rows arrive
+		bool waiting = false;
+		bool queuedSinceSync = false;
+
+		// Rows must be a multiple of 4 bytes so they stay aligned for the upload. capacity is rounded up to a
+		// power of two and should be well above the number of glyphs in use. The rasterizer writes texelSize
+		// bytes per pixel.
+		void init(
+				Allocator *allocator, u32 textureKey_, i32 width_, i32 height_, i32 texelSize_, i32 capacity_,
+				GlyphRasterizer rasterize_);
+
+		void begin_frame();
+
+		// Glyph for key, rasterized and packed on first use. Marks it used this frame, null when the font has
+		// no such glyph or the atlas can't fit it.
+		GlyphEntry* request(u64 key);
+
+		// Resident glyph for key without rasterizing it or marking it used, null if there is none
+		GlyphEntry* find(u64 key);
+
+		// Marks a glyph returned this generation as used this frame
+		void touch(GlyphEntry *entry);
+
+		// Queues the rows changed since the last call as visible content. They stay dirty for the next call
+		// when the queue is full.
+		void queue_upload(UploadQueue *queue);
+
+		// Catches up with the queue after a flush. Glyphs held back by ready are drawn again once their rows
+		// have arrived, by moving to a new generation.
+		void sync(UploadQueue const& queue);
+
+		// False, and the glyph should be left out, while its rows haven't reached the texture
+		bool ready(GlyphEntry const& entry);
+
+		// u0, v0, u1, v1 of a glyph with v0 at its top row
+		Vec4 uv_rect(GlyphEntry const& entry) const;
+
+		u64 upload_key() const;
+		i32 find_slot(u64 key) const;
+		bool pack(i32 packWidth, i32 packHeight, i32 *x, i32 *y);
+		void reset_skyline();
+		// False when the glyphs used this frame don't fit, nothing is changed then
+		bool repack();
+		void mark_dirty(i32 minRow, i32 maxRow);
+	};
+
+	struct TextRunKey {
+		u64 hash;
+		u32 font;
+		u32 size;
+	};
+
+	struct FontSource {
+		GlyphAtlas *atlas;
+		// 0 rasterizes glyphs at every size they're drawn at. Distance field fonts are generated once at
+		// this size and scaled.
+		u32 glyphSize;
+	};
+
+	// Laid out text runs by font, size and string hash. Runs keep their index for as long as they're used
+	// every frame, so draw commands can point at them; runs that go unused are evicted least recently used
+	// first when the run slots or the glyph storage fill up. A run that's drawn again with its glyphs
+	// where they were costs a hash lookup and one store per glyph.
+	struct TextRunCache {
+		static constexpr u32 maxFonts = 8;
+
+		// Atlas of each font id, set before the font's first run
+		FontSource fonts[maxFonts] = {};
+
+		TextRun *runs = nullptr;
+		TextRunKey *keys = nullptr;
+		u32 *lastUsed = nullptr;
+		// Codepoints of each run in the glyph storage, every one has a quad slot even without ink
+		i32 *firstGlyphs = nullptr;
+		i32 *codepointCounts = nullptr;
+		i32 runCapacity = 0;
+		// Slots below runCount are either live or on the free list
+		i32 runCount = 0;
+		i32 *freeRuns = nullptr;
+		i32 freeRunCount = 0;
+
+		// Run indices open addressed on hash, -1 for an empty slot
+		i32 *table = nullptr;
+		i32 tableCapacity = 0;
+
+		// Glyph storage, compacting copies the live runs to the other half. Entries are only valid while
+		// their run's generation matches its font's atlas.
+		u64 *glyphKeys[2] = {};
+		GlyphEntry **glyphEntries[2] = {};
+		GlyphQuad *quads[2] = {};
+		i32 current = 0;
+		i32 glyphCapacity = 0;
+		i32 glyphTop = 0;
+
+		u32 frame = 0;
+
+		void init(Allocator *allocator, i32 runCapacity_, i32 glyphCapacity_);
+		void set_font(u32 font, GlyphAtlas *atlas, u32 glyphSize);
+
+		void begin_frame();
+
+		// Lays out text on first use and makes sure its glyphs are in the atlas. Returns the index of its
+		// run, -1 when the cache is full of runs used this frame.
+		i32 prepare(u32 font, u32 size, String text);
+
+		// Updates the glyph quads of this frame's runs after the atlas moved glyphs under them. Call once
+		// every run of the frame is prepared, before the quads are read.
+		void resolve();
+
+		i32 find_run(u64 hash, u32 font, u32 size) const;
+		void insert_run(i32 index);
+		void resolve_run(i32 index, bool rasterize);
+		void compact();
+	};
+
+}
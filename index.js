@@ -1,35 +1,141 @@
+import { WasmWrapper } from './wasm.js';
+
+// Must match the order of GLFunction in web_gl.h
+const glStatsFunctions = [
+  'createVertexArray', 'deleteVertexArray', 'bindVertexArray', 'enableVertexAttribArray',
+  'disableVertexAttribArray', 'vertexAttribPointer', 'vertexAttribDivisor',
+  'createBuffer', 'deleteBuffer', 'bindBuffer', 'bindBufferRange', 'bufferData', 'bufferSubData',
+  'copyBufferSubData',
+  'attachShader', 'compileShader', 'createProgram', 'createShader', 'deleteProgram', 'deleteShader',
+  'detachShader', 'linkProgram', 'shaderSource', 'useProgram', 'programStatus',
+  'createTexture', 'deleteTexture', 'bindTexture', 'texImage2D', 'texSubImage2D', 'texParameteri',
+  'createFramebuffer', 'deleteFramebuffer', 'bindFramebuffer', 'framebufferTexture2D',
+  'createRenderbuffer', 'deleteRenderbuffer', 'bindRenderbuffer', 'renderbufferStorage',
+  'framebufferRenderbuffer',
+  'clear', 'clearColor', 'clearDepth', 'clearStencil', 'drawArrays', 'drawArraysInstanced',
+  'enable', 'disable', 'scissor', 'viewport', 'blendFunc', 'depthFunc', 'depthMask',
+  'fenceSync', 'deleteSync', 'clientWaitSync',
+  'getParameter',
+];
+
+// Must match GL_HANDLE_INDEX_BITS in web_gl.h. Handles pack a slot index in the low bits with the
+// slot generation above it, 0 is the null handle. Freed slots are reused LIFO and bump their
+// generation, so a stale handle resolves to null instead of to whatever reused the slot.
+const glHandleIndexBits = 20;
+const glHandleIndexMask = (1 << glHandleIndexBits) - 1;
+const glHandleGenerationMask = 0x7ff;
+// Checks the generation of every handle passed to WebGL, so a stale handle binds null instead of the
+// object that reused its slot. Off drops a load and a compare from each bind on the hot paths.
+const glHandleChecks = true;
+
+class GLHandleTable {
+
+  constructor(capacity) {
+    this.objects = new Array(capacity).fill(null);
+    this.generations = new Uint16Array(capacity);
+    this.freeList = new Uint32Array(capacity);
+    this.freeCount = 0;
+    this.nextIndex = 1;
+  }
 
-
-class WasmWrapper {
-
-  constructor(wasm) {
-    this.wasm = wasm;
-    this.textDecoder = new TextDecoder();
-    for (const elem of Object.entries(this.wasm.instance.exports)) {
-      if (typeof elem[1] === 'function') {
-        this[elem[0]] = elem[1];
+  add = (obj) => {
+    let index;
+    if (this.freeCount > 0) {
+      index = this.freeList[--this.freeCount];
+    } else {
+      if (this.nextIndex == this.generations.length) {
+        this.grow();
       }
+      index = this.nextIndex++;
     }
+    this.objects[index] = obj;
+    return (this.generations[index] << glHandleIndexBits) | index;
   }
 
-  cStrToString = (cstr) => {
-    const length = this.wasm.instance.exports.c_strlen(cstr);
-    const array = new Uint8Array(this.wasm.instance.exports.memory.buffer, cstr, length);
-    return this.textDecoder.decode(array);
+  get = (handle) => {
+    const index = handle & glHandleIndexMask;
+    if (this.generations[index] !== handle >>> glHandleIndexBits) {
+      return null;
+    }
+    return this.objects[index];
   }
 
-  memToString = (str, length) => {
-    const array = new Uint8Array(this.wasm.instance.exports.memory.buffer, str, length);
-    return this.textDecoder.decode(array);
+  remove = (handle) => {
+    const obj = this.get(handle);
+    if (obj === null) {
+      return null;
+    }
+    const index = handle & glHandleIndexMask;
+    this.objects[index] = null;
+    this.generations[index] = (this.generations[index] + 1) & glHandleGenerationMask;
+    this.freeList[this.freeCount++] = index;
+    return obj;
+  }
+
+  grow = () => {
+    const capacity = this.generations.length * 2;
+    if (capacity > glHandleIndexMask + 1) {
+      throw new Error("GL handle table is full");
+    }
+    const generations = new Uint16Array(capacity);
+    generations.set(this.generations);
+    this.generations = generations;
+    const freeList = new Uint32Array(capacity);
+    freeList.set(this.freeList);
+    this.freeList = freeList;
+    // Pushed rather than resized, setting length on an Array makes it holey
+    while (this.objects.length < capacity) {
+      this.objects.push(null);
+    }
   }
 
-  memToByteArray = (ptr, length) => {
-    return new Uint8Array(this.wasm.instance.exports.memory.buffer, ptr, length);
+};
+
+// Font ids passed to rasterizeGlyph
+const glyphFonts = ['sans-serif', 'monospace', 'serif'];
+
+// Rasterizes glyphs for the atlas with the canvas 2D text renderer
+class GlyphCanvas {
+
+  constructor(size) {
+    this.canvas = new OffscreenCanvas(size, size);
+    this.context = this.canvas.getContext('2d', { willReadFrequently: true });
+    this.context.fillStyle = 'white';
   }
 
-  growMemory = (pages) => {
-    this.wasm.instance.exports.memory.grow(pages);
-    console.log("grow memory, buffer length: ", this.wasm.instance.exports.memory.buffer.byteLength);
+  // Writes GlyphMetrics in glyph_atlas.h to metricsPtr and the coverage to pixelsPtr
+  rasterize = (wasm, font, size, codepoint, metricsPtr, pixelsPtr, capacity) => {
+    const ctx = this.context;
+    const text = String.fromCodePoint(codepoint);
+    ctx.font = `${size}px ${glyphFonts[font] ?? glyphFonts[0]}`;
+    const metrics = ctx.measureText(text);
+    const left = Math.ceil(metrics.actualBoundingBoxLeft);
+    const ascent = Math.ceil(metrics.actualBoundingBoxAscent);
+    const width = Math.max(Math.ceil(metrics.actualBoundingBoxRight) + left, 0);
+    const height = Math.max(ascent + Math.ceil(metrics.actualBoundingBoxDescent), 0);
+    if (width > this.canvas.width || height > this.canvas.height || width * height > capacity) {
+      return 0;
+    }
+
+    const view = wasm.dataView;
+    view.setInt32(metricsPtr, width, true);
+    view.setInt32(metricsPtr + 4, height, true);
+    view.setFloat32(metricsPtr + 8, -left, true);
+    view.setFloat32(metricsPtr + 12, ascent, true);
+    view.setFloat32(metricsPtr + 16, metrics.width, true);
+    view.setFloat32(metricsPtr + 20, metrics.fontBoundingBoxAscent, true);
+    view.setFloat32(metricsPtr + 24, metrics.fontBoundingBoxDescent, true);
+
+    if (width > 0 && height > 0) {
+      ctx.clearRect(0, 0, width, height);
+      ctx.fillText(text, left, ascent);
+      const rgba = ctx.getImageData(0, 0, width, height).data;
+      const pixels = wasm.u8;
+      for (let i = 0; i < width * height; ++i) {
+        pixels[pixelsPtr + i] = rgba[i * 4 + 3];
+      }
+    }
+    return 1;
   }
 
 };
@@ -39,11 +145,12 @@ class Application {
   constructor(canvas) {
     this.canvas = canvas;
     this.wasm = undefined;
-    this.glIdMap = new Array();
-    this.glIdFreelist = new Array();
-    this.glIdMap.push(null);
+    this.glHandles = new GLHandleTable(1024);
+    // Must cover GlyphAtlas::maxGlyphSize
+    this.glyphCanvas = new GlyphCanvas(128);
 
-    this.gl = canvas.getContext('webgl2');
+    // Frames only repaint the regions that changed, so the previous contents have to survive compositing
+    this.gl = canvas.getContext('webgl2', { preserveDrawingBuffer: true, depth: true });
   }
 
   init = async () => {
@@ -64,6 +171,15 @@ class Application {
   }
 
   initWasm = async () => {
+    const gl = this.gl;
+    // Stable across GLHandleTable.grow, so the unchecked lookup can close over it
+    const objects = this.glHandles.objects;
+    const lookup = glHandleChecks ? this.glHandles.get : (id) => objects[id & glHandleIndexMask];
+    // Imports without object handles call straight into WebGL without an arrow function in between
+    const direct = (name) => gl[name].bind(gl);
+    // Without it the first status query blocks until the program is linked
+    const parallelCompile = gl.getExtension('KHR_parallel_shader_compile');
+
     const importObject = {
       env: {
         growMemory: (pages) => {
@@ -82,6 +198,8 @@ class Application {
         performanceNow: () => {
           return performance.now();
         },
+        rasterizeGlyph: (font, size, codepoint, metricsPtr, pixelsPtr, capacity) =>
+          this.glyphCanvas.rasterize(this.wasm, font, size, codepoint, metricsPtr, pixelsPtr, capacity),
         sin: (a) => {
           return Math.sin(a);
         },
@@ -91,138 +209,145 @@ class Application {
       },
       gl: {
         createVertexArray: () => {
-          const buf = this.gl.createVertexArray();
-          return this.webglIdNew(buf);
+          const buf = gl.createVertexArray();
+          return this.glHandles.add(buf);
         },
         deleteVertexArray: (id) => {
-          const vao = this.glIdMap[id];
-          this.webglIdRemove(id);
-          this.gl.deleteVertexArray(vao);
-        },
-        bindVertexArray: (id) => {
-          const vao = this.glIdMap[id];
-          this.gl.bindVertexArray(vao);
-        },
-        enableVertexAttribArray: (idx) => {
-          this.gl.enableVertexAttribArray(idx);
-        },
-        disableVertexAttribArray: (idx) => {
-          this.gl.disableVertexAttribArray(idx);
-        },
-        vertexAttribPointer: (index, size, type, normalized, stride, offset) => {
-          this.gl.vertexAttribPointer(index, size, type, normalized, stride, offset);
+          const vao = this.glHandles.remove(id);
+          gl.deleteVertexArray(vao);
         },
+        bindVertexArray: (id) => gl.bindVertexArray(lookup(id)),
+        enableVertexAttribArray: direct('enableVertexAttribArray'),
+        disableVertexAttribArray: direct('disableVertexAttribArray'),
+        vertexAttribPointer: direct('vertexAttribPointer'),
+        vertexAttribDivisor: direct('vertexAttribDivisor'),
 
         createBuffer: () => {
-          const buf = this.gl.createBuffer();
-          return this.webglIdNew(buf);
+          const buf = gl.createBuffer();
+          return this.glHandles.add(buf);
         },
         deleteBuffer: (id) => {
-          const buf = this.glIdMap[id];
-          this.webglIdRemove(id);
-          this.gl.deleteBuffer(buf);
-        },
-        bindBuffer: (target, id) => {
-          const buf = this.glIdMap[id];
-          this.gl.bindBuffer(target, buf);
-        },
-        bindBufferRange: (target, index, id, offset, size) => {
-          const buf = this.glIdMap[id];
-          this.gl.bindBufferRange(target, index, buf, offset, size);
-        },
-        bufferData: (target, size, usage) => {
-          this.gl.bufferData(target, size, usage);
-        },
-        bufferSubData: (target, offset, ptr, length) => {
-          this.gl.bufferSubData(target, offset, this.wasm.memToByteArray(ptr, length), 0);
-        },
-        copyBufferSubData: (readTarget, writeTarget, readOffset, writeOffset, size) => {
-          this.gl.copyBufferSubData(readTarget, writeTarget, readOffset, writeOffset, size);
-        },
-
-        attachShader: (programId, shaderId) => {
-          const program = this.glIdMap[programId];
-          const shader = this.glIdMap[shaderId];
-          this.gl.attachShader(program, shader);
-        },
-        compileShader: (shaderId) => {
-          const shader = this.glIdMap[shaderId];
-          this.gl.compileShader(shader);
-          if (!this.gl.getShaderParameter(shader, this.gl.COMPILE_STATUS)) {
-            console.error("Shader compilation error:", this.gl.getShaderInfoLog(shader));
-          }
-        },
+          const buf = this.glHandles.remove(id);
+          gl.deleteBuffer(buf);
+        },
+        bindBuffer: (target, id) => gl.bindBuffer(target, lookup(id)),
+        bindBufferRange: (target, index, id, offset, size) =>
+          gl.bindBufferRange(target, index, lookup(id), offset, size),
+        bufferData: direct('bufferData'),
+        bufferSubData: (target, offset, ptr, length) => gl.bufferSubData(target, offset, this.wasm.u8, ptr, length),
+        copyBufferSubData: direct('copyBufferSubData'),
+
+        attachShader: (programId, shaderId) =>
+          gl.attachShader(lookup(programId), lookup(shaderId)),
+        compileShader: (shaderId) => gl.compileShader(lookup(shaderId)),
         createProgram: () => {
-          const program = this.gl.createProgram();
-          return this.webglIdNew(program);
+          const program = gl.createProgram();
+          return this.glHandles.add(program);
         },
         createShader: (type) => {
-          const shader = this.gl.createShader(type);
-          return this.webglIdNew(shader);
+          const shader = gl.createShader(type);
+          return this.glHandles.add(shader);
         },
         deleteProgram: (programId) => {
-          const program = this.glIdMap[programId];
-          this.webglIdRemove(programId);
-          this.gl.deleteProgram(program);
+          const program = this.glHandles.remove(programId);
+          gl.deleteProgram(program);
         },
         deleteShader: (shaderId) => {
-          const shader = this.glIdMap[shaderId];
-          this.webglIdRemove(shaderId);
-          this.gl.deleteShader(shader);
-        },
-        detachShader: (programId, shaderId) => {
-          const program = this.glIdMap[programId];
-          const shader = this.glIdMap[shaderId];
-          this.gl.detachShader(program, shader);
-        },
-        linkProgram: (programId) => {
-          const program = this.glIdMap[programId];
-          this.gl.linkProgram(program);
-          if (!this.gl.getProgramParameter(program, this.gl.LINK_STATUS)) {
-              console.error("Program linking error:", this.gl.getProgramInfoLog(program));
+          const shader = this.glHandles.remove(shaderId);
+          gl.deleteShader(shader);
+        },
+        detachShader: (programId, shaderId) =>
+          gl.detachShader(lookup(programId), lookup(shaderId)),
+        linkProgram: (programId) => gl.linkProgram(lookup(programId)),
+        shaderSource: (shaderId, source, length) =>
+          gl.shaderSource(lookup(shaderId), this.wasm.memToString(source, length)),
+        useProgram: (programId) => gl.useProgram(lookup(programId)),
+        // Must match GLProgramStatus in web_gl.h: -1 failed, 0 pending, 1 ready
+        programStatus: (programId) => {
+          const program = lookup(programId);
+          if (parallelCompile && !gl.getProgramParameter(program, parallelCompile.COMPLETION_STATUS_KHR)) {
+            return 0;
           }
-        },
-        shaderSource: (shaderId, source, length) => {
-          const shader = this.glIdMap[shaderId];
-          const sourceStr = this.wasm.memToString(source, length);
-          console.log(sourceStr);
-          this.gl.shaderSource(shader, sourceStr);
-        },
-        useProgram: (programId) => {
-          const program = this.glIdMap[programId];
-          this.gl.useProgram(program);
-        },
-
-        clear: (mask) => {
-          this.gl.clear(mask);
-        },
-        clearColor: (red, green, blue, alpha) => {
-          this.gl.clearColor(red, green, blue, alpha);
-        },
-        clearDepth: (depth) => {
-          this.gl.clearDepth(depth);
-        },
-        clearStencil: (stencil) => {
-          this.gl.clearStencil(stencil);
-        },
-        drawArrays: (mode, first, count) => {
-          this.gl.drawArrays(mode, first, count);
-        },
+          if (gl.getProgramParameter(program, gl.LINK_STATUS)) {
+            return 1;
+          }
+          for (const shader of gl.getAttachedShaders(program)) {
+            if (!gl.getShaderParameter(shader, gl.COMPILE_STATUS)) {
+              console.error("Shader compilation error:", gl.getShaderInfoLog(shader));
+            }
+          }
+          console.error("Program linking error:", gl.getProgramInfoLog(program));
+          return -1;
+        },
+
+        createTexture: () => {
+          const texture = gl.createTexture();
+          return this.glHandles.add(texture);
+        },
+        deleteTexture: (id) => {
+          const texture = this.glHandles.remove(id);
+          gl.deleteTexture(texture);
+        },
+        bindTexture: (target, id) => gl.bindTexture(target, lookup(id)),
+        texImage2D: (target, level, internalFormat, width, height, border, format, type, ptr, size) => {
+          const pixels = ptr ? this.wasm.u8.subarray(ptr, ptr + size) : null;
+          gl.texImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
+        },
+        texSubImage2D: (target, level, x, y, width, height, format, type, ptr, size) =>
+          gl.texSubImage2D(target, level, x, y, width, height, format, type, this.wasm.u8, ptr, size),
+        texParameteri: direct('texParameteri'),
+
+        createFramebuffer: () => {
+          const framebuffer = gl.createFramebuffer();
+          return this.glHandles.add(framebuffer);
+        },
+        deleteFramebuffer: (id) => {
+          const framebuffer = this.glHandles.remove(id);
+          gl.deleteFramebuffer(framebuffer);
+        },
+        bindFramebuffer: (target, id) => gl.bindFramebuffer(target, lookup(id)),
+        framebufferTexture2D: (target, attachment, textarget, id, level) =>
+          gl.framebufferTexture2D(target, attachment, textarget, lookup(id), level),
+
+        createRenderbuffer: () => {
+          const renderbuffer = gl.createRenderbuffer();
+          return this.glHandles.add(renderbuffer);
+        },
+        deleteRenderbuffer: (id) => {
+          const renderbuffer = this.glHandles.remove(id);
+          gl.deleteRenderbuffer(renderbuffer);
+        },
+        bindRenderbuffer: (target, id) => gl.bindRenderbuffer(target, lookup(id)),
+        renderbufferStorage: direct('renderbufferStorage'),
+        framebufferRenderbuffer: (target, attachment, renderbufferTarget, id) =>
+          gl.framebufferRenderbuffer(target, attachment, renderbufferTarget, lookup(id)),
+
+        clear: direct('clear'),
+        clearColor: direct('clearColor'),
+        clearDepth: direct('clearDepth'),
+        clearStencil: direct('clearStencil'),
+        drawArrays: direct('drawArrays'),
+        drawArraysInstanced: direct('drawArraysInstanced'),
+
+        enable: direct('enable'),
+        disable: direct('disable'),
+        scissor: direct('scissor'),
+        viewport: direct('viewport'),
+        blendFunc: direct('blendFunc'),
+        depthFunc: direct('depthFunc'),
+        depthMask: (flag) => gl.depthMask(!!flag),
 
         fenceSync: (condition, flags) => {
-          const sync = this.gl.fenceSync(condition, flags);
-          return this.webglIdNew(sync);
+          const sync = gl.fenceSync(condition, flags);
+          return this.glHandles.add(sync);
         },
         deleteSync: (syncId) => {
-          const sync = this.glIdMap[syncId];
-          this.webglIdRemove(syncId);
-          this.gl.deleteSync(sync);
-        },
-        clientWaitSync: (syncId, flags, timeout) => {
-          const sync = this.glIdMap[syncId];
-          const result = this.gl.clientWaitSync(sync, flags, Number(timeout));
-          return result;
+          const sync = this.glHandles.remove(syncId);
+          gl.deleteSync(sync);
         },
+        clientWaitSync: (syncId, flags, timeout) => gl.clientWaitSync(lookup(syncId), flags, Number(timeout)),
+
+        getParameter: direct('getParameter'),
       },
     };
 
@@ -230,6 +355,29 @@ class Application {
     this.wasm = new WasmWrapper(wasm);
 
     this.wasm.c_init();
+
+    this.frameStatsPtr = this.wasm.frameStats();
+    window.shrubFrameStats = this.readFrameStats;
+
+    this.uploadStatsPtr = this.wasm.uploadStats();
+    window.shrubUploadStats = this.readUploadStats;
+    // Bytes and milliseconds of queued uploads per frame
+    window.shrubSetUploadBudget = (bytes, ms) => this.wasm.setUploadBudget(bytes, ms);
+
+    if (this.wasm.glStats) {
+      // The snapshot lives at a fixed address, later reads are plain memory loads
+      this.glStatsPtr = this.wasm.glStats();
+      window.shrubGlStats = this.readGlStats;
+    }
+
+    if (this.wasm.allocStats) {
+      window.shrubAllocStats = this.readAllocStats;
+    }
+
+    if (this.wasm.profileTrace) {
+      // Chrome trace event JSON of the last profiled frames, load it in chrome://tracing or Perfetto
+      window.shrubProfileTrace = () => this.wasm.cStrToString(this.wasm.profileTrace());
+    }
   }
 
   render = (timestamp) => {
@@ -238,20 +386,93 @@ class Application {
     window.requestAnimationFrame(this.render);
   }
 
-  webglIdNew = (obj) => {
-    if (this.glIdFreelist.length == 0) {
-      this.glIdMap.push(obj);
-      return this.glIdMap.length - 1;
-    } else {
-      const id = this.glIdFreelist.shift();
-      this.glIdMap[id] = obj;
-      return id;
-    }
+  // Mirrors FrameStatsBlock in frame_stats.h, times are in microseconds
+  readFrameStats = () => {
+    const metrics = ['frame', 'cpu', 'ui', 'render'];
+    const words = this.wasm.u32.subarray(this.frameStatsPtr >> 2, (this.frameStatsPtr >> 2) + 3 + metrics.length * 10);
+    const readWindow = (offset) => ({
+      count: words[offset],
+      p50: words[offset + 1],
+      p95: words[offset + 2],
+      p99: words[offset + 3],
+      max: words[offset + 4],
+    });
+    const result = {
+      frame: words[0],
+      shortWindowSize: words[1],
+      longWindowSize: words[2],
+    };
+    metrics.forEach((name, i) => {
+      result[name] = {
+        shortWindow: readWindow(3 + i * 10),
+        longWindow: readWindow(3 + i * 10 + 5),
+      };
+    });
+    return result;
   }
 
-  webglIdRemove = (id) => {
-    delete this.glIdMap[id];
-    this.glIdFreelist.push(id);
+  // Mirrors UploadStatsBlock in upload_queue.h
+  readUploadStats = () => {
+    const words = this.wasm.u32.subarray(this.uploadStatsPtr >> 2, (this.uploadStatsPtr >> 2) + 8);
+    return {
+      frame: words[0],
+      queueDepth: words[1],
+      queuedBytes: words[2],
+      bytes: words[3],
+      directBytes: words[4],
+      calls: words[5],
+      oldestWait: words[6],
+      byteBudget: words[7],
+    };
+  }
+
+  readGlStats = () => {
+    const words = this.wasm.u32.subarray(this.glStatsPtr >> 2, (this.glStatsPtr >> 2) + 5 + glStatsFunctions.length);
+    const calls = {};
+    glStatsFunctions.forEach((name, i) => {
+      calls[name] = words[5 + i];
+    });
+    return {
+      frame: words[0],
+      drawCalls: words[1],
+      vertices: words[2],
+      bufferSubDataBytes: words[3],
+      copyBufferSubDataBytes: words[4],
+      calls: calls,
+    };
+  }
+
+  // Mirrors AllocStats and AllocSite in alloc_stats.h
+  readAllocStats = () => {
+    const result = [];
+    for (let i = 0; ; ++i) {
+      const ptr = this.wasm.allocStats(i);
+      if (ptr == 0) {
+        break;
+      }
+      const words = this.wasm.u32.subarray(ptr >> 2, (ptr >> 2) + 11);
+      const sites = [];
+      const siteWords = this.wasm.u32.subarray((ptr >> 2) + 11, (ptr >> 2) + 11 + words[10] * 6);
+      for (let j = 0; j < words[10]; ++j) {
+        const site = siteWords.subarray(j * 6, j * 6 + 6);
+        sites.push({
+          site: site[0] ? `${this.wasm.cStrToString(site[0])}:${site[1]}` : 'unmarked',
+          count: site[4],
+          bytes: site[5],
+        });
+      }
+      result.push({
+        name: this.wasm.cStrToString(words[0]),
+        limit: words[1],
+        used: words[2],
+        count: words[6],
+        bytes: words[7],
+        peak: words[8],
+        maxPeak: words[9],
+        sites: sites,
+      });
+    }
+    return result;
   }
 
 };
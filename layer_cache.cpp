@@ -0,0 +1,247 @@
+#include "layer_cache.h"
+
+#include "profile.h"
+
+namespace shrub {
+
+	namespace {
+
+		i32 round_up(f32 value, i32 granularity) {
+			auto size = static_cast<i32>(value);
+			if (static_cast<f32>(size) < value)
+				++size;
+			if (size < 1)
+				size = 1;
+			return (size + granularity - 1) / granularity * granularity;
+		}
+
+		u64 hash_f32(u64 hash, f32 value) {
+			u32 bits;
+			__builtin_memcpy(&bits, &value, sizeof(bits));
+			return hash_combine(hash, hash_int(bits));
+		}
+
+	}
+
+	void LayerCache::init() {
+		layerCount = 0;
+		textureCount = 0;
+		frame = 0;
+	}
+
+	void LayerCache::begin_frame() {
+		++frame;
+		for (i32 i = 0; i < layerCount; ++i)
+			layers[i].commandCount = 0;
+	}
+
+	i64 LayerCache::extract(
+			ElementTree const& tree, DrawTables const& tables, DrawCommand const *commands, i64 count,
+			u32 compositeProgram, ElementIndex *roots, DrawCommand *layerCommands, DrawCommand *out) {
+		PROFILE_ZONE("layer_extract");
+
+		// Parents come before their children, so one forward pass finds the outermost flagged ancestor
+		for (i32 i = 0; i < tree.elementCount; ++i) {
+			auto parent = tree.parents[i];
+			roots[i] = parent.index != -1 ? roots[parent.index] : ElementIndex{ -1 };
+			if (roots[i].index == -1 && (tree.elements[i].flags & Element::CACHE_LAYER_BIT))
+				roots[i] = { i };
+		}
+
+		// Find the layers drawn this frame and how many commands each one gets
+		i32 last = -1;
+		for (i64 i = 0; i < count; ++i) {
+			auto root = roots[commands[i].elementIndex.index];
+			if (root.index == -1)
+				continue;
+
+			auto id = tree.elements[root.index].id;
+			if (last == -1 || layers[last].id.id != id.id) {
+				last = -1;
+				for (i32 l = 0; l < layerCount; ++l) {
+					if (layers[l].id.id == id.id) {
+						last = l;
+						break;
+					}
+				}
+				if (last == -1) {
+					if (layerCount == maxLayers)
+						continue;
+					last = layerCount++;
+					layers[last] = {};
+					layers[last].id = id;
+					layers[last].texture = -1;
+				}
+				layers[last].root = root;
+				layers[last].frame = frame;
+			}
+			++layers[last].commandCount;
+		}
+
+		i64 offset = 0;
+		for (i32 l = 0; l < layerCount; ++l) {
+			auto& layer = layers[l];
+			if (layer.frame != frame)
+				continue;
+
+			auto const& extent = tree.elements[layer.root.index].extent;
+			auto width = round_up(extent.x, sizeGranularity);
+			auto height = round_up(extent.y, sizeGranularity);
+			if (layer.texture != -1 && (textures[layer.texture].width != width || textures[layer.texture].height != height)) {
+				release_texture(layer.texture);
+				layer.texture = -1;
+			}
+			if (layer.texture == -1) {
+				layer.texture = acquire_texture(width, height);
+				layer.rendered = false;
+			}
+
+			layer.firstCommand = offset;
+			offset += layer.commandCount;
+			layer.commandCount = 0;
+			layer.contentHash = 0;
+		}
+
+		// Scatter keeps the sorted order within every list
+		i64 outCount = 0;
+		for (i64 i = 0; i < count; ++i) {
+			auto const& drawCmd = commands[i];
+			auto root = roots[drawCmd.elementIndex.index];
+
+			Layer *layer = nullptr;
+			if (root.index != -1) {
+				for (i32 l = 0; l < layerCount; ++l) {
+					if (layers[l].frame == frame && layers[l].root.index == root.index) {
+						layer = &layers[l];
+						break;
+					}
+				}
+			}
+
+			if (!layer || layer->texture == -1) {
+				out[outCount++] = drawCmd;
+				continue;
+			}
+
+			layerCommands[layer->firstCommand + layer->commandCount++] = drawCmd;
+
+			auto rootPos = tree.positions[root.index];
+			auto pos = tree.positions[drawCmd.elementIndex.index];
+			auto const& extent = tree.elements[drawCmd.elementIndex.index].extent;
+			auto hash = hash_combine(layer->contentHash, hash_int(drawCmd.sortKey));
+			hash = hash_f32(hash, pos.x - rootPos.x);
+			hash = hash_f32(hash, pos.y - rootPos.y);
+			hash = hash_f32(hash, extent.x);
+			hash = hash_f32(hash, extent.y);
+			hash = hash_f32(hash, drawCmd.color.x);
+			hash = hash_f32(hash, drawCmd.color.y);
+			hash = hash_f32(hash, drawCmd.color.z);
+			hash = hash_f32(hash, drawCmd.color.w);
+			if (drawCmd.shape != -1 || drawCmd.text != -1 || drawCmd.line != -1)
+				hash = hash_combine(hash, hash_command_content(tables, drawCmd));
+			layer->contentHash = hash;
+		}
+
+		// Composites go where their root would sort, translucent since the layer has transparent gaps
+		for (i32 l = 0; l < layerCount; ++l) {
+			auto const& layer = layers[l];
+			if (layer.frame != frame || layer.texture == -1)
+				continue;
+
+			auto const& texture = textures[layer.texture];
+			auto const& extent = tree.elements[layer.root.index].extent;
+			auto composite = DrawCommand{
+				layer.root,
+				{ 0.f, 0.f, extent.x / static_cast<f32>(texture.width), extent.y / static_cast<f32>(texture.height) },
+				make_sort_key(0, true, compositeProgram, static_cast<u32>(layer.texture + 1), static_cast<u32>(layer.root.index)),
+			};
+
+			auto i = outCount++;
+			for (; i > 0 && out[i - 1].sortKey > composite.sortKey; --i)
+				out[i] = out[i - 1];
+			out[i] = composite;
+		}
+
+		return outCount;
+	}
+
+	void LayerCache::end_frame() {
+		for (i32 l = 0; l < layerCount;) {
+			auto& layer = layers[l];
+			if (layer.frame == frame) {
+				++l;
+				continue;
+			}
+			if (layer.texture != -1)
+				release_texture(layer.texture);
+			layers[l] = layers[--layerCount];
+		}
+	}
+
+	bool LayerCache::needs_render(Layer const& layer) const {
+		return layer.frame == frame && layer.texture != -1 && (!layer.rendered || layer.renderedHash != layer.contentHash);
+	}
+
+	void LayerCache::mark_rendered(Layer *layer) {
+		layer->renderedHash = layer->contentHash;
+		layer->rendered = true;
+	}
+
+	int LayerCache::texture_handle(u32 textureKey) const {
+		assert(textureKey > 0 && static_cast<i32>(textureKey) <= textureCount);
+		return textures[textureKey - 1].texture;
+	}
+
+	i32 LayerCache::acquire_texture(i32 width, i32 height) {
+		i32 spare = -1;
+		for (i32 i = 0; i < textureCount; ++i) {
+			if (textures[i].used)
+				continue;
+			if (textures[i].width == width && textures[i].height == height) {
+				textures[i].used = true;
+				return i;
+			}
+			spare = i;
+		}
+
+		if (spare == -1) {
+			if (textureCount == maxLayers)
+				return -1;
+
+			spare = textureCount++;
+			auto& created = textures[spare];
+			created.texture = gl_create_texture();
+			gl_bind_texture(GL_TEXTURE_2D, created.texture);
+			gl_tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			gl_tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			gl_tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			gl_tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+			created.depth = gl_create_renderbuffer();
+			created.framebuffer = gl_create_framebuffer();
+			created.width = 0;
+			created.height = 0;
+		}
+
+		auto& texture = textures[spare];
+		texture.used = true;
+		if (texture.width != width || texture.height != height) {
+			gl_bind_texture(GL_TEXTURE_2D, texture.texture);
+			gl_tex_image_2d(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr, 0);
+			gl_bind_renderbuffer(GL_RENDERBUFFER, texture.depth);
+			gl_renderbuffer_storage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+			gl_bind_framebuffer(GL_FRAMEBUFFER, texture.framebuffer);
+			gl_framebuffer_texture_2d(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture.texture, 0);
+			gl_framebuffer_renderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, texture.depth);
+			gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+			texture.width = width;
+			texture.height = height;
+		}
+		return spare;
+	}
+
+	void LayerCache::release_texture(i32 index) {
+		textures[index].used = false;
+	}
+
+}
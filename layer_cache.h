@@ -0,0 +1,76 @@
+#pragma once
+
+#include <oak_util/types.h>
+
+#include "shrub.h"
+
+namespace shrub {
+
+	using namespace oak;
+
+	struct LayerTexture {
+		int texture;
+		// Depth renderbuffer, the subtree is drawn with the same depth tested opaque pass as the canvas
+		int depth;
+		int framebuffer;
+		i32 width;
+		i32 height;
+		bool used;
+	};
+
+	struct Layer {
+		ElementId id;
+		ElementIndex root;
+		// Hash of every command in the subtree relative to the root, so moving the root doesn't re-render
+		u64 contentHash;
+		u64 renderedHash;
+		bool rendered;
+		// Pool index, -1 when none could be acquired and the subtree is drawn directly
+		i32 texture;
+		u32 frame;
+		i64 firstCommand;
+		i64 commandCount;
+	};
+
+	// Subtrees rooted at an element with CACHE_LAYER_BIT are rendered into a pooled texture and drawn as
+	// a single textured quad until their content hash changes. Layers nest by taking the outermost root,
+	// and content outside the root's extent is clipped.
+	struct LayerCache {
+		static constexpr i32 maxLayers = 16;
+		// Texture sizes are rounded up to this so pooled textures are more likely to be reused
+		static constexpr i32 sizeGranularity = 64;
+
+		Layer layers[maxLayers];
+		i32 layerCount = 0;
+
+		LayerTexture textures[maxLayers];
+		i32 textureCount = 0;
+
+		u32 frame = 0;
+
+		void init();
+
+		void begin_frame();
+
+		// Splits sorted commands into the main list and the per-layer lists. out receives the main
+		// commands with one composite command per layer merged in by sort key and must hold
+		// count + maxLayers commands. layerCommands must hold count commands, roots one entry per element.
+		// Returns the number of commands written to out.
+		i64 extract(
+				ElementTree const& tree, DrawTables const& tables, DrawCommand const *commands, i64 count,
+				u32 compositeProgram, ElementIndex *roots, DrawCommand *layerCommands, DrawCommand *out);
+
+		// Releases the textures of layers whose root wasn't drawn this frame
+		void end_frame();
+
+		bool needs_render(Layer const& layer) const;
+		void mark_rendered(Layer *layer);
+
+		// GL texture for the texture index of a composite command's sort key
+		int texture_handle(u32 textureKey) const;
+
+		i32 acquire_texture(i32 width, i32 height);
+		void release_texture(i32 index);
+	};
+
+}
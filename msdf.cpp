@@ -0,0 +1,524 @@
+#include "msdf.h"
+
+#include "profile.h"
+
+namespace shrub {
+
+	namespace {
+
+		f32 abs_f32(f32 value) {
+			return value < 0.f ? -value : value;
+		}
+
+		f32 min_f32(f32 a, f32 b) {
+			return a < b ? a : b;
+		}
+
+		f32 max_f32(f32 a, f32 b) {
+			return a > b ? a : b;
+		}
+
+		i32 floor_i32(f32 value) {
+			auto truncated = static_cast<i32>(value);
+			return static_cast<f32>(truncated) > value ? truncated - 1 : truncated;
+		}
+
+		i32 ceil_i32(f32 value) {
+			auto truncated = static_cast<i32>(value);
+			return static_cast<f32>(truncated) < value ? truncated + 1 : truncated;
+		}
+
+		f32 dot(Vec2 a, Vec2 b) {
+			return a.x * b.x + a.y * b.y;
+		}
+
+		f32 cross(Vec2 a, Vec2 b) {
+			return a.x * b.y - a.y * b.x;
+		}
+
+		Vec2 difference(Vec2 a, Vec2 b) {
+			return { a.x - b.x, a.y - b.y };
+		}
+
+		Vec2 lerp(Vec2 a, Vec2 b, f32 t) {
+			return { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t };
+		}
+
+		f32 length(Vec2 v) {
+			return __builtin_sqrtf(dot(v, v));
+		}
+
+		Vec2 normalized(Vec2 v) {
+			auto l = length(v);
+			return l > 0.f ? Vec2{ v.x / l, v.y / l } : Vec2{};
+		}
+
+		bool same_point(Vec2 a, Vec2 b) {
+			return a.x == b.x && a.y == b.y;
+		}
+
+		Vec2 start_direction(EdgeSegment const& edge) {
+			auto direction = difference(edge.p[1], edge.p[0]);
+			if (edge.quadratic && direction.x == 0.f && direction.y == 0.f)
+				direction = difference(edge.p[2], edge.p[0]);
+			return direction;
+		}
+
+		Vec2 end_direction(EdgeSegment const& edge) {
+			if (!edge.quadratic)
+				return difference(edge.p[1], edge.p[0]);
+			auto direction = difference(edge.p[2], edge.p[1]);
+			if (direction.x == 0.f && direction.y == 0.f)
+				direction = difference(edge.p[2], edge.p[0]);
+			return direction;
+		}
+
+		Vec2 end_point(EdgeSegment const& edge) {
+			return edge.quadratic ? edge.p[2] : edge.p[1];
+		}
+
+		bool is_corner(Vec2 a, Vec2 b) {
+			a = normalized(a);
+			b = normalized(b);
+			return dot(a, b) <= 0.f || abs_f32(cross(a, b)) > Outline::cornerThreshold;
+		}
+
+		// Rotates through cyan, magenta and yellow, or takes the one that shares a single channel with banned
+		u8 next_channels(u8 channels, u8 banned) {
+			auto shared = static_cast<u8>(channels & banned);
+			if (shared == EdgeSegment::RED_BIT || shared == EdgeSegment::GREEN_BIT || shared == EdgeSegment::BLUE_BIT)
+				return static_cast<u8>(shared ^ EdgeSegment::WHITE);
+			auto shifted = static_cast<u32>(channels) << 1;
+			return static_cast<u8>((shifted | shifted >> 3) & EdgeSegment::WHITE);
+		}
+
+		// -1, 0 or 1 for the first, middle and last third of count edges
+		i32 third_of(i32 position, i32 count) {
+			return static_cast<i32>(3.f + 2.875f * static_cast<f32>(position) / static_cast<f32>(count - 1) - 1.4375f + 0.5f) - 3;
+		}
+
+		void split_thirds(EdgeSegment const& edge, EdgeSegment *parts) {
+			if (!edge.quadratic) {
+				auto a = lerp(edge.p[0], edge.p[1], 1.f / 3.f);
+				auto b = lerp(edge.p[0], edge.p[1], 2.f / 3.f);
+				parts[0] = { { edge.p[0], a, a }, false, edge.channels };
+				parts[1] = { { a, b, b }, false, edge.channels };
+				parts[2] = { { b, edge.p[1], edge.p[1] }, false, edge.channels };
+				return;
+			}
+
+			// The control point of the piece from t0 to t1 is where the tangent at t0 meets the one at t1
+			f32 const ts[4] = { 0.f, 1.f / 3.f, 2.f / 3.f, 1.f };
+			for (i32 i = 0; i < 3; ++i) {
+				auto t0 = ts[i];
+				auto t1 = ts[i + 1];
+				auto start = lerp(lerp(edge.p[0], edge.p[1], t0), lerp(edge.p[1], edge.p[2], t0), t0);
+				auto end = lerp(lerp(edge.p[0], edge.p[1], t1), lerp(edge.p[1], edge.p[2], t1), t1);
+				auto control = lerp(lerp(edge.p[0], edge.p[1], t0), lerp(edge.p[1], edge.p[2], t0), t1);
+				parts[i] = { { start, control, end }, true, edge.channels };
+			}
+		}
+
+		// Positive for counter-clockwise outlines
+		f32 signed_area(Outline const& outline) {
+			f32 area = 0.f;
+			for (i32 i = 0; i < outline.edgeCount; ++i) {
+				auto const& edge = outline.edges[i];
+				area += 0.5f * cross(edge.p[0], end_point(edge));
+				if (edge.quadratic)
+					area += cross(difference(edge.p[1], edge.p[0]), difference(edge.p[2], edge.p[0])) / 3.f;
+			}
+			return area;
+		}
+
+		// Positive to the right of the edge. dot is how parallel the edge runs to the point when it's nearest at
+		// an end, for breaking ties between the two edges of a corner, and t is past [0, 1] when it's nearest
+		// at an end and the point is beyond it.
+		struct SignedDistance {
+			f32 distance;
+			f32 dot;
+			f32 t;
+		};
+
+		constexpr SignedDistance farthest = { -__builtin_huge_valf(), 1.f, 0.f };
+
+		bool closer(SignedDistance const& a, SignedDistance const& b) {
+			auto da = abs_f32(a.distance);
+			auto db = abs_f32(b.distance);
+			return da < db || (da == db && a.dot < b.dot);
+		}
+
+		f32 nonzero_sign(f32 value) {
+			return value > 0.f ? 1.f : -1.f;
+		}
+
+		SignedDistance line_distance(EdgeSegment const& edge, Vec2 point) {
+			auto aq = difference(point, edge.p[0]);
+			auto ab = difference(edge.p[1], edge.p[0]);
+			auto t = dot(aq, ab) / dot(ab, ab);
+			auto eq = difference(t > 0.5f ? edge.p[1] : edge.p[0], point);
+			auto endDistance = length(eq);
+			if (t > 0.f && t < 1.f) {
+				auto orthogonal = cross(aq, ab) / length(ab);
+				if (abs_f32(orthogonal) < endDistance)
+					return { orthogonal, 0.f, t };
+			}
+			return { nonzero_sign(cross(aq, ab)) * endDistance, abs_f32(dot(normalized(ab), normalized(eq))), t };
+		}
+
+		SignedDistance quadratic_distance(EdgeSegment const& edge, Vec2 point) {
+			auto qa = difference(edge.p[0], point);
+			auto ab = difference(edge.p[1], edge.p[0]);
+			auto br = difference(difference(edge.p[2], edge.p[1]), ab);
+
+			auto startDirection = start_direction(edge);
+			auto nearest = nonzero_sign(cross(startDirection, qa)) * length(qa);
+			auto t = -dot(qa, startDirection) / dot(startDirection, startDirection);
+			auto endDirection = end_direction(edge);
+			auto eq = difference(edge.p[2], point);
+			if (length(eq) < abs_f32(nearest)) {
+				nearest = nonzero_sign(cross(endDirection, eq)) * length(eq);
+				t = dot(difference(point, edge.p[1]), endDirection) / dot(endDirection, endDirection);
+			}
+
+			// Nearest points inside the curve are where the cubic (B(t) - point) . B'(t) / 2 goes from negative to
+			// positive. Its own turning points split [0, 1] into monotonic pieces with at most one such root each.
+			auto a = dot(br, br);
+			auto b = 3.f * dot(ab, br);
+			auto c = 2.f * dot(ab, ab) + dot(qa, br);
+			auto d = dot(qa, ab);
+			f32 bounds[4] = { 0.f };
+			i32 boundCount = 1;
+			auto qa2 = 3.f * a;
+			auto qb2 = 2.f * b;
+			if (abs_f32(qa2) > 1e-12f) {
+				auto discriminant = qb2 * qb2 - 4.f * qa2 * c;
+				if (discriminant > 0.f) {
+					auto root = __builtin_sqrtf(discriminant);
+					auto r0 = (-qb2 - root) / (2.f * qa2);
+					auto r1 = (-qb2 + root) / (2.f * qa2);
+					if (r0 > r1) {
+						auto swap = r0;
+						r0 = r1;
+						r1 = swap;
+					}
+					if (r0 > 0.f && r0 < 1.f)
+						bounds[boundCount++] = r0;
+					if (r1 > 0.f && r1 < 1.f)
+						bounds[boundCount++] = r1;
+				}
+			} else if (abs_f32(qb2) > 1e-12f) {
+				auto r = -c / qb2;
+				if (r > 0.f && r < 1.f)
+					bounds[boundCount++] = r;
+			}
+			bounds[boundCount++] = 1.f;
+
+			for (i32 i = 0; i + 1 < boundCount; ++i) {
+				auto lo = bounds[i];
+				auto hi = bounds[i + 1];
+				if (((a * lo + b) * lo + c) * lo + d >= 0.f || ((a * hi + b) * hi + c) * hi + d <= 0.f)
+					continue;
+
+				// Newton, falling back to bisection whenever a step leaves the bracket
+				auto root = (lo + hi) * 0.5f;
+				for (i32 iteration = 0; iteration < 12; ++iteration) {
+					auto value = ((a * root + b) * root + c) * root + d;
+					if (value < 0.f)
+						lo = root;
+					else
+						hi = root;
+					auto slope = (3.f * a * root + 2.f * b) * root + c;
+					auto next = slope > 0.f ? root - value / slope : lo - 1.f;
+					root = next > lo && next < hi ? next : (lo + hi) * 0.5f;
+				}
+
+				auto qe = Vec2{
+					qa.x + 2.f * root * ab.x + root * root * br.x,
+					qa.y + 2.f * root * ab.y + root * root * br.y,
+				};
+				auto distance = length(qe);
+				if (distance <= abs_f32(nearest)) {
+					nearest = nonzero_sign(cross(Vec2{ ab.x + root * br.x, ab.y + root * br.y }, qe)) * distance;
+					t = root;
+				}
+			}
+
+			if (t >= 0.f && t <= 1.f)
+				return { nearest, 0.f, t };
+			if (t < 0.5f)
+				return { nearest, abs_f32(dot(normalized(startDirection), normalized(qa))), t };
+			return { nearest, abs_f32(dot(normalized(endDirection), normalized(eq))), t };
+		}
+
+		SignedDistance edge_distance(EdgeSegment const& edge, Vec2 point) {
+			return edge.quadratic ? quadratic_distance(edge, point) : line_distance(edge, point);
+		}
+
+		// Past its ends an edge continues along its tangents, which keeps each channel's distance straight across
+		// the corners so the median can rebuild them
+		f32 pseudo_distance(EdgeSegment const& edge, SignedDistance const& nearest, Vec2 point) {
+			auto distance = nearest.distance;
+			if (nearest.t < 0.f) {
+				auto direction = normalized(start_direction(edge));
+				auto aq = difference(point, edge.p[0]);
+				if (dot(aq, direction) < 0.f) {
+					auto perpendicular = cross(aq, direction);
+					if (abs_f32(perpendicular) <= abs_f32(distance))
+						distance = perpendicular;
+				}
+			} else if (nearest.t > 1.f) {
+				auto direction = normalized(end_direction(edge));
+				auto bq = difference(point, end_point(edge));
+				if (dot(bq, direction) > 0.f) {
+					auto perpendicular = cross(bq, direction);
+					if (abs_f32(perpendicular) <= abs_f32(distance))
+						distance = perpendicular;
+				}
+			}
+			return distance;
+		}
+
+		f32 median(f32 a, f32 b, f32 c) {
+			return max_f32(min_f32(a, b), min_f32(max_f32(a, b), c));
+		}
+
+		u8 encode(f32 distance) {
+			auto value = 0.5f + distance / (2.f * msdfRange);
+			value = value < 0.f ? 0.f : value > 1.f ? 1.f : value;
+			return static_cast<u8>(value * 255.f + 0.5f);
+		}
+
+	}
+
+	void Outline::init(Allocator *allocator, i32 edgeCapacity_, i32 contourCapacity_) {
+		edgeCapacity = edgeCapacity_;
+		edges = allocate<EdgeSegment>(allocator, edgeCapacity);
+		contourCapacity = contourCapacity_;
+		contours = allocate<Contour>(allocator, contourCapacity);
+		clear();
+	}
+
+	void Outline::clear() {
+		edgeCount = 0;
+		contourCount = 0;
+		pen = {};
+		overflowed = false;
+	}
+
+	void Outline::move_to(Vec2 to) {
+		close();
+		pen = to;
+		// Empty contours are reused rather than kept
+		if (contourCount && !contours[contourCount - 1].edgeCount)
+			return;
+		if (contourCount == contourCapacity) {
+			overflowed = true;
+			return;
+		}
+		contours[contourCount++] = { edgeCount, 0 };
+	}
+
+	void Outline::line_to(Vec2 to) {
+		if (same_point(to, pen))
+			return;
+		if (!contourCount || edgeCount == edgeCapacity) {
+			overflowed = true;
+			return;
+		}
+		edges[edgeCount++] = { { pen, to, to }, false, EdgeSegment::WHITE };
+		++contours[contourCount - 1].edgeCount;
+		pen = to;
+	}
+
+	void Outline::quad_to(Vec2 control, Vec2 to) {
+		if (same_point(control, pen) || same_point(control, to)) {
+			line_to(to);
+			return;
+		}
+		if (!contourCount || edgeCount == edgeCapacity) {
+			overflowed = true;
+			return;
+		}
+		edges[edgeCount++] = { { pen, control, to }, true, EdgeSegment::WHITE };
+		++contours[contourCount - 1].edgeCount;
+		pen = to;
+	}
+
+	void Outline::close() {
+		if (!contourCount || !contours[contourCount - 1].edgeCount)
+			return;
+		line_to(edges[contours[contourCount - 1].firstEdge].p[0]);
+	}
+
+	bool Outline::color_edges() {
+		close();
+		for (i32 c = 0; c < contourCount; ++c) {
+			auto& contour = contours[c];
+			auto contourEdges = edges + contour.firstEdge;
+			auto n = contour.edgeCount;
+			if (!n)
+				continue;
+
+			// Corners are where the edge before ends going a different way than the next one starts
+			i32 cornerCount = 0;
+			i32 firstCorner = 0;
+			for (i32 i = 0; i < n; ++i) {
+				if (is_corner(end_direction(contourEdges[(i + n - 1) % n]), start_direction(contourEdges[i]))) {
+					if (!cornerCount)
+						firstCorner = i;
+					++cornerCount;
+				}
+			}
+
+			if (!cornerCount) {
+				for (i32 i = 0; i < n; ++i)
+					contourEdges[i].channels = EdgeSegment::WHITE;
+				continue;
+			}
+
+			if (cornerCount == 1) {
+				// A teardrop: the two sides of the corner get different channels with white in between
+				u8 const channels[3] = { EdgeSegment::GREEN_BIT | EdgeSegment::BLUE_BIT, EdgeSegment::WHITE,
+					EdgeSegment::RED_BIT | EdgeSegment::BLUE_BIT };
+				if (n >= 3) {
+					for (i32 i = 0; i < n; ++i)
+						contourEdges[(firstCorner + i) % n].channels = channels[1 + third_of(i, n)];
+					continue;
+				}
+
+				// Too few edges for three colors, split each into thirds
+				auto extra = 2 * n;
+				if (edgeCount + extra > edgeCapacity)
+					return false;
+				EdgeSegment original[2];
+				for (i32 i = 0; i < n; ++i)
+					original[i] = contourEdges[(firstCorner + i) % n];
+				for (i32 i = edgeCount - 1; i >= contour.firstEdge + n; --i)
+					edges[i + extra] = edges[i];
+				for (i32 later = c + 1; later < contourCount; ++later)
+					contours[later].firstEdge += extra;
+
+				for (i32 i = 0; i < n; ++i)
+					split_thirds(original[i], contourEdges + 3 * i);
+				for (i32 i = 0; i < 3 * n; ++i)
+					contourEdges[i].channels = channels[n == 1 ? i : i / 2];
+				contour.edgeCount += extra;
+				edgeCount += extra;
+				continue;
+			}
+
+			// The last run between corners mustn't match the first, they meet at the first corner
+			u8 const initial = EdgeSegment::GREEN_BIT | EdgeSegment::BLUE_BIT;
+			auto channels = initial;
+			i32 run = 0;
+			for (i32 i = 0; i < n; ++i) {
+				auto index = (firstCorner + i) % n;
+				if (i > 0 && is_corner(end_direction(contourEdges[(index + n - 1) % n]), start_direction(contourEdges[index]))) {
+					++run;
+					channels = next_channels(channels, run == cornerCount - 1 ? initial : 0);
+				}
+				contourEdges[index].channels = channels;
+			}
+		}
+		return true;
+	}
+
+	ClipRect Outline::bounds() const {
+		auto rect = ClipRect{ { __builtin_huge_valf(), __builtin_huge_valf() }, { -__builtin_huge_valf(), -__builtin_huge_valf() } };
+		for (i32 i = 0; i < edgeCount; ++i) {
+			auto const& edge = edges[i];
+			for (i32 p = 0; p < (edge.quadratic ? 3 : 2); ++p) {
+				rect.min.x = min_f32(rect.min.x, edge.p[p].x);
+				rect.min.y = min_f32(rect.min.y, edge.p[p].y);
+				rect.max.x = max_f32(rect.max.x, edge.p[p].x);
+				rect.max.y = max_f32(rect.max.y, edge.p[p].y);
+			}
+		}
+		return rect;
+	}
+
+	void generate_msdf(Outline const& outline, f32 scale, Vec2 origin, u8 *pixels, i32 width, i32 height) {
+		PROFILE_ZONE("msdf_generate");
+
+		// Edge distances are positive on their right, which is inside for clockwise outlines
+		auto sign = signed_area(outline) > 0.f ? -scale : scale;
+
+		for (i32 row = 0; row < height; ++row) {
+			for (i32 column = 0; column < width; ++column) {
+				auto point = Vec2{
+					origin.x + (static_cast<f32>(column) + 0.5f) / scale,
+					origin.y + (static_cast<f32>(height - 1 - row) + 0.5f) / scale,
+				};
+
+				auto nearest = farthest;
+				SignedDistance channelNearest[3] = { farthest, farthest, farthest };
+				i32 channelEdges[3] = { -1, -1, -1 };
+				for (i32 e = 0; e < outline.edgeCount; ++e) {
+					auto const& edge = outline.edges[e];
+					auto distance = edge_distance(edge, point);
+					if (closer(distance, nearest))
+						nearest = distance;
+					for (i32 channel = 0; channel < 3; ++channel) {
+						if ((edge.channels & (1 << channel)) && closer(distance, channelNearest[channel])) {
+							channelNearest[channel] = distance;
+							channelEdges[channel] = e;
+						}
+					}
+				}
+
+				f32 distances[3];
+				for (i32 channel = 0; channel < 3; ++channel) {
+					auto e = channelEdges[channel];
+					distances[channel] = e != -1
+						? pseudo_distance(outline.edges[e], channelNearest[channel], point) * sign
+						: nearest.distance * sign;
+				}
+
+				// Where corners of different channels come close the median can land on the wrong side, those
+				// texels fall back to the true distance
+				auto trueDistance = nearest.distance * sign;
+				if ((median(distances[0], distances[1], distances[2]) > 0.f) != (trueDistance > 0.f))
+					distances[0] = distances[1] = distances[2] = trueDistance;
+
+				auto texel = pixels + 4 * (row * width + column);
+				texel[0] = encode(distances[0]);
+				texel[1] = encode(distances[1]);
+				texel[2] = encode(distances[2]);
+				texel[3] = encode(trueDistance);
+			}
+		}
+	}
+
+	bool generate_msdf_glyph(Outline *outline, f32 scale, GlyphMetrics *metrics, u8 *pixels, i32 capacity) {
+		if (outline->overflowed || !outline->color_edges())
+			return false;
+
+		if (!outline->edgeCount) {
+			metrics->width = 0;
+			metrics->height = 0;
+			return true;
+		}
+
+		// Whole texels around the bounds, with room for the range on every side
+		auto bounds = outline->bounds();
+		auto margin = ceil_i32(msdfRange);
+		auto left = floor_i32(bounds.min.x * scale) - margin;
+		auto bottom = floor_i32(bounds.min.y * scale) - margin;
+		auto right = ceil_i32(bounds.max.x * scale) + margin;
+		auto top = ceil_i32(bounds.max.y * scale) + margin;
+		auto width = right - left;
+		auto height = top - bottom;
+		if (static_cast<i64>(width) * height * 4 > capacity)
+			return false;
+
+		metrics->width = width;
+		metrics->height = height;
+		metrics->bearingX = static_cast<f32>(left);
+		metrics->bearingY = static_cast<f32>(top);
+		generate_msdf(
+			*outline, scale, { static_cast<f32>(left) / scale, static_cast<f32>(bottom) / scale }, pixels, width, height);
+		return true;
+	}
+
+}
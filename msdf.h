@@ -0,0 +1,82 @@
+#pragma once
+
+#include <oak_util/types.h>
+
+#include "glyph_atlas.h"
+
+namespace shrub {
+
+	using namespace oak;
+
+	// Distance covered by the field on either side of the outline, in texels. Shaders need the same value
+	// to turn a sample back into a distance.
+	constexpr f32 msdfRange = 4.f;
+
+	// A line from p[0] to p[1] or a quadratic Bezier through p[1]
+	struct EdgeSegment {
+		enum : u8 {
+			RED_BIT = 1,
+			GREEN_BIT = 2,
+			BLUE_BIT = 4,
+			WHITE = RED_BIT | GREEN_BIT | BLUE_BIT,
+		};
+
+		Vec2 p[3];
+		bool quadratic;
+		// Channels whose distance this edge takes part in, two edges meeting at a corner share at most one
+		u8 channels;
+	};
+
+	struct Contour {
+		i32 firstEdge;
+		i32 edgeCount;
+	};
+
+	// Closed contours in font units with y up, filled by the nonzero rule. Either orientation works as long
+	// as holes run opposite to the contour around them, as they do in fonts.
+	struct Outline {
+		// Sharper corners than this between two edges get different channels, as the sine of the angle
+		static constexpr f32 cornerThreshold = 0.14f;
+
+		EdgeSegment *edges = nullptr;
+		i32 edgeCount = 0;
+		i32 edgeCapacity = 0;
+		Contour *contours = nullptr;
+		i32 contourCount = 0;
+		i32 contourCapacity = 0;
+		Vec2 pen;
+		// Set when an edge or contour didn't fit, the outline is incomplete
+		bool overflowed = false;
+
+		void init(Allocator *allocator, i32 edgeCapacity_, i32 contourCapacity_);
+		void clear();
+
+		// Starts a contour, the previous one is closed if it wasn't
+		void move_to(Vec2 to);
+		void line_to(Vec2 to);
+		void quad_to(Vec2 control, Vec2 to);
+		// Adds a line back to the contour's start if the pen isn't there
+		void close();
+
+		// Assigns channels so every corner is kept sharp by the median of three distances. Contours with a
+		// single corner are split into at least three edges, which needs spare edge capacity. Returns false
+		// when there isn't enough.
+		bool color_edges();
+
+		// Control points included, which is all generate_msdf needs
+		ClipRect bounds() const;
+	};
+
+	// Writes an RGBA distance field of outline at scale pixels per font unit, rows top first. RGB hold the
+	// per channel pseudo distances, their median is the distance to the outline; A holds the true distance.
+	// Both map msdfRange pixels outside to 0 and as far inside to 255. origin is the font unit position of
+	// the bottom left corner of the bottom left texel. outline must have its edges colored.
+	void generate_msdf(Outline const& outline, f32 scale, Vec2 origin, u8 *pixels, i32 width, i32 height);
+
+	// Colors the edges of outline and writes its field sized to its bounds plus the range, for a
+	// GlyphRasterizer with an RGBA atlas. Fills in width, height and the bearings of metrics, advance, ascent
+	// and descent are left to the caller. Returns false when the outline is incomplete or the field doesn't
+	// fit in capacity bytes.
+	bool generate_msdf_glyph(Outline *outline, f32 scale, GlyphMetrics *metrics, u8 *pixels, i32 capacity);
+
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <oak_util/types.h>
+
+#ifdef __wasm__
+extern "C" __attribute__((import_module("env"), import_name("performanceNow"))) double performance_now();
+#else
+#include <time.h>
+#endif
+
+namespace shrub {
+
+	using namespace oak;
+
+	// Milliseconds from an arbitrary monotonic origin
+	inline f64 profile_now() {
+#ifdef __wasm__
+		return performance_now();
+#else
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return static_cast<f64>(ts.tv_sec) * 1000.0 + static_cast<f64>(ts.tv_nsec) * 0.000001;
+#endif
+	}
+
+#ifdef SHRUB_PROFILE
+
+#ifndef SHRUB_PROFILE_CAPACITY
+#define SHRUB_PROFILE_CAPACITY 8192
+#endif
+
+	struct ProfileEvent {
+		// Must be a string literal without characters that need escaping in JSON
+		char const *name;
+		f64 begin;
+		f64 end;
+		u32 frame;
+		u32 depth;
+	};
+
+	struct Profiler {
+		static constexpr u64 capacity = SHRUB_PROFILE_CAPACITY;
+
+		static_assert((capacity & (capacity - 1)) == 0, "Profile capacity must be a power of two");
+
+		ProfileEvent events[capacity];
+		u64 head = 0;
+		u32 frame = 0;
+		u32 depth = 0;
+
+		u64 begin_zone(char const *name);
+		void end_zone(u64 seq);
+
+		void frame_mark();
+
+		i64 write_trace(char *buffer, i64 bufferCapacity) const;
+	};
+
+	inline Profiler profiler;
+
+	inline u64 Profiler::begin_zone(char const *name) {
+		auto seq = head++;
+		auto& evt = events[seq & (capacity - 1)];
+		evt.name = name;
+		evt.frame = frame;
+		evt.depth = depth++;
+		evt.end = -1.0;
+		evt.begin = profile_now();
+		return seq;
+	}
+
+	inline void Profiler::end_zone(u64 seq) {
+		auto now = profile_now();
+		--depth;
+		// The slot was recycled while the zone was open
+		if (head - seq > capacity)
+			return;
+		events[seq & (capacity - 1)].end = now;
+	}
+
+	inline void Profiler::frame_mark() {
+		++frame;
+		depth = 0;
+	}
+
+	struct TraceWriter {
+		char *data;
+		i64 count;
+		i64 capacity;
+
+		void put(char c) {
+			if (count < capacity)
+				data[count] = c;
+			++count;
+		}
+
+		void put(char const *str) {
+			while (*str)
+				put(*str++);
+		}
+
+		void put_u64(u64 value) {
+			char digits[20];
+			i32 n = 0;
+			do {
+				digits[n++] = static_cast<char>('0' + value % 10);
+				value /= 10;
+			} while (value);
+			while (n)
+				put(digits[--n]);
+		}
+
+		// Trace event timestamps are microseconds, write with nanosecond precision
+		void put_us(f64 ms) {
+			auto ns = static_cast<u64>(ms * 1000000.0);
+			put_u64(ns / 1000);
+			put('.');
+			auto frac = ns % 1000;
+			put(static_cast<char>('0' + frac / 100));
+			put(static_cast<char>('0' + frac / 10 % 10));
+			put(static_cast<char>('0' + frac % 10));
+		}
+	};
+
+	// Writes the ring buffer contents as Chrome trace event JSON (chrome://tracing, Perfetto).
+	// Returns the number of bytes the full trace needs, which may exceed bufferCapacity.
+	inline i64 Profiler::write_trace(char *buffer, i64 bufferCapacity) const {
+		auto writer = TraceWriter{ buffer, 0, bufferCapacity };
+		auto first = head > capacity ? head - capacity : 0;
+		bool comma = false;
+
+		writer.put("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+		for (auto seq = first; seq < head; ++seq) {
+			auto const& evt = events[seq & (capacity - 1)];
+			if (evt.end < evt.begin)
+				continue;
+			if (comma)
+				writer.put(',');
+			comma = true;
+			writer.put("\n{\"name\":\"");
+			writer.put(evt.name);
+			writer.put("\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":");
+			writer.put_us(evt.begin);
+			writer.put(",\"dur\":");
+			writer.put_us(evt.end - evt.begin);
+			writer.put(",\"args\":{\"frame\":");
+			writer.put_u64(evt.frame);
+			writer.put(",\"depth\":");
+			writer.put_u64(evt.depth);
+			writer.put("}}");
+		}
+		writer.put("\n]}");
+
+		return writer.count;
+	}
+
+	struct ProfileZone {
+		u64 seq;
+
+		explicit ProfileZone(char const *name) : seq{ profiler.begin_zone(name) } {}
+		~ProfileZone() { profiler.end_zone(seq); }
+
+		ProfileZone(ProfileZone const&) = delete;
+		ProfileZone& operator=(ProfileZone const&) = delete;
+	};
+
+#define SHRUB_PROFILE_CONCAT_(a, b) a##b
+#define SHRUB_PROFILE_CONCAT(a, b) SHRUB_PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ::shrub::ProfileZone SHRUB_PROFILE_CONCAT(profileZone_, __LINE__){ name }
+#define PROFILE_FRAME_MARK() ::shrub::profiler.frame_mark()
+
+#else
+
+#define PROFILE_ZONE(name) do {} while (0)
+#define PROFILE_FRAME_MARK() do {} while (0)
+
+#endif
+
+}
@@ -0,0 +1,89 @@
+#include "program_cache.h"
+
+#include "profile.h"
+
+namespace shrub {
+
+	void ProgramCache::init(Allocator *allocator, i64 capacity) {
+		entries.reserve(allocator, capacity);
+		pendingCount = 0;
+	}
+
+	ProgramId ProgramCache::request(String vertSource, String fragSource) {
+		auto hash = hash_combine(hash_string(vertSource), hash_string(fragSource));
+
+		for (i64 i = 0; i < entries.count; ++i) {
+			if (entries[i].hash == hash)
+				return { static_cast<i32>(i) };
+		}
+
+		auto entry = ProgramEntry{};
+		entry.hash = hash;
+		entry.program = gl_create_program();
+		entry.vs = gl_create_shader(GL_VERTEX_SHADER);
+		entry.fs = gl_create_shader(GL_FRAGMENT_SHADER);
+		entry.status = GL_PROGRAM_STATUS_PENDING;
+
+		gl_shader_source(entry.vs, vertSource.data, vertSource.count);
+		gl_shader_source(entry.fs, fragSource.data, fragSource.count);
+
+		gl_compile_shader(entry.vs);
+		gl_compile_shader(entry.fs);
+
+		gl_attach_shader(entry.program, entry.vs);
+		gl_attach_shader(entry.program, entry.fs);
+
+		gl_link_program(entry.program);
+
+		++pendingCount;
+		push(&entries, entry);
+
+		return { static_cast<i32>(entries.count - 1) };
+	}
+
+	void ProgramCache::poll() {
+		if (!pendingCount)
+			return;
+
+		PROFILE_ZONE("program_poll");
+
+		for (i64 i = 0; i < entries.count; ++i) {
+			auto& entry = entries[i];
+			if (entry.status != GL_PROGRAM_STATUS_PENDING)
+				continue;
+
+			entry.status = gl_program_status(entry.program);
+			if (entry.status == GL_PROGRAM_STATUS_PENDING)
+				continue;
+
+			// The shaders stay attached until now so JS can report their info logs on failure
+			gl_detach_shader(entry.program, entry.vs);
+			gl_detach_shader(entry.program, entry.fs);
+			gl_delete_shader(entry.vs);
+			gl_delete_shader(entry.fs);
+			entry.vs = 0;
+			entry.fs = 0;
+
+			if (entry.status == GL_PROGRAM_STATUS_FAILED) {
+				gl_delete_program(entry.program);
+				entry.program = 0;
+			}
+
+			--pendingCount;
+		}
+	}
+
+	int ProgramCache::program(ProgramId id) const {
+		if (id.index < 0)
+			return 0;
+		auto const& entry = entries[id.index];
+		return entry.status == GL_PROGRAM_STATUS_READY ? entry.program : 0;
+	}
+
+	GLint ProgramCache::status(ProgramId id) const {
+		if (id.index < 0)
+			return GL_PROGRAM_STATUS_FAILED;
+		return entries[id.index].status;
+	}
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <oak_util/types.h>
+
+#include "web_gl.h"
+
+namespace shrub {
+
+	using namespace oak;
+
+	struct ProgramId {
+		i32 index = -1;
+	};
+
+	struct ProgramEntry {
+		u64 hash;
+		int program;
+		int vs;
+		int fs;
+		GLint status;
+	};
+
+	// Programs are compiled and linked on request but their status is only queried from poll, so the
+	// driver can work on every pending program in parallel instead of stalling on each one in turn.
+	struct ProgramCache {
+		Vector<ProgramEntry> entries;
+		i32 pendingCount = 0;
+
+		void init(Allocator *allocator, i64 capacity);
+
+		// Returns the cached program for these sources or starts building a new one
+		ProgramId request(String vertSource, String fragSource);
+
+		// Resolves the status of pending programs, cheap once nothing is pending
+		void poll();
+
+		// GL program handle once linked successfully, 0 while pending or failed
+		int program(ProgramId id) const;
+
+		GLint status(ProgramId id) const;
+	};
+
+}
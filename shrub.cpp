@@ -0,0 +1,461 @@
+#include "shrub.h"
+
+#include "profile.h"
+
+namespace shrub {
+
+	namespace {
+
+		f32 min_f32(f32 a, f32 b) {
+			return a < b ? a : b;
+		}
+
+		f32 max_f32(f32 a, f32 b) {
+			return a > b ? a : b;
+		}
+
+		u64 hash_f32(u64 hash, f32 value) {
+			u32 bits;
+			__builtin_memcpy(&bits, &value, sizeof(bits));
+			return hash_combine(hash, hash_int(bits));
+		}
+
+		// RGBA8 in memory order, read back by a normalized byte attribute
+		u32 pack_color(Vec4 color) {
+			f32 const channels[4] = { color.x, color.y, color.z, color.w };
+			u32 packed = 0;
+			for (i32 i = 0; i < 4; ++i) {
+				auto value = min_f32(max_f32(channels[i], 0.f), 1.f);
+				packed |= static_cast<u32>(value * 255.f + 0.5f) << (i * 8);
+			}
+			return packed;
+		}
+
+	}
+
+	void ElementTree::init(Allocator *allocator, i32 capacity) {
+		elements = allocate<Element>(allocator, capacity);
+		parents = allocate<ElementIndex>(allocator, capacity);
+		firstChildren = allocate<ElementIndex>(allocator, capacity);
+		lastChildren = allocate<ElementIndex>(allocator, capacity);
+		siblings = allocate<ElementIndex>(allocator, capacity);
+		positions = allocate<Vec2>(allocator, capacity);
+		extents = allocate<Vec2>(allocator, capacity);
+		clipRects = allocate<ClipRect>(allocator, capacity);
+		clipParents = allocate<ElementIndex>(allocator, capacity);
+		visible = allocate<bool>(allocator, capacity);
+
+		elementCapacity = capacity;
+	}
+
+	void ElementTree::begin_ui() {
+		PROFILE_ZONE("begin_ui");
+		elementCount = 0;
+	}
+
+	void ElementTree::end_ui() {
+		layout();
+		transform();
+	}
+
+	ElementIndex ElementTree::push_element(ElementIndex parent, Element const& elem) {
+		assert(elementCount < elementCapacity);
+
+		auto result = ElementIndex{ elementCount++ };
+		elements[result.index] = elem;
+		parents[result.index] = parent;
+		firstChildren[result.index] = { -1 };
+		lastChildren[result.index] = { -1 };
+		siblings[result.index] = { -1 };
+
+		if (parent.index != -1) {
+			if (lastChildren[parent.index].index != -1)
+				siblings[lastChildren[parent.index].index] = result;
+			lastChildren[parent.index] = result;
+			if (firstChildren[parent.index].index == -1)
+				firstChildren[parent.index] = result;
+		}
+
+		return result;
+	}
+
+	void ElementTree::layout() {
+		PROFILE_ZONE("layout");
+
+		for (i32 i = 0; i < elementCount; ++i) {
+		}
+
+	}
+
+	void ElementTree::transform() {
+		PROFILE_ZONE("transform");
+		for (i32 i = 0; i < elementCount; ++i) {
+			auto parent = parents[i];
+			auto parentOrigin = Vec2{};
+			auto clip = unboundedClip;
+			auto clipParent = ElementIndex{ -1 };
+			if (parent.index != -1) {
+				parentOrigin = positions[parent.index];
+				clip = clipRects[parent.index];
+				clipParent = clipParents[parent.index];
+				if (elements[parent.index].flags & Element::CLIP_CHILDREN_BIT) {
+					clip = child_clip_rect(parent);
+					clipParent = parent;
+				}
+			}
+
+			positions[i] = parentOrigin + elements[i].pos;
+			extents[i] = elements[i].extent;
+			clipRects[i] = clip;
+			clipParents[i] = clipParent;
+		}
+	}
+
+	void ElementTree::cull(ClipRect viewport_) {
+		PROFILE_ZONE("cull");
+		viewport = viewport_;
+		// A culled element that clips passes an empty clip rect on, which takes its whole subtree with it
+		for (i32 i = 0; i < elementCount; ++i) {
+			auto overlap = intersect(intersect(clipRects[i], viewport), { positions[i], positions[i] + extents[i] });
+			visible[i] = overlap.min.x < overlap.max.x && overlap.min.y < overlap.max.y;
+		}
+	}
+
+	ElementIndex ElementTree::clip_source(ElementIndex index) const {
+		auto const& clip = clipRects[index.index];
+		auto min = positions[index.index];
+		auto max = min + extents[index.index];
+		auto inside = min.x >= clip.min.x && min.y >= clip.min.y && max.x <= clip.max.x && max.y <= clip.max.y;
+		return inside ? ElementIndex{ -1 } : clipParents[index.index];
+	}
+
+	ClipRect ElementTree::child_clip_rect(ElementIndex index) const {
+		auto pos = positions[index.index];
+		return intersect(clipRects[index.index], { pos, pos + extents[index.index] });
+	}
+
+	ElementIndex ElementTree::hit_test(Vec2 point) const {
+		PROFILE_ZONE("hit_test");
+		// Children are pushed after their parents so the last hit is the topmost. Clipped away parts of an
+		// element can't be hit, they aren't drawn.
+		for (i32 i = elementCount - 1; i >= 0; --i) {
+			auto const& pos = positions[i];
+			auto const& extent = elements[i].extent;
+			auto const& clip = clipRects[i];
+			if (point.x >= pos.x && point.x <= pos.x + extent.x
+					&& point.y >= pos.y && point.y <= pos.y + extent.y
+					&& point.x >= clip.min.x && point.x <= clip.max.x
+					&& point.y >= clip.min.y && point.y <= clip.max.y)
+				return { i };
+		}
+		return { -1 };
+	}
+
+	Element* ElementTree::operator[](ElementIndex index) {
+		return elements + index.index;
+	}
+
+	void write_rectangle(f32 *out, Vec2 pos, Vec2 extent, f32 depth, Vec4 color) {
+
+		const f32 rectangle[rectangleFloats] = {
+			pos.x           , pos.y           , depth, color.x, color.y, color.z, color.w,
+			pos.x + extent.x, pos.y           , depth, color.x, color.y, color.z, color.w,
+			pos.x + extent.x, pos.y + extent.y, depth, color.x, color.y, color.z, color.w,
+			pos.x + extent.x, pos.y + extent.y, depth, color.x, color.y, color.z, color.w,
+			pos.x           , pos.y + extent.y, depth, color.x, color.y, color.z, color.w,
+			pos.x           , pos.y           , depth, color.x, color.y, color.z, color.w,
+		};
+
+		for (i32 i = 0; i < rectangleFloats; ++i)
+			out[i] = rectangle[i];
+	}
+
+	void write_textured_rectangle(f32 *out, Vec2 pos, Vec2 extent, f32 depth, Vec4 uvRect) {
+
+		const f32 rectangle[rectangleFloats] = {
+			pos.x           , pos.y           , depth, uvRect.x, uvRect.y, 0.f, 0.f,
+			pos.x + extent.x, pos.y           , depth, uvRect.z, uvRect.y, 0.f, 0.f,
+			pos.x + extent.x, pos.y + extent.y, depth, uvRect.z, uvRect.w, 0.f, 0.f,
+			pos.x + extent.x, pos.y + extent.y, depth, uvRect.z, uvRect.w, 0.f, 0.f,
+			pos.x           , pos.y + extent.y, depth, uvRect.x, uvRect.w, 0.f, 0.f,
+			pos.x           , pos.y           , depth, uvRect.x, uvRect.y, 0.f, 0.f,
+		};
+
+		for (i32 i = 0; i < rectangleFloats; ++i)
+			out[i] = rectangle[i];
+	}
+
+	void write_shape(f32 *out, Vec2 pos, Vec2 extent, f32 depth, Vec4 color, DrawShape const& shape, ClipRect const& clip) {
+		// Infinite clip edges would turn into NaN in the shader's comparisons on some drivers
+		constexpr f32 far = 1e30f;
+		auto clipMin = Vec2{ clip.min.x > -far ? clip.min.x : -far, clip.min.y > -far ? clip.min.y : -far };
+		auto clipMax = Vec2{ clip.max.x < far ? clip.max.x : far, clip.max.y < far ? clip.max.y : far };
+
+		if (shape.shadowBlur > 0.f)
+			pos = pos + shape.shadowOffset;
+
+		const f32 instance[shapeVertices * vertexFloats] = {
+			pos.x, pos.y, extent.x, extent.y,
+			color.x, color.y, color.z, color.w,
+			shape.radii.x, shape.radii.y, shape.radii.z, shape.radii.w,
+			shape.borderColor.x, shape.borderColor.y, shape.borderColor.z, shape.borderColor.w,
+			clipMin.x, clipMin.y, clipMax.x, clipMax.y,
+			depth, shape.borderWidth, shape.shadowBlur,
+		};
+
+		for (i32 i = 0; i < shapeVertices * vertexFloats; ++i)
+			out[i] = instance[i];
+	}
+
+	u64 hash_shape(DrawShape const& shape) {
+		f32 const values[] = {
+			shape.radii.x, shape.radii.y, shape.radii.z, shape.radii.w,
+			shape.borderColor.x, shape.borderColor.y, shape.borderColor.z, shape.borderColor.w,
+			shape.borderWidth, shape.shadowBlur, shape.shadowOffset.x, shape.shadowOffset.y,
+		};
+		u64 hash = 0;
+		for (auto value : values) {
+			u32 bits;
+			__builtin_memcpy(&bits, &value, sizeof(bits));
+			hash = hash_combine(hash, hash_int(bits));
+		}
+		return hash;
+	}
+
+	ClipRect shape_bounds(DrawShape const& shape, Vec2 pos, Vec2 extent) {
+		if (shape.shadowBlur <= 0.f)
+			return { pos, pos + extent };
+
+		auto spread = 3.f * shape.shadowBlur;
+		auto min = Vec2{ pos.x + shape.shadowOffset.x - spread, pos.y + shape.shadowOffset.y - spread };
+		return { min, { min.x + extent.x + 2.f * spread, min.y + extent.y + 2.f * spread } };
+	}
+
+	DrawPolyline make_polyline(
+			Vec2 const *points, i32 pointCount, f32 width, LineJoin join, LineCap cap, f32 miterLimit) {
+		auto line = DrawPolyline{ points, pointCount, width, join, cap, miterLimit, 0, {} };
+
+		u64 hash = hash_int(static_cast<u64>(pointCount) << 16 | static_cast<u64>(join) << 8 | static_cast<u64>(cap));
+		hash = hash_f32(hash, width);
+		hash = hash_f32(hash, miterLimit);
+
+		auto min = pointCount ? points[0] : Vec2{};
+		auto max = min;
+		for (i32 i = 0; i < pointCount; ++i) {
+			hash = hash_f32(hash, points[i].x);
+			hash = hash_f32(hash, points[i].y);
+			min = { min_f32(min.x, points[i].x), min_f32(min.y, points[i].y) };
+			max = { max_f32(max.x, points[i].x), max_f32(max.y, points[i].y) };
+		}
+		line.hash = hash;
+
+		// Miter tips reach out to the limit, square cap corners to the diagonal, plus the antialiased pixel
+		auto reach = max_f32(join == LineJoin::MITER ? miterLimit : 1.f, cap == LineCap::SQUARE ? 1.415f : 1.f);
+		reach = reach * width * 0.5f + 1.f;
+		line.bounds = { { min.x - reach, min.y - reach }, { max.x + reach, max.y + reach } };
+		return line;
+	}
+
+	void write_polyline(f32 *out, Vec2 pos, f32 depth, Vec4 color, DrawPolyline const& line) {
+		auto packedColor = pack_color(color);
+		auto style = static_cast<f32>(static_cast<u32>(line.join) | static_cast<u32>(line.cap) << 2);
+
+		auto count = polyline_vertices(line);
+		for (i32 i = 0; i < vertexFloats; ++i)
+			out[i] = 0.f;
+		i32 written = 1;
+		for (i32 i = 0; i < line.pointCount; ++i) {
+			// A zero length segment has no direction to draw its neighbours' joins from
+			if (i && line.points[i].x == line.points[i - 1].x && line.points[i].y == line.points[i - 1].y)
+				continue;
+			const f32 point[vertexFloats] = {
+				pos.x + line.points[i].x, pos.y + line.points[i].y, depth, 0.f, line.width, style, line.miterLimit,
+			};
+			auto slot = out + written * vertexFloats;
+			for (i32 j = 0; j < vertexFloats; ++j)
+				slot[j] = point[j];
+			// The bits can spell a NaN, so they're never loaded as a float
+			__builtin_memcpy(slot + 3, &packedColor, sizeof(packedColor));
+			++written;
+		}
+		for (i32 i = written * vertexFloats; i < count * vertexFloats; ++i)
+			out[i] = 0.f;
+	}
+
+	Vec2 text_origin(TextRun const& run, Vec2 pos, Vec2 extent) {
+		return { pos.x, pos.y + (extent.y - run.ascent - run.descent) * 0.5f + run.descent };
+	}
+
+	ElementId command_id(ElementTree const& tree, DrawCommand const& drawCmd) {
+		auto id = tree.elements[drawCmd.elementIndex.index].id;
+		return drawCmd.ordinal ? ElementId{ hash_combine(id.id, hash_int(drawCmd.ordinal)) } : id;
+	}
+
+	ClipRect command_bounds(DrawTables const& tables, DrawCommand const& drawCmd, Vec2 pos, Vec2 extent) {
+		if (drawCmd.shape != -1)
+			return shape_bounds(tables.shapes[drawCmd.shape], pos, extent);
+		if (drawCmd.text != -1) {
+			auto const& run = tables.texts[drawCmd.text];
+			auto origin = text_origin(run, pos, extent);
+			return { origin + run.bounds.min, origin + run.bounds.max };
+		}
+		if (drawCmd.line != -1) {
+			auto const& line = tables.lines[drawCmd.line];
+			return { pos + line.bounds.min, pos + line.bounds.max };
+		}
+		return { pos, pos + extent };
+	}
+
+	u64 hash_command_content(DrawTables const& tables, DrawCommand const& drawCmd) {
+		if (drawCmd.shape != -1)
+			return hash_shape(tables.shapes[drawCmd.shape]);
+		// Glyphs still uploading are left out, the count changes when they arrive
+		if (drawCmd.text != -1) {
+			auto const& run = tables.texts[drawCmd.text];
+			return hash_combine(run.hash, hash_int(static_cast<u64>(run.glyphCount)));
+		}
+		if (drawCmd.line != -1)
+			return tables.lines[drawCmd.line].hash;
+		return 0;
+	}
+
+	void write_glyph(f32 *out, Vec2 pos, Vec2 extent, f32 depth, Vec4 color, Vec4 uvRect) {
+		const f32 instance[glyphVertices * vertexFloats] = {
+			pos.x, pos.y, extent.x, extent.y,
+			uvRect.x, uvRect.y, uvRect.z, uvRect.w,
+			color.x, color.y, color.z, color.w,
+			depth,
+		};
+
+		for (i32 i = 0; i < glyphVertices * vertexFloats; ++i)
+			out[i] = instance[i];
+	}
+
+	void push_rectangle(GLintptr *offset, Vec2 pos, Vec2 extent, f32 depth, Vec4 color) {
+		f32 rectangle[rectangleFloats];
+		write_rectangle(rectangle, pos, extent, depth, color);
+
+		gl_buffer_sub_data(GL_COPY_READ_BUFFER, *offset, rectangle, sizeof(rectangle));
+		*offset += sizeof(rectangle);
+	}
+
+	void ClipPlan::plan(Allocator *allocator, ElementTree const& tree, DrawCommand const *commands, i64 count) {
+		PROFILE_ZONE("clip_plan");
+		runs = allocate<i32>(allocator, tree.elementCount);
+		for (i32 i = 0; i < tree.elementCount; ++i)
+			runs[i] = 0;
+
+		auto last = ElementIndex{ -1 };
+		for (i64 i = 0; i < count; ++i) {
+			auto clip = tree.clip_source(commands[i].elementIndex);
+			if (clip.index != -1 && clip.index != last.index)
+				++runs[clip.index];
+			last = clip;
+		}
+	}
+
+	ElementIndex ClipPlan::scissor_clip(ElementTree const& tree, ElementIndex index) const {
+		auto clip = tree.clip_source(index);
+		return clip.index != -1 && runs[clip.index] <= maxScissorRuns ? clip : ElementIndex{ -1 };
+	}
+
+	ElementIndex ClipPlan::geometry_clip(ElementTree const& tree, ElementIndex index) const {
+		auto clip = tree.clip_source(index);
+		return clip.index != -1 && runs[clip.index] > maxScissorRuns ? clip : ElementIndex{ -1 };
+	}
+
+	i64 cull_hidden_commands(
+			ElementTree const& tree, DrawTables const& tables, DrawCommand const *commands, i64 count, DrawCommand *out) {
+		PROFILE_ZONE("draw_cull");
+		i64 kept = 0;
+		for (i64 i = 0; i < count; ++i) {
+			auto const& drawCmd = commands[i];
+			auto index = drawCmd.elementIndex.index;
+			auto visible = tree.visible[index];
+			// A plain rectangle covers its element exactly
+			if (command_primitive(drawCmd) != BatchPrimitive::TRIANGLES) {
+				auto bounds = command_bounds(tables, drawCmd, tree.positions[index], tree.extents[index]);
+				auto overlap = intersect(intersect(tree.clipRects[index], tree.viewport), bounds);
+				visible = overlap.min.x < overlap.max.x && overlap.min.y < overlap.max.y;
+			}
+			if (visible)
+				out[kept++] = drawCmd;
+		}
+		return kept;
+	}
+
+	void number_draw_commands(Allocator *allocator, ElementTree const& tree, DrawCommand *commands, i64 count) {
+		auto counts = allocate<u32>(allocator, tree.elementCount);
+		for (i32 i = 0; i < tree.elementCount; ++i)
+			counts[i] = 0;
+		for (i64 i = 0; i < count; ++i)
+			commands[i].ordinal = counts[commands[i].elementIndex.index]++;
+	}
+
+	void sort_draw_commands(DrawCommand *commands, DrawCommand *scratch, i64 count) {
+		PROFILE_ZONE("draw_sort");
+		if (count < 2)
+			return;
+
+		u32 histograms[8][256] = {};
+		for (i64 i = 0; i < count; ++i) {
+			auto key = commands[i].sortKey;
+			for (i32 pass = 0; pass < 8; ++pass)
+				++histograms[pass][(key >> (pass * 8)) & 0xff];
+		}
+
+		auto src = commands;
+		auto dst = scratch;
+		for (i32 pass = 0; pass < 8; ++pass) {
+			auto& histogram = histograms[pass];
+			// Every key shares this byte, the pass would be an identity copy
+			if (histogram[(src[0].sortKey >> (pass * 8)) & 0xff] == count)
+				continue;
+
+			u32 sum = 0;
+			for (auto& bucket : histogram) {
+				auto n = bucket;
+				bucket = sum;
+				sum += n;
+			}
+
+			for (i64 i = 0; i < count; ++i) {
+				auto byte = (src[i].sortKey >> (pass * 8)) & 0xff;
+				dst[histogram[byte]++] = src[i];
+			}
+
+			auto tmp = src;
+			src = dst;
+			dst = tmp;
+		}
+
+		if (src != commands) {
+			for (i64 i = 0; i < count; ++i)
+				commands[i] = src[i];
+		}
+	}
+
+	i64 push_draw_commands(
+			GLintptr *offset, ElementTree const& tree, DrawCommand const *commands, i64 count, DrawBatch *batches) {
+		PROFILE_ZONE("vertex_gen");
+		i64 batchCount = 0;
+		for (i64 i = 0; i < count; ++i) {
+			auto const& drawCmd = commands[i];
+			auto program = sort_key_program(drawCmd.sortKey);
+			auto texture = sort_key_texture(drawCmd.sortKey);
+			auto translucent = sort_key_translucent(drawCmd.sortKey);
+			if (!batchCount || batches[batchCount - 1].program != program || batches[batchCount - 1].texture != texture
+					|| batches[batchCount - 1].translucent != translucent) {
+				auto first = static_cast<GLint>(*offset / static_cast<GLintptr>(vertexFloats * sizeof(f32)));
+				batches[batchCount++] = { program, texture, translucent, { -1 }, BatchPrimitive::TRIANGLES, first, 0 };
+			}
+
+			auto const& pos = tree.positions[drawCmd.elementIndex.index];
+			auto const& elem = tree.elements[drawCmd.elementIndex.index];
+			push_rectangle(offset, pos, elem.extent, element_depth(drawCmd.elementIndex), drawCmd.color);
+			batches[batchCount - 1].count += 6;
+		}
+		return batchCount;
+	}
+
+}
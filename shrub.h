@@ -0,0 +1,397 @@
+#pragma once
+
+#include <oak_util/types.h>
+#include <oak_math/math.h>
+
+#include "web_gl.h"
+
+namespace shrub {
+
+	using namespace oak;
+
+	struct ElementIndex {
+		i32 index = 0;
+	};
+
+	struct ElementId {
+		u64 id = 0;
+	};
+
+	struct ElementPadding {
+		f32 right = 0.f;
+		f32 top = 0.f;
+		f32 left = 0.f;
+		f32 bottom = 0.f;
+	};
+
+	struct Element {
+
+		enum FlagBits : u32 {
+			LAYOUT_AXIS_MAJOR_MASK = 0x3,
+			LAYOUT_AXIS_MINOR_MASK = 0xC,
+			USE_AUTO_LAYOUT_BIT = 0x10,
+			// The subtree is rendered into a texture and composited until its content changes, see LayerCache
+			CACHE_LAYER_BIT = 0x20,
+			// Descendants are clipped to this element's bounds
+			CLIP_CHILDREN_BIT = 0x40,
+		};
+
+		ElementId id;
+		Vec2 pos;
+		Vec2 alignment;
+		Vec2 extent;
+		ElementPadding padding;
+		u32 flags = 0;
+
+		static constexpr Element from_id(ElementId id) {
+			auto result = Element{};
+			result.id = id;
+			return result;
+		}
+
+		constexpr i32 major_axis() const {
+			return (flags & LAYOUT_AXIS_MAJOR_MASK);
+		}
+
+		constexpr i32 minor_axis() const {
+			return (flags & LAYOUT_AXIS_MINOR_MASK) >> 2;
+		}
+	};
+
+	struct ClipRect {
+		Vec2 min;
+		Vec2 max;
+	};
+
+	constexpr ClipRect unboundedClip = {
+		{ -__builtin_huge_valf(), -__builtin_huge_valf() },
+		{ __builtin_huge_valf(), __builtin_huge_valf() },
+	};
+
+	// Empty results come out with min above max
+	constexpr ClipRect intersect(ClipRect a, ClipRect b) {
+		return {
+			{ a.min.x > b.min.x ? a.min.x : b.min.x, a.min.y > b.min.y ? a.min.y : b.min.y },
+			{ a.max.x < b.max.x ? a.max.x : b.max.x, a.max.y < b.max.y ? a.max.y : b.max.y },
+		};
+	}
+
+	struct ElementConstraints {
+		ElementIndex index;
+		Vec2 minExtent;
+		Vec2 maxExtent;
+	};
+
+	struct ElementTree {
+
+		Element *elements = nullptr;
+		ElementIndex *parents = nullptr;
+		ElementIndex *firstChildren = nullptr;
+		ElementIndex *lastChildren = nullptr;
+		ElementIndex *siblings = nullptr;
+		Vec2 *positions = nullptr;
+		// Copied from the elements in transform so the passes after it stay on dense arrays
+		Vec2 *extents = nullptr;
+		// Intersection of the bounds of every ancestor that clips, unboundedClip when there are none
+		ClipRect *clipRects = nullptr;
+		// Nearest ancestor that clips, -1 when there is none
+		ElementIndex *clipParents = nullptr;
+		bool *visible = nullptr;
+		// Set by cull
+		ClipRect viewport = unboundedClip;
+		i32 elementCount = 0;
+		i32 elementCapacity = 0;
+
+		ElementConstraints *constraints = nullptr;
+		i32 constraintCount = 0;
+		i32 constraintCapacity = 0;
+
+		void init(Allocator *allocator, i32 capacity);
+
+		void begin_ui();
+		void end_ui();
+
+		ElementIndex push_element(ElementIndex parent, Element const& widget);
+
+		void layout();
+		void transform();
+		// Marks elements whose bounds miss the viewport or their clip rect as not visible, after transform
+		void cull(ClipRect viewport_);
+
+		// Clip parent of an element that crosses the edge of its clip rect, -1 when it's fully inside
+		ElementIndex clip_source(ElementIndex index) const;
+		// Rect the children of an element with CLIP_CHILDREN_BIT are clipped to
+		ClipRect child_clip_rect(ElementIndex index) const;
+
+		// Topmost element containing point inside its clip rect, or -1. After transform.
+		ElementIndex hit_test(Vec2 point) const;
+
+		Element* operator[](ElementIndex index);
+	};
+
+	// Sort keys order draws by layer, then opaque before translucent. Opaque draws group by program
+	// and texture and keep depth as a tiebreak, inverted so they go front to back and the depth test
+	// rejects what they cover. Translucent draws must stay in depth order, so depth goes above the
+	// state bits for them.
+	//
+	//   63       56  55   54                                                  3
+	//   | layer 8 | T |  opaque: program 12 | texture 16 | ~depth 24         | 0 0 0
+	//                   translucent: depth 24 | program 12 | texture 16      |
+	enum : u64 {
+		SORT_KEY_LAYER_BITS = 8,
+		SORT_KEY_PROGRAM_BITS = 12,
+		SORT_KEY_TEXTURE_BITS = 16,
+		SORT_KEY_DEPTH_BITS = 24,
+
+		SORT_KEY_LAYER_SHIFT = 56,
+		SORT_KEY_TRANSLUCENT_BIT = 1ull << 55,
+	};
+
+	constexpr u64 make_sort_key(u32 layer, bool translucent, u32 program, u32 texture, u32 depth) {
+		auto l = static_cast<u64>(layer & ((1u << SORT_KEY_LAYER_BITS) - 1));
+		auto p = static_cast<u64>(program & ((1u << SORT_KEY_PROGRAM_BITS) - 1));
+		auto t = static_cast<u64>(texture & ((1u << SORT_KEY_TEXTURE_BITS) - 1));
+		auto d = static_cast<u64>(depth & ((1u << SORT_KEY_DEPTH_BITS) - 1));
+		return translucent
+			? l << SORT_KEY_LAYER_SHIFT | SORT_KEY_TRANSLUCENT_BIT | d << 31 | p << 19 | t << 3
+			: l << SORT_KEY_LAYER_SHIFT | p << 43 | t << 27 | (d ^ ((1u << SORT_KEY_DEPTH_BITS) - 1)) << 3;
+	}
+
+	constexpr u32 sort_key_program(u64 key) {
+		auto shift = key & SORT_KEY_TRANSLUCENT_BIT ? 19 : 43;
+		return static_cast<u32>(key >> shift) & ((1u << SORT_KEY_PROGRAM_BITS) - 1);
+	}
+
+	constexpr u32 sort_key_texture(u64 key) {
+		auto shift = key & SORT_KEY_TRANSLUCENT_BIT ? 3 : 27;
+		return static_cast<u32>(key >> shift) & ((1u << SORT_KEY_TEXTURE_BITS) - 1);
+	}
+
+	constexpr bool sort_key_translucent(u64 key) {
+		return key & SORT_KEY_TRANSLUCENT_BIT;
+	}
+
+	// Clip space z for an element, later elements in the tree are nearer. Opaque draws are depth tested
+	// against this rather than their sort key, so a higher sort key layer only lifts translucent draws.
+	// The step is coarser than a 24 bit depth buffer needs so float rounding can't reorder neighbours.
+	constexpr f32 element_depth(ElementIndex index) {
+		return 1.f - static_cast<f32>(index.index + 1) * (1.f / static_cast<f32>(1 << 22));
+	}
+
+	// Rounded rectangle drawn by the shape program, a circle is a square with every radius at half its side.
+	// Edges are antialiased, so shape commands belong in the translucent pass.
+	struct DrawShape {
+		// Corners in the order write_rectangle emits them: min x min y, max x min y, max x max y, min x max y
+		Vec4 radii;
+		Vec4 borderColor;
+		// Inset from the edge, 0 for none
+		f32 borderWidth = 0.f;
+		// Gaussian standard deviation. Above 0 the shape draws its blurred silhouette, moved by shadowOffset, in
+		// the command's color and without a border. Give a shadow its own element pushed before the one
+		// casting it, element ids key the cached geometry and damage.
+		f32 shadowBlur = 0.f;
+		Vec2 shadowOffset;
+	};
+
+	u64 hash_shape(DrawShape const& shape);
+
+	// Area a shape can draw to, shadows reach past their element by their offset and three deviations
+	ClipRect shape_bounds(DrawShape const& shape, Vec2 pos, Vec2 extent);
+
+	enum class LineJoin : u8 {
+		MITER,
+		ROUND,
+		BEVEL,
+	};
+
+	enum class LineCap : u8 {
+		BUTT,
+		SQUARE,
+		ROUND,
+	};
+
+	// Connected segments through points relative to the element's position, stroked width wide in the command's
+	// color. Points must stay valid until the frame is drawn. Edges are antialiased, so line commands belong in
+	// the translucent pass.
+	struct DrawPolyline {
+		Vec2 const *points;
+		i32 pointCount;
+		f32 width;
+		LineJoin join;
+		LineCap cap;
+		// Miter joins longer than this many widths are beveled instead, as in SVG
+		f32 miterLimit;
+		// Of everything above, worked out once by make_polyline so damage, layers and geometry don't each walk the
+		// points. A line whose points don't change can be kept and pushed again every frame.
+		u64 hash;
+		// Area the stroke can draw to, relative to the element's position
+		ClipRect bounds;
+	};
+
+	DrawPolyline make_polyline(
+			Vec2 const *points, i32 pointCount, f32 width, LineJoin join, LineCap cap, f32 miterLimit = 4.f);
+
+	// Relative to the baseline origin of its run, y up
+	struct GlyphQuad {
+		Vec2 pos;
+		Vec2 extent;
+		Vec4 uvRect;
+	};
+
+	// A line of text laid out by TextRunCache
+	struct TextRun {
+		// Font, size and string, equal hashes look the same wherever their glyphs are in the atlas
+		u64 hash;
+		// Glyphs with ink, resolved against atlas generation
+		GlyphQuad const *glyphs;
+		i32 glyphCount;
+		u32 generation;
+		// Advance box and glyph ink relative to the baseline origin
+		ClipRect bounds;
+		f32 ascent;
+		f32 descent;
+	};
+
+	// Baseline origin of a run drawn in an element, left aligned and centered on the font's ascent and descent
+	Vec2 text_origin(TextRun const& run, Vec2 pos, Vec2 extent);
+
+	// Commands with a texture in their sort key draw a textured quad, color then holds its uv rectangle
+	// as u0, v0, u1, v1. Text commands draw their run's glyphs in color from the glyph atlas texture.
+	struct DrawCommand {
+		ElementIndex elementIndex;
+		Vec4 color;
+		u64 sortKey = 0;
+		// Index into the frame's DrawShape table, -1 for a plain rectangle
+		i32 shape = -1;
+		// Index into TextRunCache::runs, -1 for none
+		i32 text = -1;
+		// Index into the frame's DrawPolyline table, -1 for none
+		i32 line = -1;
+		// Commands before this one on the same element, set by number_draw_commands
+		u32 ordinal = 0;
+	};
+
+	// Element id and ordinal of a command, what its damage and retained geometry are keyed on
+	ElementId command_id(ElementTree const& tree, DrawCommand const& drawCmd);
+
+	// What the shape, text and line indices of draw commands point into, any may be null when no command
+	// uses it
+	struct DrawTables {
+		DrawShape const *shapes = nullptr;
+		TextRun const *texts = nullptr;
+		DrawPolyline const *lines = nullptr;
+	};
+
+	// Canvas area a command can draw to
+	ClipRect command_bounds(DrawTables const& tables, DrawCommand const& drawCmd, Vec2 pos, Vec2 extent);
+
+	// Hash of the shape, text or line a command draws beyond its rectangle, 0 for a plain rectangle
+	u64 hash_command_content(DrawTables const& tables, DrawCommand const& drawCmd);
+
+	enum class BatchPrimitive : u8 {
+		TRIANGLES,
+		// Instances of shapeVertices vertex slots each, drawn as one quad per instance
+		SHAPES,
+		// Instances of glyphVertices vertex slots each
+		GLYPHS,
+		// Segment instances reading four consecutive vertex slots each, see write_polyline
+		LINES,
+	};
+
+	constexpr BatchPrimitive command_primitive(DrawCommand const& drawCmd) {
+		return drawCmd.shape != -1 ? BatchPrimitive::SHAPES
+			: drawCmd.text != -1 ? BatchPrimitive::GLYPHS
+			: drawCmd.line != -1 ? BatchPrimitive::LINES
+			: BatchPrimitive::TRIANGLES;
+	}
+
+	// Consecutive vertices sharing a program, texture and clip, program and texture are the indices from the
+	// sort key
+	struct DrawBatch {
+		u32 program;
+		u32 texture;
+		// Drawn with depth writes off
+		bool translucent;
+		// Element whose clip rect the batch is scissored to, -1 for none
+		ElementIndex clip;
+		BatchPrimitive primitive;
+		GLint first;
+		GLsizei count;
+	};
+
+	// Chooses how commands crossing their clip rect are clipped this frame. Scissoring splits a batch at
+	// every change of clip, so a clip whose commands the sort scattered over many runs has its commands'
+	// geometry cut to the clip rect instead.
+	struct ClipPlan {
+		static constexpr i32 maxScissorRuns = 4;
+
+		// Runs of commands scissored to each clip parent, indexed by element
+		i32 *runs = nullptr;
+
+		void plan(Allocator *allocator, ElementTree const& tree, DrawCommand const *commands, i64 count);
+
+		// Element to scissor the command to, -1 for none
+		ElementIndex scissor_clip(ElementTree const& tree, ElementIndex index) const;
+		// Element whose clip rect the command's geometry is cut to, -1 for none
+		ElementIndex geometry_clip(ElementTree const& tree, ElementIndex index) const;
+	};
+
+	// Keeps the commands that reach the viewport inside their element's clip rect, in order, after
+	// ElementTree::cull. Shapes, text and lines are tested on their own bounds since they can overflow
+	// their element. out may alias commands. Returns the number of commands kept.
+	i64 cull_hidden_commands(
+		ElementTree const& tree, DrawTables const& tables, DrawCommand const *commands, i64 count, DrawCommand *out);
+
+	// Numbers the commands of each element in order, so an element can draw several. Run it before culling
+	// and the sort, the push order is what stays the same from frame to frame.
+	void number_draw_commands(Allocator *allocator, ElementTree const& tree, DrawCommand *commands, i64 count);
+
+	// Stable LSD radix sort on sortKey, passes where every key has the same byte are skipped.
+	// scratch must hold count commands, the result ends up in commands.
+	void sort_draw_commands(DrawCommand *commands, DrawCommand *scratch, i64 count);
+
+	// Interleaved vec3 position and vec4 color
+	constexpr i32 vertexFloats = 7;
+	constexpr i32 rectangleFloats = 6 * vertexFloats;
+
+	// Two triangles at the clip space depth given by element_depth
+	void write_rectangle(f32 *out, Vec2 pos, Vec2 extent, f32 depth, Vec4 color);
+
+	// Same layout with the uv rectangle spread over the corners in place of the color
+	void write_textured_rectangle(f32 *out, Vec2 pos, Vec2 extent, f32 depth, Vec4 uvRect);
+
+	void push_rectangle(GLintptr *offset, Vec2 pos, Vec2 extent, f32 depth, Vec4 color);
+
+	// Vertex slots one shape instance takes in vertex storage
+	constexpr i32 shapeVertices = 4;
+
+	// One shape instance: vec4 rect (pos, extent), vec4 color, vec4 radii, vec4 border color,
+	// vec4 clip rect (min, max), vec2 depth and border width, then padding. Fragments outside clip are
+	// discarded, pass unboundedClip when the shape is scissored or unclipped.
+	void write_shape(f32 *out, Vec2 pos, Vec2 extent, f32 depth, Vec4 color, DrawShape const& shape, ClipRect const& clip);
+
+	// Vertex slots one glyph instance takes in vertex storage
+	constexpr i32 glyphVertices = 2;
+
+	// One glyph instance: vec4 rect (pos, extent), vec4 uv rect, vec4 color, depth, then padding
+	void write_glyph(f32 *out, Vec2 pos, Vec2 extent, f32 depth, Vec4 color, Vec4 uvRect);
+
+	// Vertex slots a polyline takes in vertex storage
+	constexpr i32 polyline_vertices(DrawPolyline const& line) {
+		return line.pointCount + 2;
+	}
+
+	// One point per vertex slot: vec2 position, depth, RGBA8 color, width, join and cap, miter limit. A zero
+	// slot on either side ends the line, so the instance of each segment reads the slots of its endpoints and
+	// of the points before and after them, and draws its joins or caps from those. Repeated points are dropped
+	// and the slots they leave at the end are zero too.
+	void write_polyline(f32 *out, Vec2 pos, f32 depth, Vec4 color, DrawPolyline const& line);
+
+	// Writes the geometry for each command into GL_COPY_READ_BUFFER starting at offset, shapes, text and lines are
+	// drawn as plain rectangles. Adjacent commands with the same program, texture and translucency are merged into
+	// one batch, batches must hold count entries.
+	// Returns the number of batches written.
+	i64 push_draw_commands(
+			GLintptr *offset, ElementTree const& tree, DrawCommand const *commands, i64 count, DrawBatch *batches);
+
+}
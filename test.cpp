@@ -1,8 +1,66 @@
 #include <stdbool.h>
 #include <oak_util/types.h>
 
-#define SHRUB_API extern "C"
+using namespace oak;
 
-SHRUB_API iptr add(iptr a, iptr b) {
+// Probes for the cost of crossing the JS/wasm boundary, driven by bench.js
+
+#define WASM_IMPORT(module, name) extern "C" __attribute__((import_module(#module), import_name(#name)))
+#define WASM_EXPORT(name) extern "C" __attribute__((export_name(#name)))
+
+WASM_IMPORT(bench, scalar) void bench_scalar(i32 a, i32 b);
+WASM_IMPORT(bench, byteView) void bench_byte_view(void const *data, usize length);
+WASM_IMPORT(bench, cachedView) void bench_cached_view(void const *data, usize length);
+WASM_IMPORT(bench, string) void bench_string(char const *str, usize length);
+WASM_IMPORT(bench, glArrow) void bench_gl_arrow(f32 r, f32 g, f32 b, f32 a);
+WASM_IMPORT(bench, glBound) void bench_gl_bound(f32 r, f32 g, f32 b, f32 a);
+
+namespace {
+
+	constexpr usize payloadCapacity = 1 << 20;
+	char payload[payloadCapacity];
+
+}
+
+WASM_EXPORT(add) iptr add(iptr a, iptr b) {
 	return a*a + b;
 }
+
+WASM_EXPORT(payloadCapacity) usize payload_capacity() {
+	return payloadCapacity;
+}
+
+WASM_EXPORT(fillPayload) void fill_payload() {
+	for (usize i = 0; i < payloadCapacity; ++i)
+		payload[i] = static_cast<char>('a' + i % 26);
+}
+
+WASM_EXPORT(callScalar) void call_scalar(i32 count) {
+	for (i32 i = 0; i < count; ++i)
+		bench_scalar(i, count - i);
+}
+
+WASM_EXPORT(callByteView) void call_byte_view(i32 count, usize length) {
+	for (i32 i = 0; i < count; ++i)
+		bench_byte_view(payload, length);
+}
+
+WASM_EXPORT(callCachedView) void call_cached_view(i32 count, usize length) {
+	for (i32 i = 0; i < count; ++i)
+		bench_cached_view(payload, length);
+}
+
+WASM_EXPORT(callString) void call_string(i32 count, usize length) {
+	for (i32 i = 0; i < count; ++i)
+		bench_string(payload, length);
+}
+
+WASM_EXPORT(callGlArrow) void call_gl_arrow(i32 count) {
+	for (i32 i = 0; i < count; ++i)
+		bench_gl_arrow(0.f, 0.f, 0.f, 1.f);
+}
+
+WASM_EXPORT(callGlBound) void call_gl_bound(i32 count) {
+	for (i32 i = 0; i < count; ++i)
+		bench_gl_bound(0.f, 0.f, 0.f, 1.f);
+}
@@ -0,0 +1,64 @@
+#include "uniform_ring.h"
+
+#include "profile.h"
+
+namespace shrub {
+
+	namespace {
+
+		GLsizeiptr align_up(GLsizeiptr value, GLintptr alignment) {
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+	}
+
+	void UniformRing::init(Allocator *allocator, GLsizeiptr segmentSize_, i32 segmentCount_) {
+		// WebGL2 guarantees at most 256, but the spec only promises a positive value
+		alignment = gl_get_parameter(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT);
+		if (alignment <= 0)
+			alignment = 256;
+
+		segmentSize = align_up(segmentSize_, alignment);
+		segmentCount = segmentCount_;
+		segment = 0;
+		used = 0;
+
+		staging = allocate<u8>(allocator, segmentSize);
+
+		buffer = gl_create_buffer();
+		gl_bind_buffer(GL_UNIFORM_BUFFER, buffer);
+		gl_buffer_data(GL_UNIFORM_BUFFER, segmentSize * segmentCount, GL_DYNAMIC_DRAW);
+	}
+
+	void UniformRing::begin_frame(i32 segment_) {
+		assert(segment_ >= 0 && segment_ < segmentCount);
+		segment = segment_;
+		used = 0;
+	}
+
+	GLintptr UniformRing::push(void const *data, GLsizeiptr size) {
+		auto offset = align_up(used, alignment);
+		if (offset + size > segmentSize)
+			return -1;
+
+		__builtin_memcpy(staging + offset, data, static_cast<usize>(size));
+		used = offset + size;
+
+		return segment * segmentSize + offset;
+	}
+
+	void UniformRing::upload() {
+		if (!used)
+			return;
+
+		PROFILE_ZONE("uniform_upload");
+		gl_bind_buffer(GL_UNIFORM_BUFFER, buffer);
+		gl_buffer_sub_data(GL_UNIFORM_BUFFER, segment * segmentSize, staging, used);
+	}
+
+	void UniformRing::bind(GLuint index, GLintptr offset, GLsizeiptr size) const {
+		assert(offset >= 0 && offset % alignment == 0);
+		gl_bind_buffer_range(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+	}
+
+}
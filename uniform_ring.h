@@ -0,0 +1,43 @@
+#pragma once
+
+#include <oak_util/types.h>
+
+#include "web_gl.h"
+
+namespace shrub {
+
+	using namespace oak;
+
+	// One GL_UNIFORM_BUFFER split into a segment per virtual frame. Blocks for every draw in a frame are
+	// packed into a CPU copy of that frame's segment and uploaded with a single bufferSubData, draws then
+	// select their block with bindBufferRange. Reusing a segment is safe once the frame fence that last
+	// covered it has signalled, which begin_frame already waits for.
+	struct UniformRing {
+		int buffer = 0;
+		u8 *staging = nullptr;
+		GLintptr alignment = 0;
+		GLsizeiptr segmentSize = 0;
+		i32 segmentCount = 0;
+		i32 segment = 0;
+		GLsizeiptr used = 0;
+
+		void init(Allocator *allocator, GLsizeiptr segmentSize_, i32 segmentCount_);
+
+		void begin_frame(i32 segment_);
+
+		// Copies a std140 block into this frame's segment, returns its offset in buffer or -1 when the
+		// segment is full
+		GLintptr push(void const *data, GLsizeiptr size);
+
+		template<typename T>
+		GLintptr push(T const& block) {
+			return push(&block, sizeof(T));
+		}
+
+		// Uploads everything pushed since begin_frame, call before the first draw that binds a block
+		void upload();
+
+		void bind(GLuint index, GLintptr offset, GLsizeiptr size) const;
+	};
+
+}
@@ -0,0 +1,140 @@
+#include "upload_queue.h"
+
+#include "profile.h"
+
+namespace shrub {
+
+	void UploadQueue::init(Allocator *allocator, i32 capacity_, GLsizeiptr byteBudget_, f64 timeBudget_) {
+		capacity = capacity_;
+		items = allocate<UploadItem>(allocator, capacity);
+		count = 0;
+		frame = 0;
+		spent = 0;
+		stats = {};
+		set_budget(byteBudget_, timeBudget_);
+	}
+
+	void UploadQueue::begin_frame() {
+		++frame;
+		spent = 0;
+		stats.bytes = 0;
+		stats.directBytes = 0;
+		stats.calls = 0;
+	}
+
+	void UploadQueue::record_direct(GLsizeiptr bytes) {
+		stats.bytes += static_cast<u32>(bytes);
+		stats.directBytes += static_cast<u32>(bytes);
+	}
+
+	bool UploadQueue::queue_texture_rows(
+			u64 key, int texture, i32 width, i32 rowSize, GLenum format, u8 const *pixels, i32 rowBegin, i32 rowEnd) {
+		return queue({ key, texture, pixels, rowBegin, rowEnd, width, rowSize, format, frame });
+	}
+
+	bool UploadQueue::pending(u64 key, i64 *begin, i64 *end) const {
+		auto index = find(key);
+		if (index == -1)
+			return false;
+		*begin = items[index].next;
+		*end = items[index].end;
+		return true;
+	}
+
+	GLsizeiptr UploadQueue::flush() {
+		PROFILE_ZONE("upload_flush");
+		auto start = profile_now();
+
+		// Few items and mostly in order already
+		for (i32 i = 1; i < count; ++i) {
+			auto item = items[i];
+			auto j = i;
+			for (; j > 0 && item.frame < items[j - 1].frame; --j)
+				items[j] = items[j - 1];
+			items[j] = item;
+		}
+
+		GLsizeiptr uploaded = 0;
+		for (i32 i = 0; i < count; ++i) {
+			auto& item = items[i];
+			while (item.next < item.end) {
+				if (stats.calls && profile_now() - start >= timeBudget)
+					break;
+				auto allowance = byteBudget - spent;
+				if (allowance <= 0) {
+					if (stats.calls)
+						break;
+					allowance = minChunk;
+				}
+
+				// Whole rows keep the source contiguous, at least one goes
+				auto rows = allowance / item.rowSize;
+				rows = rows < 1 ? 1 : rows < item.end - item.next ? rows : item.end - item.next;
+				auto size = static_cast<GLsizeiptr>(rows * item.rowSize);
+				gl_bind_texture(GL_TEXTURE_2D, item.texture);
+				gl_tex_sub_image_2d(
+					GL_TEXTURE_2D, 0, 0, static_cast<GLint>(item.next), item.width, static_cast<GLsizei>(rows),
+					item.format, GL_UNSIGNED_BYTE, item.data + item.next * item.rowSize, size);
+				item.next += rows;
+				spent += size;
+				uploaded += size;
+				++stats.calls;
+			}
+		}
+
+		i32 kept = 0;
+		i64 queuedBytes = 0;
+		auto oldest = frame;
+		for (i32 i = 0; i < count; ++i) {
+			if (items[i].next >= items[i].end)
+				continue;
+			queuedBytes += (items[i].end - items[i].next) * items[i].rowSize;
+			oldest = items[i].frame < oldest ? items[i].frame : oldest;
+			items[kept++] = items[i];
+		}
+		count = kept;
+
+		++stats.frame;
+		stats.queueDepth = static_cast<u32>(count);
+		stats.queuedBytes = static_cast<u32>(queuedBytes);
+		stats.bytes += static_cast<u32>(uploaded);
+		stats.oldestWait = frame - oldest;
+		return uploaded;
+	}
+
+	void UploadQueue::set_budget(GLsizeiptr byteBudget_, f64 timeBudget_) {
+		byteBudget = byteBudget_;
+		timeBudget = timeBudget_;
+		stats.byteBudget = static_cast<u32>(byteBudget);
+	}
+
+	i32 UploadQueue::find(u64 key) const {
+		for (i32 i = 0; i < count; ++i) {
+			if (items[i].key == key)
+				return i;
+		}
+		return -1;
+	}
+
+	bool UploadQueue::queue(UploadItem const& item) {
+		if (item.next >= item.end)
+			return true;
+
+		auto index = find(item.key);
+		if (index == -1) {
+			if (count == capacity)
+				return false;
+			items[count++] = item;
+			return true;
+		}
+
+		// The owner's copy is current, so the union covers both and the older age is kept
+		auto& queued = items[index];
+		assert(queued.texture == item.texture);
+		queued.data = item.data;
+		queued.next = item.next < queued.next ? item.next : queued.next;
+		queued.end = item.end > queued.end ? item.end : queued.end;
+		return true;
+	}
+
+}
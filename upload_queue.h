@@ -0,0 +1,87 @@
+#pragma once
+
+#include <oak_util/types.h>
+
+#include "web_gl.h"
+
+namespace shrub {
+
+	using namespace oak;
+
+	struct UploadItem {
+		u64 key;
+		int texture;
+		// Owner's CPU copy of the whole texture
+		u8 const *data;
+		// Rows still to upload
+		i64 next;
+		i64 end;
+		// Rows are width texels of rowSize bytes
+		i32 width;
+		i32 rowSize;
+		GLenum format;
+		u32 frame;
+	};
+
+	// Every field is a u32 so the block maps onto a Uint32Array in JS
+	struct UploadStatsBlock {
+		u32 frame;
+		// Still queued once this frame's uploads are done
+		u32 queueDepth;
+		u32 queuedBytes;
+		// Uploaded this frame, direct uploads included
+		u32 bytes;
+		u32 directBytes;
+		u32 calls;
+		// Frames the oldest queued item has waited
+		u32 oldestWait;
+		u32 byteBudget;
+	};
+
+	// Spreads texture uploads over frames, so content that arrives all at once doesn't land in a single
+	// frame. flush uploads items oldest first, in row chunks, until the frame's byte or time budget runs
+	// out; the first chunk of a frame always goes so nothing starves. Items point at their owner's CPU
+	// copy, which must stay valid and current until they're done, and owners ask for what's pending to
+	// decide what to draw in the meantime.
+	struct UploadQueue {
+		// Least a frame uploads once the budget is spent, so big rows still make progress
+		static constexpr GLsizeiptr minChunk = 16 << 10;
+
+		UploadItem *items = nullptr;
+		i32 count = 0;
+		i32 capacity = 0;
+
+		GLsizeiptr byteBudget = 0;
+		// Milliseconds
+		f64 timeBudget = 0.0;
+		GLsizeiptr spent = 0;
+		u32 frame = 0;
+
+		UploadStatsBlock stats = {};
+
+		void init(Allocator *allocator, i32 capacity_, GLsizeiptr byteBudget_, f64 timeBudget_);
+
+		void begin_frame();
+
+		// Counts an upload made outside the queue in this frame's stats
+		void record_direct(GLsizeiptr bytes);
+
+		// Queues rows [rowBegin, rowEnd) of texture, pixels points at row 0. A queued item with the same key
+		// grows to cover both bands and keeps its age. Returns false when the queue is full.
+		bool queue_texture_rows(
+				u64 key, int texture, i32 width, i32 rowSize, GLenum format, u8 const *pixels, i32 rowBegin, i32 rowEnd);
+
+		// Rows of key not uploaded yet, false when nothing is
+		bool pending(u64 key, i64 *begin, i64 *end) const;
+
+		// Uploads within the budgets and fills in stats. Leaves the texture binding changed. Returns the
+		// number of bytes uploaded.
+		GLsizeiptr flush();
+
+		void set_budget(GLsizeiptr byteBudget_, f64 timeBudget_);
+
+		i32 find(u64 key) const;
+		bool queue(UploadItem const& item);
+	};
+
+}
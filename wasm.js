@@ -0,0 +1,44 @@
+export class WasmWrapper {
+
+  constructor(wasm) {
+    this.wasm = wasm;
+    this.memory = this.wasm.instance.exports.memory;
+    this.textDecoder = new TextDecoder();
+    for (const elem of Object.entries(this.wasm.instance.exports)) {
+      if (typeof elem[1] === 'function') {
+        this[elem[0]] = elem[1];
+      }
+    }
+    this.refreshViews();
+  }
+
+  // Growing memory detaches the old ArrayBuffer, every cached view must be rebuilt from the new one
+  refreshViews = () => {
+    const buffer = this.memory.buffer;
+    this.u8 = new Uint8Array(buffer);
+    this.u32 = new Uint32Array(buffer);
+    this.f32 = new Float32Array(buffer);
+    this.dataView = new DataView(buffer);
+  }
+
+  cStrToString = (cstr) => {
+    const end = this.u8.indexOf(0, cstr);
+    return this.textDecoder.decode(this.u8.subarray(cstr, end));
+  }
+
+  memToString = (str, length) => {
+    return this.textDecoder.decode(this.u8.subarray(str, str + length));
+  }
+
+  // Allocates a view per call, prefer indexing u8 directly or passing (u8, ptr, length) to WebGL
+  memToByteArray = (ptr, length) => {
+    return new Uint8Array(this.memory.buffer, ptr, length);
+  }
+
+  growMemory = (pages) => {
+    this.memory.grow(pages);
+    this.refreshViews();
+    console.log("grow memory, buffer length: ", this.memory.buffer.byteLength);
+  }
+
+};
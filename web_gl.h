@@ -696,47 +696,566 @@ enum GLenum: GLuint {
 	GL_MAX_CLIENT_WAIT_TIMEOUT_WEBGL                 = 0x9247,
 };
 
+enum GLProgramStatus : GLint {
+	GL_PROGRAM_STATUS_FAILED = -1,
+	GL_PROGRAM_STATUS_PENDING = 0,
+	GL_PROGRAM_STATUS_READY = 1,
+};
+
 #define GL_TIMEOUT_IGNORED                              = -1;
 
+#ifdef __wasm__
 #define WEBGL_IMPORT(name) extern "C" __attribute__((import_module("gl"), import_name(#name)))
+#else
+// Native builds (the benchmarks) provide their own definitions
+#define WEBGL_IMPORT(name) extern "C"
+#endif
 
-WEBGL_IMPORT(createVertexArray) int gl_create_vertex_array();
-WEBGL_IMPORT(deleteVertexArray) void gl_delete_vertex_array(int vao);
-WEBGL_IMPORT(bindVertexArray) void gl_bind_vertex_array(int vao);
-WEBGL_IMPORT(enableVertexAttribArray) void gl_enable_vertex_attrib_array(GLuint idx);
-WEBGL_IMPORT(disableVertexAttribArray) void gl_disable_vertex_attrib_array(GLuint idx);
-WEBGL_IMPORT(vertexAttribPointer) void gl_vertex_attrib_pointer(
+// Raw imports, call the gl_ wrappers below so the traffic shows up in GLStats
+WEBGL_IMPORT(createVertexArray) int webgl_create_vertex_array();
+WEBGL_IMPORT(deleteVertexArray) void webgl_delete_vertex_array(int vao);
+WEBGL_IMPORT(bindVertexArray) void webgl_bind_vertex_array(int vao);
+WEBGL_IMPORT(enableVertexAttribArray) void webgl_enable_vertex_attrib_array(GLuint idx);
+WEBGL_IMPORT(disableVertexAttribArray) void webgl_disable_vertex_attrib_array(GLuint idx);
+WEBGL_IMPORT(vertexAttribPointer) void webgl_vertex_attrib_pointer(
 		GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, GLintptr offset);
+WEBGL_IMPORT(vertexAttribDivisor) void webgl_vertex_attrib_divisor(GLuint index, GLuint divisor);
 
-WEBGL_IMPORT(createBuffer) int gl_create_buffer();
-WEBGL_IMPORT(deleteBuffer) void gl_delete_buffer(int buffer);
-WEBGL_IMPORT(bindBuffer) void gl_bind_buffer(GLenum target, int buffer);
-WEBGL_IMPORT(bindBufferRange) void gl_bind_buffer_range(
+WEBGL_IMPORT(createBuffer) int webgl_create_buffer();
+WEBGL_IMPORT(deleteBuffer) void webgl_delete_buffer(int buffer);
+WEBGL_IMPORT(bindBuffer) void webgl_bind_buffer(GLenum target, int buffer);
+WEBGL_IMPORT(bindBufferRange) void webgl_bind_buffer_range(
 		GLenum target, GLuint index, int buffer, GLintptr offset, GLsizeiptr size);
-WEBGL_IMPORT(bufferData) void gl_buffer_data(GLenum target, GLsizeiptr size, GLenum usage);
-WEBGL_IMPORT(bufferSubData) void gl_buffer_sub_data(
+WEBGL_IMPORT(bufferData) void webgl_buffer_data(GLenum target, GLsizeiptr size, GLenum usage);
+WEBGL_IMPORT(bufferSubData) void webgl_buffer_sub_data(
 		GLenum target, GLintptr offset, void const *data, GLsizeiptr size);
-WEBGL_IMPORT(copyBufferSubData) void gl_copy_buffer_sub_data(
+WEBGL_IMPORT(copyBufferSubData) void webgl_copy_buffer_sub_data(
 		GLenum readTarget, GLenum writeTarget, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size);
 
-WEBGL_IMPORT(attachShader) void gl_attach_shader(int program, int shader);
-WEBGL_IMPORT(compileShader) void gl_compile_shader(int shader);
-WEBGL_IMPORT(createProgram) int gl_create_program();
-WEBGL_IMPORT(createShader) int gl_create_shader(GLenum type);
-WEBGL_IMPORT(deleteProgram) void gl_delete_program(int program);
-WEBGL_IMPORT(deleteShader) void gl_delete_shader(int shader);
-WEBGL_IMPORT(detachShader) void gl_detach_shader(int program, int shader);
-WEBGL_IMPORT(linkProgram) void gl_link_program(int program);
-WEBGL_IMPORT(shaderSource) void gl_shader_source(int shader, char const *source, GLsizeiptr length);
-WEBGL_IMPORT(useProgram) void gl_use_program(int program);
-
-WEBGL_IMPORT(clear) void gl_clear(GLbitfield mask);
-WEBGL_IMPORT(clearColor) void gl_clear_color(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha);
-WEBGL_IMPORT(clearDepth) void gl_clear_depth(GLclampf depth);
-WEBGL_IMPORT(clearStencil) void gl_clear_stencil(GLint s);
-WEBGL_IMPORT(drawArrays) void gl_draw_arrays(GLenum mode, GLint first, GLsizei count);
-
-WEBGL_IMPORT(fenceSync) int gl_fence_sync(GLenum condition, GLbitfield flags);
-WEBGL_IMPORT(deleteSync) void gl_delete_sync(int sync);
-WEBGL_IMPORT(clientWaitSync) GLenum gl_client_wait_sync(int sync, GLbitfield flags, GLuint64 timeout);
+WEBGL_IMPORT(attachShader) void webgl_attach_shader(int program, int shader);
+WEBGL_IMPORT(compileShader) void webgl_compile_shader(int shader);
+WEBGL_IMPORT(createProgram) int webgl_create_program();
+WEBGL_IMPORT(createShader) int webgl_create_shader(GLenum type);
+WEBGL_IMPORT(deleteProgram) void webgl_delete_program(int program);
+WEBGL_IMPORT(deleteShader) void webgl_delete_shader(int shader);
+WEBGL_IMPORT(detachShader) void webgl_detach_shader(int program, int shader);
+WEBGL_IMPORT(linkProgram) void webgl_link_program(int program);
+WEBGL_IMPORT(shaderSource) void webgl_shader_source(int shader, char const *source, GLsizeiptr length);
+WEBGL_IMPORT(useProgram) void webgl_use_program(int program);
+// Non-blocking where KHR_parallel_shader_compile is available, see GLProgramStatus
+WEBGL_IMPORT(programStatus) GLint webgl_program_status(int program);
+
+WEBGL_IMPORT(createTexture) int webgl_create_texture();
+WEBGL_IMPORT(deleteTexture) void webgl_delete_texture(int texture);
+WEBGL_IMPORT(bindTexture) void webgl_bind_texture(GLenum target, int texture);
+// pixels may be null to only allocate storage, size is its length in bytes
+WEBGL_IMPORT(texImage2D) void webgl_tex_image_2d(
+		GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border,
+		GLenum format, GLenum type, void const *pixels, GLsizeiptr size);
+// Reads size bytes of pixels straight from wasm memory
+WEBGL_IMPORT(texSubImage2D) void webgl_tex_sub_image_2d(
+		GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
+		GLenum format, GLenum type, void const *pixels, GLsizeiptr size);
+WEBGL_IMPORT(texParameteri) void webgl_tex_parameteri(GLenum target, GLenum pname, GLint param);
+
+WEBGL_IMPORT(createFramebuffer) int webgl_create_framebuffer();
+WEBGL_IMPORT(deleteFramebuffer) void webgl_delete_framebuffer(int framebuffer);
+WEBGL_IMPORT(bindFramebuffer) void webgl_bind_framebuffer(GLenum target, int framebuffer);
+WEBGL_IMPORT(framebufferTexture2D) void webgl_framebuffer_texture_2d(
+		GLenum target, GLenum attachment, GLenum textarget, int texture, GLint level);
+
+WEBGL_IMPORT(createRenderbuffer) int webgl_create_renderbuffer();
+WEBGL_IMPORT(deleteRenderbuffer) void webgl_delete_renderbuffer(int renderbuffer);
+WEBGL_IMPORT(bindRenderbuffer) void webgl_bind_renderbuffer(GLenum target, int renderbuffer);
+WEBGL_IMPORT(renderbufferStorage) void webgl_renderbuffer_storage(
+		GLenum target, GLenum internalFormat, GLsizei width, GLsizei height);
+WEBGL_IMPORT(framebufferRenderbuffer) void webgl_framebuffer_renderbuffer(
+		GLenum target, GLenum attachment, GLenum renderbufferTarget, int renderbuffer);
+
+WEBGL_IMPORT(clear) void webgl_clear(GLbitfield mask);
+WEBGL_IMPORT(clearColor) void webgl_clear_color(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha);
+WEBGL_IMPORT(clearDepth) void webgl_clear_depth(GLclampf depth);
+WEBGL_IMPORT(clearStencil) void webgl_clear_stencil(GLint s);
+WEBGL_IMPORT(drawArrays) void webgl_draw_arrays(GLenum mode, GLint first, GLsizei count);
+WEBGL_IMPORT(drawArraysInstanced) void webgl_draw_arrays_instanced(
+		GLenum mode, GLint first, GLsizei count, GLsizei instanceCount);
+
+WEBGL_IMPORT(enable) void webgl_enable(GLenum cap);
+WEBGL_IMPORT(disable) void webgl_disable(GLenum cap);
+WEBGL_IMPORT(scissor) void webgl_scissor(GLint x, GLint y, GLsizei width, GLsizei height);
+WEBGL_IMPORT(viewport) void webgl_viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+WEBGL_IMPORT(blendFunc) void webgl_blend_func(GLenum sfactor, GLenum dfactor);
+WEBGL_IMPORT(depthFunc) void webgl_depth_func(GLenum func);
+WEBGL_IMPORT(depthMask) void webgl_depth_mask(GLboolean flag);
+
+WEBGL_IMPORT(fenceSync) int webgl_fence_sync(GLenum condition, GLbitfield flags);
+WEBGL_IMPORT(deleteSync) void webgl_delete_sync(int sync);
+WEBGL_IMPORT(clientWaitSync) GLenum webgl_client_wait_sync(int sync, GLbitfield flags, GLuint64 timeout);
+
+// Integer state only, e.g. GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT. Round-trips to the driver, query once at init
+WEBGL_IMPORT(getParameter) GLint webgl_get_parameter(GLenum pname);
+
+enum GLFunction : GLuint {
+	GL_FN_CREATE_VERTEX_ARRAY,
+	GL_FN_DELETE_VERTEX_ARRAY,
+	GL_FN_BIND_VERTEX_ARRAY,
+	GL_FN_ENABLE_VERTEX_ATTRIB_ARRAY,
+	GL_FN_DISABLE_VERTEX_ATTRIB_ARRAY,
+	GL_FN_VERTEX_ATTRIB_POINTER,
+	GL_FN_VERTEX_ATTRIB_DIVISOR,
+	GL_FN_CREATE_BUFFER,
+	GL_FN_DELETE_BUFFER,
+	GL_FN_BIND_BUFFER,
+	GL_FN_BIND_BUFFER_RANGE,
+	GL_FN_BUFFER_DATA,
+	GL_FN_BUFFER_SUB_DATA,
+	GL_FN_COPY_BUFFER_SUB_DATA,
+	GL_FN_ATTACH_SHADER,
+	GL_FN_COMPILE_SHADER,
+	GL_FN_CREATE_PROGRAM,
+	GL_FN_CREATE_SHADER,
+	GL_FN_DELETE_PROGRAM,
+	GL_FN_DELETE_SHADER,
+	GL_FN_DETACH_SHADER,
+	GL_FN_LINK_PROGRAM,
+	GL_FN_SHADER_SOURCE,
+	GL_FN_USE_PROGRAM,
+	GL_FN_PROGRAM_STATUS,
+	GL_FN_CREATE_TEXTURE,
+	GL_FN_DELETE_TEXTURE,
+	GL_FN_BIND_TEXTURE,
+	GL_FN_TEX_IMAGE_2D,
+	GL_FN_TEX_SUB_IMAGE_2D,
+	GL_FN_TEX_PARAMETERI,
+	GL_FN_CREATE_FRAMEBUFFER,
+	GL_FN_DELETE_FRAMEBUFFER,
+	GL_FN_BIND_FRAMEBUFFER,
+	GL_FN_FRAMEBUFFER_TEXTURE_2D,
+	GL_FN_CREATE_RENDERBUFFER,
+	GL_FN_DELETE_RENDERBUFFER,
+	GL_FN_BIND_RENDERBUFFER,
+	GL_FN_RENDERBUFFER_STORAGE,
+	GL_FN_FRAMEBUFFER_RENDERBUFFER,
+	GL_FN_CLEAR,
+	GL_FN_CLEAR_COLOR,
+	GL_FN_CLEAR_DEPTH,
+	GL_FN_CLEAR_STENCIL,
+	GL_FN_DRAW_ARRAYS,
+	GL_FN_DRAW_ARRAYS_INSTANCED,
+	GL_FN_ENABLE,
+	GL_FN_DISABLE,
+	GL_FN_SCISSOR,
+	GL_FN_VIEWPORT,
+	GL_FN_BLEND_FUNC,
+	GL_FN_DEPTH_FUNC,
+	GL_FN_DEPTH_MASK,
+	GL_FN_FENCE_SYNC,
+	GL_FN_DELETE_SYNC,
+	GL_FN_CLIENT_WAIT_SYNC,
+	GL_FN_GET_PARAMETER,
+	GL_FN_COUNT,
+};
+
+// Per-frame WebGL traffic, the last completed frame is kept in glStats so JS can read it straight
+// out of wasm memory. Every field is a GLuint so the block maps onto a Uint32Array.
+struct GLStats {
+	GLuint frame;
+	GLuint drawCalls;
+	GLuint vertices;
+	GLuint bufferSubDataBytes;
+	GLuint copyBufferSubDataBytes;
+	GLuint calls[GL_FN_COUNT];
+};
+
+#ifdef SHRUB_GL_STATS
+
+inline GLStats glStatsFrame;
+inline GLStats glStats;
+
+#define GL_STATS_CALL(fn) (++glStatsFrame.calls[fn])
+#define GL_STATS_ADD(field, value) (glStatsFrame.field += static_cast<GLuint>(value))
+
+inline void gl_stats_end_frame() {
+	glStatsFrame.frame = glStats.frame + 1;
+	glStats = glStatsFrame;
+	glStatsFrame = {};
+}
+
+#else
+
+#define GL_STATS_CALL(fn) ((void)0)
+#define GL_STATS_ADD(field, value) ((void)0)
+
+inline void gl_stats_end_frame() {}
+
+#endif
+
+// Object handles pack a slot index with the slot generation, see GLHandleTable in index.js. 0 is null.
+#define GL_HANDLE_INDEX_BITS 20
+#define GL_HANDLE_INDEX_MASK ((1 << GL_HANDLE_INDEX_BITS) - 1)
+
+#ifndef NDEBUG
+
+#ifndef GL_HANDLE_DEBUG_CAPACITY
+#define GL_HANDLE_DEBUG_CAPACITY 4096
+#endif
+
+// The live handle of every slot, a deleted or stale handle no longer matches its slot
+inline int glLiveHandles[GL_HANDLE_DEBUG_CAPACITY];
+
+inline bool gl_handle_valid(int handle) {
+	auto index = handle & GL_HANDLE_INDEX_MASK;
+	return handle == 0 || index >= GL_HANDLE_DEBUG_CAPACITY || glLiveHandles[index] == handle;
+}
+
+inline int gl_handle_track(int handle) {
+	auto index = handle & GL_HANDLE_INDEX_MASK;
+	if (index < GL_HANDLE_DEBUG_CAPACITY)
+		glLiveHandles[index] = handle;
+	return handle;
+}
+
+inline void gl_handle_release(int handle) {
+	assert(gl_handle_valid(handle));
+	auto index = handle & GL_HANDLE_INDEX_MASK;
+	if (index < GL_HANDLE_DEBUG_CAPACITY)
+		glLiveHandles[index] = 0;
+}
+
+#define GL_HANDLE_CHECK(handle) assert(gl_handle_valid(handle))
+
+#else
+
+inline int gl_handle_track(int handle) {
+	return handle;
+}
+
+inline void gl_handle_release(int) {}
+
+#define GL_HANDLE_CHECK(handle) ((void)0)
+
+#endif
+
+inline int gl_create_vertex_array() {
+	GL_STATS_CALL(GL_FN_CREATE_VERTEX_ARRAY);
+	return gl_handle_track(webgl_create_vertex_array());
+}
+
+inline void gl_delete_vertex_array(int vao) {
+	GL_STATS_CALL(GL_FN_DELETE_VERTEX_ARRAY);
+	gl_handle_release(vao);
+	webgl_delete_vertex_array(vao);
+}
+
+inline void gl_bind_vertex_array(int vao) {
+	GL_STATS_CALL(GL_FN_BIND_VERTEX_ARRAY);
+	GL_HANDLE_CHECK(vao);
+	webgl_bind_vertex_array(vao);
+}
+
+inline void gl_enable_vertex_attrib_array(GLuint idx) {
+	GL_STATS_CALL(GL_FN_ENABLE_VERTEX_ATTRIB_ARRAY);
+	webgl_enable_vertex_attrib_array(idx);
+}
+
+inline void gl_disable_vertex_attrib_array(GLuint idx) {
+	GL_STATS_CALL(GL_FN_DISABLE_VERTEX_ATTRIB_ARRAY);
+	webgl_disable_vertex_attrib_array(idx);
+}
+
+inline void gl_vertex_attrib_pointer(
+		GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, GLintptr offset) {
+	GL_STATS_CALL(GL_FN_VERTEX_ATTRIB_POINTER);
+	webgl_vertex_attrib_pointer(index, size, type, normalized, stride, offset);
+}
+
+inline void gl_vertex_attrib_divisor(GLuint index, GLuint divisor) {
+	GL_STATS_CALL(GL_FN_VERTEX_ATTRIB_DIVISOR);
+	webgl_vertex_attrib_divisor(index, divisor);
+}
+
+inline int gl_create_buffer() {
+	GL_STATS_CALL(GL_FN_CREATE_BUFFER);
+	return gl_handle_track(webgl_create_buffer());
+}
+
+inline void gl_delete_buffer(int buffer) {
+	GL_STATS_CALL(GL_FN_DELETE_BUFFER);
+	gl_handle_release(buffer);
+	webgl_delete_buffer(buffer);
+}
+
+inline void gl_bind_buffer(GLenum target, int buffer) {
+	GL_STATS_CALL(GL_FN_BIND_BUFFER);
+	GL_HANDLE_CHECK(buffer);
+	webgl_bind_buffer(target, buffer);
+}
+
+inline void gl_bind_buffer_range(
+		GLenum target, GLuint index, int buffer, GLintptr offset, GLsizeiptr size) {
+	GL_STATS_CALL(GL_FN_BIND_BUFFER_RANGE);
+	GL_HANDLE_CHECK(buffer);
+	webgl_bind_buffer_range(target, index, buffer, offset, size);
+}
+
+inline void gl_buffer_data(GLenum target, GLsizeiptr size, GLenum usage) {
+	GL_STATS_CALL(GL_FN_BUFFER_DATA);
+	webgl_buffer_data(target, size, usage);
+}
+
+inline void gl_buffer_sub_data(GLenum target, GLintptr offset, void const *data, GLsizeiptr size) {
+	GL_STATS_CALL(GL_FN_BUFFER_SUB_DATA);
+	GL_STATS_ADD(bufferSubDataBytes, size);
+	webgl_buffer_sub_data(target, offset, data, size);
+}
+
+inline void gl_copy_buffer_sub_data(
+		GLenum readTarget, GLenum writeTarget, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size) {
+	GL_STATS_CALL(GL_FN_COPY_BUFFER_SUB_DATA);
+	GL_STATS_ADD(copyBufferSubDataBytes, size);
+	webgl_copy_buffer_sub_data(readTarget, writeTarget, readOffset, writeOffset, size);
+}
+
+inline void gl_attach_shader(int program, int shader) {
+	GL_STATS_CALL(GL_FN_ATTACH_SHADER);
+	GL_HANDLE_CHECK(program);
+	GL_HANDLE_CHECK(shader);
+	webgl_attach_shader(program, shader);
+}
+
+inline void gl_compile_shader(int shader) {
+	GL_STATS_CALL(GL_FN_COMPILE_SHADER);
+	GL_HANDLE_CHECK(shader);
+	webgl_compile_shader(shader);
+}
+
+inline int gl_create_program() {
+	GL_STATS_CALL(GL_FN_CREATE_PROGRAM);
+	return gl_handle_track(webgl_create_program());
+}
+
+inline int gl_create_shader(GLenum type) {
+	GL_STATS_CALL(GL_FN_CREATE_SHADER);
+	return gl_handle_track(webgl_create_shader(type));
+}
+
+inline void gl_delete_program(int program) {
+	GL_STATS_CALL(GL_FN_DELETE_PROGRAM);
+	gl_handle_release(program);
+	webgl_delete_program(program);
+}
+
+inline void gl_delete_shader(int shader) {
+	GL_STATS_CALL(GL_FN_DELETE_SHADER);
+	gl_handle_release(shader);
+	webgl_delete_shader(shader);
+}
+
+inline void gl_detach_shader(int program, int shader) {
+	GL_STATS_CALL(GL_FN_DETACH_SHADER);
+	GL_HANDLE_CHECK(program);
+	GL_HANDLE_CHECK(shader);
+	webgl_detach_shader(program, shader);
+}
+
+inline void gl_link_program(int program) {
+	GL_STATS_CALL(GL_FN_LINK_PROGRAM);
+	GL_HANDLE_CHECK(program);
+	webgl_link_program(program);
+}
+
+inline void gl_shader_source(int shader, char const *source, GLsizeiptr length) {
+	GL_STATS_CALL(GL_FN_SHADER_SOURCE);
+	GL_HANDLE_CHECK(shader);
+	webgl_shader_source(shader, source, length);
+}
+
+inline void gl_use_program(int program) {
+	GL_STATS_CALL(GL_FN_USE_PROGRAM);
+	GL_HANDLE_CHECK(program);
+	webgl_use_program(program);
+}
+
+inline GLint gl_program_status(int program) {
+	GL_STATS_CALL(GL_FN_PROGRAM_STATUS);
+	GL_HANDLE_CHECK(program);
+	return webgl_program_status(program);
+}
+
+inline int gl_create_texture() {
+	GL_STATS_CALL(GL_FN_CREATE_TEXTURE);
+	return gl_handle_track(webgl_create_texture());
+}
+
+inline void gl_delete_texture(int texture) {
+	GL_STATS_CALL(GL_FN_DELETE_TEXTURE);
+	gl_handle_release(texture);
+	webgl_delete_texture(texture);
+}
+
+inline void gl_bind_texture(GLenum target, int texture) {
+	GL_STATS_CALL(GL_FN_BIND_TEXTURE);
+	GL_HANDLE_CHECK(texture);
+	webgl_bind_texture(target, texture);
+}
+
+inline void gl_tex_image_2d(
+		GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border,
+		GLenum format, GLenum type, void const *pixels, GLsizeiptr size) {
+	GL_STATS_CALL(GL_FN_TEX_IMAGE_2D);
+	webgl_tex_image_2d(target, level, internalFormat, width, height, border, format, type, pixels, size);
+}
+
+inline void gl_tex_sub_image_2d(
+		GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
+		GLenum format, GLenum type, void const *pixels, GLsizeiptr size) {
+	GL_STATS_CALL(GL_FN_TEX_SUB_IMAGE_2D);
+	webgl_tex_sub_image_2d(target, level, xoffset, yoffset, width, height, format, type, pixels, size);
+}
+
+inline void gl_tex_parameteri(GLenum target, GLenum pname, GLint param) {
+	GL_STATS_CALL(GL_FN_TEX_PARAMETERI);
+	webgl_tex_parameteri(target, pname, param);
+}
+
+inline int gl_create_framebuffer() {
+	GL_STATS_CALL(GL_FN_CREATE_FRAMEBUFFER);
+	return gl_handle_track(webgl_create_framebuffer());
+}
+
+inline void gl_delete_framebuffer(int framebuffer) {
+	GL_STATS_CALL(GL_FN_DELETE_FRAMEBUFFER);
+	gl_handle_release(framebuffer);
+	webgl_delete_framebuffer(framebuffer);
+}
+
+inline void gl_bind_framebuffer(GLenum target, int framebuffer) {
+	GL_STATS_CALL(GL_FN_BIND_FRAMEBUFFER);
+	GL_HANDLE_CHECK(framebuffer);
+	webgl_bind_framebuffer(target, framebuffer);
+}
+
+inline void gl_framebuffer_texture_2d(GLenum target, GLenum attachment, GLenum textarget, int texture, GLint level) {
+	GL_STATS_CALL(GL_FN_FRAMEBUFFER_TEXTURE_2D);
+	GL_HANDLE_CHECK(texture);
+	webgl_framebuffer_texture_2d(target, attachment, textarget, texture, level);
+}
+
+inline int gl_create_renderbuffer() {
+	GL_STATS_CALL(GL_FN_CREATE_RENDERBUFFER);
+	return gl_handle_track(webgl_create_renderbuffer());
+}
+
+inline void gl_delete_renderbuffer(int renderbuffer) {
+	GL_STATS_CALL(GL_FN_DELETE_RENDERBUFFER);
+	gl_handle_release(renderbuffer);
+	webgl_delete_renderbuffer(renderbuffer);
+}
+
+inline void gl_bind_renderbuffer(GLenum target, int renderbuffer) {
+	GL_STATS_CALL(GL_FN_BIND_RENDERBUFFER);
+	GL_HANDLE_CHECK(renderbuffer);
+	webgl_bind_renderbuffer(target, renderbuffer);
+}
+
+inline void gl_renderbuffer_storage(GLenum target, GLenum internalFormat, GLsizei width, GLsizei height) {
+	GL_STATS_CALL(GL_FN_RENDERBUFFER_STORAGE);
+	webgl_renderbuffer_storage(target, internalFormat, width, height);
+}
+
+inline void gl_framebuffer_renderbuffer(GLenum target, GLenum attachment, GLenum renderbufferTarget, int renderbuffer) {
+	GL_STATS_CALL(GL_FN_FRAMEBUFFER_RENDERBUFFER);
+	GL_HANDLE_CHECK(renderbuffer);
+	webgl_framebuffer_renderbuffer(target, attachment, renderbufferTarget, renderbuffer);
+}
+
+inline void gl_clear(GLbitfield mask) {
+	GL_STATS_CALL(GL_FN_CLEAR);
+	webgl_clear(mask);
+}
+
+inline void gl_clear_color(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha) {
+	GL_STATS_CALL(GL_FN_CLEAR_COLOR);
+	webgl_clear_color(red, green, blue, alpha);
+}
+
+inline void gl_clear_depth(GLclampf depth) {
+	GL_STATS_CALL(GL_FN_CLEAR_DEPTH);
+	webgl_clear_depth(depth);
+}
+
+inline void gl_clear_stencil(GLint s) {
+	GL_STATS_CALL(GL_FN_CLEAR_STENCIL);
+	webgl_clear_stencil(s);
+}
+
+inline void gl_draw_arrays(GLenum mode, GLint first, GLsizei count) {
+	GL_STATS_CALL(GL_FN_DRAW_ARRAYS);
+	GL_STATS_ADD(drawCalls, 1);
+	GL_STATS_ADD(vertices, count);
+	webgl_draw_arrays(mode, first, count);
+}
+
+inline void gl_draw_arrays_instanced(GLenum mode, GLint first, GLsizei count, GLsizei instanceCount) {
+	GL_STATS_CALL(GL_FN_DRAW_ARRAYS_INSTANCED);
+	GL_STATS_ADD(drawCalls, 1);
+	GL_STATS_ADD(vertices, count * instanceCount);
+	webgl_draw_arrays_instanced(mode, first, count, instanceCount);
+}
+
+inline void gl_enable(GLenum cap) {
+	GL_STATS_CALL(GL_FN_ENABLE);
+	webgl_enable(cap);
+}
+
+inline void gl_disable(GLenum cap) {
+	GL_STATS_CALL(GL_FN_DISABLE);
+	webgl_disable(cap);
+}
+
+inline void gl_scissor(GLint x, GLint y, GLsizei width, GLsizei height) {
+	GL_STATS_CALL(GL_FN_SCISSOR);
+	webgl_scissor(x, y, width, height);
+}
+
+inline void gl_viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+	GL_STATS_CALL(GL_FN_VIEWPORT);
+	webgl_viewport(x, y, width, height);
+}
+
+inline void gl_blend_func(GLenum sfactor, GLenum dfactor) {
+	GL_STATS_CALL(GL_FN_BLEND_FUNC);
+	webgl_blend_func(sfactor, dfactor);
+}
+
+inline void gl_depth_func(GLenum func) {
+	GL_STATS_CALL(GL_FN_DEPTH_FUNC);
+	webgl_depth_func(func);
+}
+
+inline void gl_depth_mask(GLboolean flag) {
+	GL_STATS_CALL(GL_FN_DEPTH_MASK);
+	webgl_depth_mask(flag);
+}
+
+inline int gl_fence_sync(GLenum condition, GLbitfield flags) {
+	GL_STATS_CALL(GL_FN_FENCE_SYNC);
+	return gl_handle_track(webgl_fence_sync(condition, flags));
+}
+
+inline void gl_delete_sync(int sync) {
+	GL_STATS_CALL(GL_FN_DELETE_SYNC);
+	gl_handle_release(sync);
+	webgl_delete_sync(sync);
+}
+
+inline GLenum gl_client_wait_sync(int sync, GLbitfield flags, GLuint64 timeout) {
+	GL_STATS_CALL(GL_FN_CLIENT_WAIT_SYNC);
+	GL_HANDLE_CHECK(sync);
+	return webgl_client_wait_sync(sync, flags, timeout);
+}
 
+inline GLint gl_get_parameter(GLenum pname) {
+	GL_STATS_CALL(GL_FN_GET_PARAMETER);
+	return webgl_get_parameter(pname);
+}